@@ -0,0 +1,142 @@
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include <argparse/argparse.hpp>
+#include <fmt/core.h>
+
+#include "sung/imgref/filesys.hpp"
+#include "sung/imgref/img_refinery.hpp"
+
+
+namespace {
+
+    namespace fs = std::filesystem;
+    using Backend = sung::oiio::EncoderBackend;
+    using Harbor = sung::oiio::ImageExportHarbor;
+    using BuildFunc = std::function<std::string(Harbor&)>;
+
+
+    struct BenchResult {
+        double avg_ms_ = 0;
+        size_t bytes_ = 0;
+        std::string error_;
+    };
+
+
+    const char* backend_name(Backend backend) {
+        switch (backend) {
+            case Backend::oiio:
+                return "oiio";
+            case Backend::native:
+                return "native";
+        }
+        return "?";
+    }
+
+    BenchResult run_bench(
+        Backend backend, int iterations, const BuildFunc& fn
+    ) {
+        using clock_t = std::chrono::steady_clock;
+
+        BenchResult out;
+        double total_ms = 0;
+        for (int i = 0; i < iterations; ++i) {
+            Harbor harbor(backend);
+            const auto start = clock_t::now();
+            const auto err = fn(harbor);
+            const auto end = clock_t::now();
+            if (!err.empty()) {
+                out.error_ = err;
+                return out;
+            }
+
+            total_ms += std::chrono::duration<double, std::milli>(end - start)
+                            .count();
+            out.bytes_ = harbor.pick_the_smallest()->second.data_.size();
+        }
+
+        out.avg_ms_ = total_ms / iterations;
+        return out;
+    }
+
+    void bench_file(const fs::path& path, int iterations) {
+        auto img = sung::oiio::open_img(path);
+        if (!img) {
+            fmt::print(" * {}: {}\n", sung::make_utf8_str(path), img.error());
+            return;
+        }
+
+        auto opaque = sung::oiio::drop_alpha_ch(**img);
+        if (!opaque) {
+            fmt::print(
+                " * {}: {}\n", sung::make_utf8_str(path), opaque.error()
+            );
+            return;
+        }
+
+        const std::vector<std::pair<std::string, BuildFunc>> cases{
+            { "png 9",
+              [&](Harbor& h) { return h.build_png("png", **img, 9); } },
+            { "jpeg 80",
+              [&](Harbor& h) { return h.build_jpeg("jpeg", **opaque, 80); } },
+            { "webp 80",
+              [&](Harbor& h) { return h.build_webp("webp", **img, 80); } },
+            { "webp lossless",
+              [&](Harbor& h) { return h.build_webp_lossless("webp", **img); } },
+        };
+
+        fmt::print("{}\n", sung::make_utf8_str(path));
+        for (const auto& [name, fn] : cases) {
+            for (const auto backend : { Backend::oiio, Backend::native }) {
+                const auto res = ::run_bench(backend, iterations, fn);
+                if (!res.error_.empty()) {
+                    fmt::print(
+                        "  {:<14} {:<7} error: {}\n",
+                        name,
+                        ::backend_name(backend),
+                        res.error_
+                    );
+                    continue;
+                }
+
+                fmt::print(
+                    "  {:<14} {:<7} {:>10.2f} ms {:>12} bytes\n",
+                    name,
+                    ::backend_name(backend),
+                    res.avg_ms_,
+                    res.bytes_
+                );
+            }
+        }
+    }
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser p("Image Refinery encoder benchmark");
+
+    std::vector<std::string> inputs;
+    p.add_argument("inputs")
+        .help("Input image file paths")
+        .append()
+        .store_into(inputs);
+
+    int iterations = 5;
+    p.add_argument("-n", "--iterations")
+        .help("Encode repetitions per case")
+        .default_value(5)
+        .store_into(iterations);
+
+    try {
+        p.parse_args(argc, argv);
+    } catch (const std::exception& err) {
+        fmt::print("{}\n", err.what());
+        return 1;
+    }
+
+    for (const auto& x : inputs) ::bench_file(fs::u8path(x), iterations);
+
+    return 0;
+}
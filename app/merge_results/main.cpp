@@ -0,0 +1,62 @@
+#include <string>
+#include <vector>
+
+#include <argparse/argparse.hpp>
+#include <fmt/core.h>
+
+#include "sung/imgref/result_log.hpp"
+
+
+namespace {
+
+    namespace fs = std::filesystem;
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser p("Image Refinery result log merger");
+
+    std::vector<std::string> inputs;
+    p.add_argument("inputs")
+        .help("Result logs written by reduce_img --shard ... --result-log")
+        .append()
+        .store_into(inputs);
+
+    std::string output;
+    p.add_argument("-o", "--output")
+        .help("Merged result log path")
+        .required()
+        .store_into(output);
+
+    try {
+        p.parse_args(argc, argv);
+    } catch (const std::exception& err) {
+        fmt::print("{}\n", err.what());
+        return 1;
+    }
+
+    std::vector<fs::path> input_paths;
+    for (const auto& x : inputs) input_paths.push_back(fs::u8path(x));
+
+    sung::ResultSink::Summary summary;
+    const auto err = sung::merge_result_logs(
+        input_paths, fs::u8path(output), &summary
+    );
+    if (!err.empty()) {
+        fmt::print("{}\n", err);
+        return 1;
+    }
+
+    uint64_t total = 0;
+    for (const auto& [outcome, count] : summary.outcomes_) {
+        fmt::print("{}: {}\n", sung::to_str(outcome), count);
+        total += count;
+    }
+    fmt::print(
+        "{} files, {:.1f} MB saved\n",
+        total,
+        (static_cast<double>(summary.src_bytes_) - summary.dst_bytes_) / 1e6
+    );
+    return 0;
+}
@@ -0,0 +1,58 @@
+#!/usr/bin/env bash
+# Runs several reduce_img shards at once over one folder, merges their
+# result logs and checks that every input was handled by exactly one shard.
+#
+# Usage: shard_test.sh <reduce_img> <merge_results> <work dir> [shards]
+
+set -euo pipefail
+
+reduce_img=$1
+merge_results=$2
+work=$3
+shards=${4:-3}
+files=12
+
+fail() {
+    echo "FAIL: $*"
+    exit 1
+}
+
+rm -rf "$work"
+mkdir -p "$work/in/sub"
+
+# 16x16 RGB gradient
+png=iVBORw0KGgoAAAANSUhEUgAAABAAAAAQCAIAAACQkWg2AAAAHUlEQVR42mNkYGgQYGAgHrEwCDCQBEY1jGoYOhoAHgoCnoxpJwYAAAAASUVORK5CYII=
+for ((i = 0; i < files; ++i)); do
+    dir=$work/in
+    ((i % 2)) && dir=$work/in/sub
+    echo "$png" | base64 -d > "$dir/$i.png"
+done
+
+pids=()
+for ((i = 0; i < shards; ++i)); do
+    "$reduce_img" -r -q --shard "$i/$shards" -o "$work/out" \
+        --result-log "$work/shard_$i.jsonl" "$work/in" > /dev/null &
+    pids+=($!)
+done
+for pid in "${pids[@]}"; do
+    wait "$pid" || fail "a shard exited with an error"
+done
+
+"$merge_results" -o "$work/merged.jsonl" "$work"/shard_*.jsonl > /dev/null
+
+list_paths() {
+    grep -o '"path":"[^"]*"' "$@" | sed 's/.*"path"://' | sort
+}
+
+all=$(cat "$work"/shard_*.jsonl | list_paths)
+[[ $(echo "$all" | wc -l) -eq $files ]] ||
+    fail "shards logged $(echo "$all" | wc -l) records for $files files"
+[[ $(echo "$all" | sort -u | wc -l) -eq $files ]] ||
+    fail "a file was handled by more than one shard"
+[[ $(list_paths "$work/merged.jsonl") == "$all" ]] ||
+    fail "the merged log is not the union of the shard logs"
+
+compgen -G "$work/out_*" > /dev/null &&
+    fail "shards wrote into more than one output folder"
+
+echo "OK: $files files over $shards shards"
@@ -0,0 +1,472 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <argparse/argparse.hpp>
+#include <fmt/core.h>
+#include <BS_thread_pool.hpp>
+
+#include "sung/imgref/filesys.hpp"
+#include "sung/imgref/governor.hpp"
+#include "sung/imgref/img_refinery.hpp"
+#include "sung/imgref/metrics.hpp"
+#include "sung/imgref/native_codec.hpp"
+#include "sung/imgref/refinery.hpp"
+
+
+namespace {
+
+    namespace fs = std::filesystem;
+    using Metrics = std::map<std::string, double>;
+
+
+    // Timings below this differ by noise alone
+    constexpr double STAGE_SLACK_MS = 0.5;
+
+
+    struct MetricSpec {
+        const char* name_;
+        bool higher_is_better_;
+        bool is_stage_;
+    };
+
+    constexpr MetricSpec METRIC_SPECS[] = {
+        { "files_per_sec", true, false },
+        { "decode_ms", false, true },
+        { "resize_ms", false, true },
+        { "encode_ms", false, true },
+        { "write_ms", false, true },
+        { "peak_rss_mb", false, false },
+    };
+
+
+    struct CorpusSpec {
+        int files_ = 24;
+        uint32_t seed_ = 1;
+    };
+
+
+    // Gradients, stripes and a little noise, so neither codec gets a
+    // trivially compressible input. Only raw mt19937 output is used since
+    // distributions differ between standard libraries.
+    std::vector<uint8_t> make_pixels(
+        int width, int height, int nchannels, std::mt19937& rng
+    ) {
+        std::vector<uint8_t> out(
+            static_cast<size_t>(width) * height * nchannels
+        );
+        const auto period = 8 + static_cast<int>(rng() % 56);
+        const auto hole_x = static_cast<int>(rng() % width);
+        const auto hole_y = static_cast<int>(rng() % height);
+
+        size_t i = 0;
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                const auto noise = static_cast<int>(rng() & 7);
+                const auto stripe = ((x + y) / period) % 2 ? 24 : 0;
+                out[i++] = (x * 255 / width + noise) & 0xFF;
+                out[i++] = (y * 255 / height + stripe) & 0xFF;
+                out[i++] = ((x ^ y) & 0x3F) + 96 + noise;
+                if (nchannels == 4) {
+                    const auto hole = std::abs(x - hole_x) < width / 4 &&
+                                      std::abs(y - hole_y) < height / 4;
+                    out[i++] = hole ? 0 : 255;
+                }
+            }
+        }
+        return out;
+    }
+
+    // Deterministic for a given spec, so runs and machines compare
+    std::string make_corpus(
+        const fs::path& dir,
+        const CorpusSpec& spec,
+        std::vector<fs::path>& files
+    ) {
+        std::error_code ec;
+        fs::remove_all(dir, ec);
+        fs::create_directories(dir, ec);
+        if (ec)
+            return fmt::format("Failed to create corpus: {}", ec.message());
+
+        std::mt19937 rng(spec.seed_);
+        for (int i = 0; i < spec.files_; ++i) {
+            const auto width = 480 + static_cast<int>(rng() % 5) * 240;
+            const auto height = 360 + static_cast<int>(rng() % 5) * 180;
+            // Photo-like JPEG, opaque PNG, PNG with transparent holes
+            const auto kind = i % 3;
+            const auto nchannels = kind == 2 ? 4 : 3;
+            const auto pixels = ::make_pixels(width, height, nchannels, rng);
+
+            sung::codec::PixelView view;
+            view.data_ = pixels.data();
+            view.width_ = width;
+            view.height_ = height;
+            view.nchannels_ = nchannels;
+            view.row_stride_ = static_cast<std::ptrdiff_t>(width) *
+                               nchannels;
+
+            std::vector<unsigned char> data;
+            std::string err;
+            fs::path path;
+            if (kind == 0) {
+                path = dir / fmt::format("{:03}.jpg", i);
+                err = sung::codec::encode_jpeg(data, view, 92, {});
+            } else {
+                path = dir / fmt::format("{:03}.png", i);
+                err = sung::codec::encode_png(data, view, 6, {});
+            }
+            if (!err.empty())
+                return err;
+
+            std::ofstream file(path, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(data.data()), data.size());
+            if (!file)
+                return fmt::format(
+                    "Failed to write {}", sung::make_utf8_str(path)
+                );
+            files.push_back(path);
+        }
+        return "";
+    }
+
+
+    double median(std::vector<double> values) {
+        if (values.empty())
+            return 0;
+        std::sort(values.begin(), values.end());
+        const auto mid = values.size() / 2;
+        if (values.size() % 2)
+            return values[mid];
+        return (values[mid - 1] + values[mid]) / 2;
+    }
+
+    // Whole corpus through the refinery once
+    Metrics run_once(
+        const std::vector<fs::path>& files,
+        const sung::WorkContext& ctx,
+        BS::thread_pool& pool,
+        size_t& failures
+    ) {
+        using clock_t = std::chrono::steady_clock;
+
+        std::mutex mut;
+        std::vector<sung::StageTimings> timings;
+        const auto start = clock_t::now();
+        for (const auto& path : files) {
+            pool.detach_task([&, path] {
+                sung::WorkOutput output;
+                sung::refine_img(path, ctx, output);
+                std::lock_guard lock(mut);
+                if (output.record_.outcome_ == sung::WorkOutcome::failed)
+                    ++failures;
+                timings.push_back(output.record_.timings_);
+            });
+        }
+        pool.wait();
+        const std::chrono::duration<double> elapsed = clock_t::now() - start;
+        const auto wall = elapsed.count();
+
+        std::vector<double> decode, resize, encode, write;
+        for (const auto& t : timings) {
+            decode.push_back(t.decode_ * 1000);
+            resize.push_back(t.resize_ * 1000);
+            encode.push_back(t.encode_ * 1000);
+            write.push_back(t.write_ * 1000);
+        }
+
+        Metrics out;
+        out["files_per_sec"] = wall > 0 ? files.size() / wall : 0;
+        out["decode_ms"] = ::median(decode);
+        out["resize_ms"] = ::median(resize);
+        out["encode_ms"] = ::median(encode);
+        out["write_ms"] = ::median(write);
+        return out;
+    }
+
+
+    // Just enough JSON for the flat object write_baseline produces
+    std::optional<Metrics> parse_baseline(const std::string& text) {
+        Metrics out;
+        size_t pos = 0;
+        const auto skip_ws = [&] {
+            while (pos < text.size() && std::isspace((unsigned char)text[pos]))
+                ++pos;
+        };
+        const auto consume = [&](char c) {
+            skip_ws();
+            if (pos >= text.size() || text[pos] != c)
+                return false;
+            ++pos;
+            return true;
+        };
+
+        if (!consume('{'))
+            return std::nullopt;
+        if (consume('}'))
+            return out;
+
+        do {
+            if (!consume('"'))
+                return std::nullopt;
+            const auto end = text.find('"', pos);
+            if (end == std::string::npos)
+                return std::nullopt;
+            const auto key = text.substr(pos, end - pos);
+            pos = end + 1;
+            if (!consume(':'))
+                return std::nullopt;
+
+            skip_ws();
+            if (text.compare(pos, 4, "null") == 0) {
+                pos += 4;
+                continue;
+            }
+            size_t used = 0;
+            try {
+                out[key] = std::stod(text.substr(pos), &used);
+            } catch (const std::exception&) {
+                return std::nullopt;
+            }
+            pos += used;
+        } while (consume(','));
+
+        if (!consume('}'))
+            return std::nullopt;
+        return out;
+    }
+
+    std::string write_baseline(const fs::path& path, const Metrics& metrics) {
+        std::string out = "{\n";
+        for (auto it = metrics.begin(); it != metrics.end(); ++it) {
+            out += fmt::format("    \"{}\": {:.4f}", it->first, it->second);
+            out += std::next(it) == metrics.end() ? "\n" : ",\n";
+        }
+        out += "}\n";
+
+        std::ofstream file(path, std::ios::binary);
+        file << out;
+        if (!file)
+            return fmt::format(
+                "Failed to write baseline: {}", sung::make_utf8_str(path)
+            );
+        return "";
+    }
+
+    // Returns true if any metric regressed beyond `tolerance` or has no
+    // baseline, so an unrecorded baseline cannot pass the gate
+    bool compare(
+        const Metrics& baseline, const Metrics& current, double tolerance
+    ) {
+        bool regressed = false;
+        bool missing = false;
+        fmt::print("{:<16} {:>12} {:>12}\n", "metric", "baseline", "current");
+        for (const auto& spec : METRIC_SPECS) {
+            const auto cur = current.at(spec.name_);
+            const auto found = baseline.find(spec.name_);
+            if (found == baseline.end()) {
+                fmt::print(
+                    "{:<16} {:>12} {:>12.2f}  MISSING\n", spec.name_, "-", cur
+                );
+                missing = true;
+                continue;
+            }
+
+            const auto base = found->second;
+            const auto change = base != 0 ? (cur - base) / base : 0;
+            const auto worse = spec.higher_is_better_ ? -change : change;
+            auto bad = worse > tolerance;
+            if (spec.is_stage_ && std::abs(cur - base) < STAGE_SLACK_MS)
+                bad = false;
+            regressed = regressed || bad;
+
+            fmt::print(
+                "{:<16} {:>12.2f} {:>12.2f}  {:+.1f}% {}\n",
+                spec.name_,
+                base,
+                cur,
+                change * 100,
+                bad ? "REGRESSED" : "ok"
+            );
+        }
+
+        if (missing) {
+            fmt::print(
+                "Some metrics have no baseline, record one on the reference "
+                "machine with --update-baseline\n"
+            );
+        }
+        return regressed || missing;
+    }
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser p("Image Refinery throughput regression check");
+
+    std::string baseline_path = IMGREF_PERF_BASELINE;
+    p.add_argument("-b", "--baseline")
+        .help("Baseline JSON to compare with")
+        .default_value(baseline_path)
+        .store_into(baseline_path);
+
+    double tolerance = 0.10;
+    p.add_argument("-t", "--tolerance")
+        .help("Allowed relative regression per metric, e.g. 0.1 for 10%")
+        .default_value(0.10)
+        .store_into(tolerance);
+
+    int runs = 5;
+    p.add_argument("-n", "--runs")
+        .help("Measured runs over the corpus, after one warm-up run")
+        .default_value(5)
+        .store_into(runs);
+
+    CorpusSpec corpus;
+    p.add_argument("--files")
+        .help("Generated corpus size")
+        .default_value(24)
+        .store_into(corpus.files_);
+
+    int threads = 0;
+    p.add_argument("-j", "--threads")
+        .help("Worker threads, 0 for the CPUs this container may use")
+        .default_value(0)
+        .store_into(threads);
+
+    std::string work_dir;
+    p.add_argument("--work-dir")
+        .help("Where the corpus and outputs are written")
+        .store_into(work_dir);
+
+    bool update = false;
+    p.add_argument("--update-baseline")
+        .help("Write the results as the new baseline instead of comparing")
+        .flag()
+        .store_into(update);
+
+    try {
+        p.parse_args(argc, argv);
+    } catch (const std::exception& err) {
+        fmt::print("{}\n", err.what());
+        return 1;
+    }
+
+    if (runs < 1) {
+        fmt::print("--runs must be at least 1\n");
+        return 1;
+    }
+
+    const auto root = work_dir.empty()
+                          ? fs::temp_directory_path() / "imgref_perf_regress"
+                          : fs::u8path(work_dir);
+    const auto corpus_dir = root / "corpus";
+    const auto output_dir = root / "out";
+
+    std::vector<fs::path> files;
+    if (const auto err = ::make_corpus(corpus_dir, corpus, files);
+        !err.empty()) {
+        fmt::print("{}\n", err);
+        return 1;
+    }
+
+    // Fixed so baselines stay comparable
+    sung::ImgRefWorkConfigs configs;
+    configs.allow_webp_ = true;
+    configs.native_encoders_ = true;
+    configs.reduction_threshold_ = 1;
+
+    const sung::ExternalResultLoc output_loc(corpus_dir, output_dir);
+    sung::WorkContext ctx{ configs, output_loc };
+
+    BS::thread_pool pool(
+        threads > 0 ? static_cast<size_t>(threads) : sung::get_cpu_limit()
+    );
+    sung::oiio::set_thread_limit(
+        static_cast<unsigned>(pool.get_thread_count())
+    );
+
+    std::vector<Metrics> samples;
+    size_t failures = 0;
+    for (int i = 0; i <= runs; ++i) {
+        std::error_code ec;
+        fs::remove_all(output_dir, ec);
+        fs::create_directories(output_dir, ec);
+
+        auto metrics = ::run_once(files, ctx, pool, failures);
+        if (i == 0)
+            continue;  // Warm-up
+        fmt::print(
+            "run {}: {:.2f} files/s\n", i, metrics.at("files_per_sec")
+        );
+        samples.push_back(std::move(metrics));
+    }
+    if (failures) {
+        fmt::print("{} files failed, results are not comparable\n", failures);
+        return 1;
+    }
+
+    Metrics current;
+    for (const auto& spec : METRIC_SPECS) {
+        std::vector<double> values;
+        for (const auto& s : samples) {
+            const auto found = s.find(spec.name_);
+            if (found != s.end())
+                values.push_back(found->second);
+        }
+        current[spec.name_] = ::median(values);
+    }
+    current["peak_rss_mb"] = sung::metrics::get_peak_rss_bytes() / 1e6;
+    current["corpus_files"] = corpus.files_;
+
+    const auto baseline_fpath = fs::u8path(baseline_path);
+    if (update) {
+        const auto err = ::write_baseline(baseline_fpath, current);
+        if (!err.empty()) {
+            fmt::print("{}\n", err);
+            return 1;
+        }
+        fmt::print("Baseline written: {}\n", baseline_path);
+        return 0;
+    }
+
+    if (!fs::exists(baseline_fpath)) {
+        fmt::print(
+            "No baseline at {}, record one on the reference machine with "
+            "--update-baseline\n",
+            baseline_path
+        );
+        return 1;
+    }
+
+    std::ifstream file(baseline_fpath, std::ios::binary);
+    const std::string text(
+        (std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()
+    );
+    const auto baseline = ::parse_baseline(text);
+    if (!baseline) {
+        fmt::print("Invalid baseline: {}\n", baseline_path);
+        return 1;
+    }
+
+    const auto base_files = baseline->find("corpus_files");
+    if (base_files != baseline->end() && base_files->second != corpus.files_) {
+        fmt::print(
+            "Baseline was recorded with {} files, not {}\n",
+            base_files->second,
+            corpus.files_
+        );
+        return 1;
+    }
+
+    return ::compare(*baseline, current, tolerance) ? 2 : 0;
+}
@@ -1,14 +1,39 @@
-#include <fstream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <set>
+#include <thread>
 #include <vector>
 
 #include <fmt/core.h>
 #include <BS_thread_pool.hpp>
 #include <sung/general/stringtool.hpp>
 
+#include "sung/imgref/archive.hpp"
 #include "sung/imgref/argpar.hpp"
+#include "sung/imgref/candidate_stats.hpp"
+#include "sung/imgref/dedup.hpp"
+#include "sung/imgref/dir_watcher.hpp"
+#include "sung/imgref/file_io.hpp"
 #include "sung/imgref/filesys.hpp"
+#include "sung/imgref/governor.hpp"
 #include "sung/imgref/img_refinery.hpp"
+#include "sung/imgref/manifest.hpp"
+#include "sung/imgref/metrics.hpp"
+#include "sung/imgref/pixel_pool.hpp"
+#include "sung/imgref/refinery.hpp"
+#include "sung/imgref/result_log.hpp"
+#include "sung/imgref/schedule.hpp"
+#include "sung/imgref/size_estimator.hpp"
+#include "sung/imgref/storage.hpp"
 
 
 namespace {
@@ -16,81 +41,160 @@ namespace {
     namespace fs = std::filesystem;
 
 
-    std::string do_work(
-        const fs::path& path,
-        const sung::ExternalResultLoc& output_loc,
-        const sung::ImgRefWorkConfigs& configs
+    // Timed out files get this many times the limit on the retry pass
+    constexpr double RETRY_TIME_FACTOR = 4;
+    // A watched file is taken once no write to it was seen for this long
+    constexpr std::chrono::milliseconds WATCH_DEBOUNCE{ 1000 };
+
+    volatile std::sig_atomic_t g_stop_watching = 0;
+
+    void on_interrupt(int) { g_stop_watching = 1; }
+
+    volatile std::sig_atomic_t g_reload_limits = 0;
+
+    void on_hangup(int) { g_reload_limits = 1; }
+
+
+    // In seconds, made before dispatch with the fixed cost model
+    struct MakespanPrediction {
+        double lpt_ = 0;
+        double path_order_ = 0;
+        double lower_bound_ = 0;
+        double total_cost_ = 0;
+    };
+
+    std::optional<MakespanPrediction> predict_makespan(
+        const std::vector<double>& costs, const size_t workers
     ) {
-        const auto src_size = fs::file_size(path);
-        auto img = sung::oiio::open_img(path);
-        if (!img)
-            return img.error();
-
-        const auto props = sung::oiio::get_img_properties(**img);
-        if (props.animated_)
-            return "Animated image not supported";
-
-        sung::oiio::ImageSize2D img_dim(props.width_, props.height_);
-        img_dim.resize_for_jpeg();
-        img_dim.resize_to_enclose(2000, 2000);
-        if (configs.allow_webp_)
-            img_dim.resize_for_webp();
-
-        auto mod = sung::oiio::resize_img(**img, img_dim);
-        if (!mod)
-            return mod.error();
-
-        if (!props.transparent_) {
-            mod = sung::oiio::drop_alpha_ch(**mod);
-            if (!mod)
-                return mod.error();
-        }
-
-        sung::oiio::ImageExportHarbor harbor;
-        if (configs.allow_webp_)
-            harbor.build_webp("webp 80", **mod, 80);
-        if (props.transparent_)
-            harbor.build_png("png", **mod, 9);
-        else
-            harbor.build_jpeg("jpeg 80", **mod, 80);
+        const auto total = std::accumulate(costs.begin(), costs.end(), 0.0);
+        if (total <= 0 || workers == 0)
+            return std::nullopt;
 
-        if (props.monochrome_ && !props.transparent_) {
-            mod = sung::oiio::merge_greyscale_channels(**mod);
-            if (!mod)
-                return mod.error();
-            harbor.build_jpeg("jpeg 80 monochrome", **mod, 80);
-        }
+        std::vector<size_t> path_order(costs.size());
+        std::iota(path_order.begin(), path_order.end(), 0);
+        const auto lpt_order = sung::make_lpt_order(costs);
+        const auto largest = *std::max_element(costs.begin(), costs.end());
+        constexpr auto RATE = sung::SECONDS_PER_COST_UNIT;
+        const auto simulate = [&](const std::vector<size_t>& order) {
+            return sung::simulate_makespan(costs, order, workers) * RATE;
+        };
 
-        sung::FilePathMap img_map{ path };
-        for (auto& [name, record] : harbor.get_sorted_by_size()) {
-            if (record->data_.size() >= src_size * configs.reduction_threshold_)
-                return fmt::format(
-                    "Not enough reduction ({})",
-                    record->data_.size() / (double)src_size
-                );
+        MakespanPrediction out;
+        out.lpt_ = simulate(lpt_order);
+        out.path_order_ = simulate(path_order);
+        out.lower_bound_ = std::max(total / workers, largest) * RATE;
+        out.total_cost_ = total;
+        return out;
+    }
 
-            const auto out_path = img_map.add_with_suffix(
-                fmt::format("{}.{}", name, record->file_ext_), output_loc
-            );
+    // The measured seconds per cost unit show how far off the model was
+    void print_makespan(
+        const MakespanPrediction& prediction,
+        const double busy_seconds,
+        const std::chrono::duration<double> actual,
+        const bool path_order
+    ) {
+        fmt::print(
+            "Makespan: {:.1f} s actual ({} order), predicted {:.1f} s "
+            "largest first, {:.1f} s path order, lower bound {:.1f} s\n",
+            actual.count(),
+            path_order ? "path" : "largest first",
+            prediction.lpt_,
+            prediction.path_order_,
+            prediction.lower_bound_
+        );
+        fmt::print(
+            "{:.4f} s per cost unit measured, {:.4f} s assumed\n",
+            busy_seconds / prediction.total_cost_,
+            sung::SECONDS_PER_COST_UNIT
+        );
+    }
 
-            sung::create_folder(out_path.parent_path());
-            std::fstream file(out_path, std::ios::out | std::ios::binary);
-            if (!file)
-                return "Failed to open file";
-            file.write((const char*)record->data_.data(), record->data_.size());
 
-            break;
+    struct DedupReport {
+        std::atomic<uint64_t> files_skipped_ = 0;
+        std::atomic<uint64_t> input_bytes_skipped_ = 0;
+        std::atomic<uint64_t> output_bytes_linked_ = 0;
+        std::atomic<int64_t> cpu_us_saved_ = 0;
+    };
+
+
+    // Gives a duplicate the representative's result without re-encoding
+    std::string propagate_result(
+        const fs::path& member,
+        const sung::WorkOutput& rep_output,
+        const sung::ExternalResultLoc& output_loc,
+        const sung::ImgRefWorkConfigs& configs,
+        DedupReport& report,
+        sung::WorkRecord& rec
+    ) {
+        const auto& rep_path = rep_output.record_.output_path_;
+        sung::FilePathMap img_map{ member };
+        const auto out_path = img_map.add_with_suffix(
+            rep_output.suffix_, output_loc
+        );
+        sung::create_folder(out_path.parent_path());
+        rec.output_path_ = out_path;
+
+        std::error_code ec;
+        bool linked = false;
+        if (configs.dedup_hardlink_) {
+            fs::create_hard_link(rep_path, out_path, ec);
+            linked = !ec;
+        }
+        if (!linked) {
+            fs::copy_file(
+                rep_path, out_path, fs::copy_options::overwrite_existing, ec
+            );
+            if (ec)
+                return "Failed to copy result: " + ec.message();
+        } else {
+            report.output_bytes_linked_ += fs::file_size(out_path, ec);
         }
 
         if (configs.inplace_) {
             const auto res = img_map.replace_src();
             if (!res)
                 return "Failed to replace img: " + res.error();
+            rec.output_path_ = *res;
         }
 
+        rec.outcome_ = sung::WorkOutcome::success;
         return "success";
     }
 
+    bool is_under(const fs::path& path, const fs::path& root) {
+        const auto rel = path.lexically_relative(root);
+        return !rel.empty() && *rel.begin() != "..";
+    }
+
+    sung::Expected<std::unique_ptr<sung::IStorage>, std::string> make_storage(
+        const std::string& url, const sung::ImgRefWorkConfigs& configs
+    ) {
+        constexpr std::string_view FILE_SCHEME = "file://";
+        if (url.starts_with(FILE_SCHEME))
+            return sung::make_local_storage(url.substr(FILE_SCHEME.size()));
+
+        sung::HttpStorageConfigs storage_configs;
+        storage_configs.url_ = url;
+        storage_configs.max_prefetch_bytes_ = size_t(configs.prefetch_mb_)
+                                              << 20;
+        return sung::make_http_storage(storage_configs);
+    }
+
+    // The deepest folder containing all of `paths`
+    fs::path get_common_folder(const std::vector<fs::path>& paths) {
+        fs::path out;
+        for (const auto& x : paths) {
+            const auto folder = fs::is_directory(x) ? x : x.parent_path();
+            if (out.empty())
+                out = folder;
+            while (!::is_under(folder, out) && out.has_relative_path())
+                out = out.parent_path();
+        }
+        return out;
+    }
+
 }  // namespace
 
 
@@ -109,29 +213,752 @@ int main(int argc, char* argv[]) {
     file_filter.add_allowed_ext(".webp");
     file_filter.add_allowed_ext(".gif");
 
+    // Inputs are listed and read, outputs written through it when set
+    std::unique_ptr<sung::IFileIO> file_io;
+    sung::IStorage* storage = nullptr;
+    if (configs.storage_url_) {
+        auto made = ::make_storage(*configs.storage_url_, configs);
+        if (!made) {
+            fmt::print("{}\n", made.error());
+            return 1;
+        }
+        storage = made->get();
+        file_io = std::move(*made);
+    }
+
+    // Canonical like the listed files so outputs map the same way
+    std::vector<fs::path> watch_folders;
+    if (configs.watch_) {
+        for (const auto& path : configs.inputs_) {
+            if (fs::is_directory(path))
+                watch_folders.push_back(fs::canonical(path));
+        }
+    }
+
+    // Started before the scan so uploads during the first pass are queued
+    std::unique_ptr<sung::IDirWatcher> watcher;
+    if (configs.watch_) {
+        auto made = sung::make_dir_watcher(
+            watch_folders, configs.recursive_, WATCH_DEBOUNCE
+        );
+        if (!made) {
+            fmt::print("{}\n", made.error());
+            return 1;
+        }
+        watcher = std::move(*made);
+    }
+
+    // Manifests and archives are streamed as they are read
     sung::FileList file_list;
     file_list.file_filter_ = file_filter;
-
     for (const auto& path : configs.inputs_) {
-        file_list.add(path, configs.recursive_);
+        if (!storage) {
+            file_list.add(path, configs.recursive_);
+            continue;
+        }
+        const auto err = file_list.add(*storage, path, configs.recursive_);
+        if (!err.empty())
+            fmt::print("{}\n", err);
     }
 
-    const sung::ExternalResultLoc output_loc(
-        file_list.get_longest_common_prefix(),
-        *sung::make_fol_path_with_suffix(
-            configs.output_dir_.value_or(fs::temp_directory_path() / "imgref")
-        )
-    );
+    // Entries are named as if each archive were a folder
+    sung::FileList archive_list;
+    archive_list.file_filter_ = [](fs::path) { return true; };
+    for (const auto& path : configs.input_archives_) {
+        if (fs::is_regular_file(path))
+            archive_list.add(path, false);
+        else
+            fmt::print("Archive not found: {}\n", sung::make_utf8_str(path));
+    }
+
+    // Storage keys map onto output keys under -o as they are by default
+    fs::path input_root;
+    if (storage)
+        input_root = configs.input_root_.value_or(fs::path());
+    else if (configs.input_root_)
+        input_root = fs::absolute(*configs.input_root_).lexically_normal();
+    else if (configs.input_manifest_)
+        input_root = fs::current_path();
+    else if (!configs.input_archives_.empty())
+        input_root = archive_list.get_longest_common_prefix();
+    else if (configs.watch_)
+        input_root = ::get_common_folder(watch_folders);
+    else
+        input_root = file_list.get_longest_common_prefix();
+
+    // Paths relative to the root become entry paths in the output archive
+    fs::path output_dir;
+    if (storage) {
+        output_dir = *configs.output_dir_;
+    } else if (!configs.output_archive_) {
+        const auto dir = configs.output_dir_.value_or(
+            fs::temp_directory_path() / "imgref"
+        );
+        if (configs.shard_.count_ > 1) {
+            // Every shard of a run writes into the same folder
+            std::error_code ec;
+            fs::create_directories(dir, ec);
+            if (ec) {
+                fmt::print(
+                    "Failed to create '{}': {}\n",
+                    sung::make_utf8_str(dir),
+                    ec.message()
+                );
+                return 1;
+            }
+            output_dir = dir;
+        } else {
+            output_dir = *sung::make_fol_path_with_suffix(dir);
+        }
+    }
+    const sung::ExternalResultLoc output_loc(input_root, output_dir);
+
+    // Every shard scans the same inputs, so they all agree on the root
+    const auto in_shard = [&](const fs::path& path) {
+        return configs.shard_.contains(path.lexically_relative(input_root));
+    };
+
+    // Paired before sharding so both halves land in the same shard
+    std::vector<std::pair<fs::path, fs::path>> alpha_pairs;
+    if (configs.merge_alpha_) {
+        std::vector<fs::path> unpaired;
+        alpha_pairs = file_list.pair_by_suffix("_a", "_o", &unpaired);
+        std::erase_if(alpha_pairs, [&](const auto& x) {
+            return !in_shard(x.first);
+        });
+        for (const auto& x : unpaired) {
+            if (in_shard(x))
+                fmt::print("No partner for {}\n", sung::make_utf8_str(x));
+        }
+        file_list.clear();
+    }
+    file_list.retain_if(in_shard);
 
     const std::vector<fs::path> files_vec(
         file_list.get_files().begin(), file_list.get_files().end()
     );
 
-    BS::thread_pool pool;
-    pool.submit_sequence<size_t>(0, files_vec.size(), [&](const size_t i) {
-        const auto result = ::do_work(files_vec[i], output_loc, configs);
-        fmt::print(" * {}: {}\n", sung::make_utf8_str(files_vec[i]), result);
+    // Write times of files already taken, read before the first pass. The
+    // watcher reports them again unchanged, unlike re-uploads.
+    std::map<fs::path, fs::file_time_type> taken;
+    if (watcher) {
+        for (const auto& path : files_vec) {
+            std::error_code ec;
+            const auto time = fs::last_write_time(path, ec);
+            if (!ec)
+                taken[path] = time;
+        }
+    }
+
+    sung::CandidateStats cand_stats;
+    std::optional<sung::CandidateSelector> selector;
+    if (configs.stats_file_) {
+        if (fs::exists(*configs.stats_file_)) {
+            const auto err = cand_stats.load(*configs.stats_file_);
+            if (!err.empty())
+                fmt::print("Candidate stats not loaded: {}\n", err);
+        }
+
+        sung::CandidateSelectorConfigs sel_configs;
+        sel_configs.explore_rate_ = configs.explore_rate_;
+        sel_configs.margin_ = configs.adaptive_margin_;
+        selector.emplace(cand_stats, sel_configs);
+    }
+
+    sung::SizeEstimator estimator;
+
+    sung::WorkContext work_ctx{ configs, output_loc };
+    work_ctx.selector_ = selector ? &*selector : nullptr;
+    work_ctx.estimator_ = configs.estimate_sizes_ ? &estimator : nullptr;
+
+    if (configs.io_uring_) {
+        auto io = sung::make_uring_file_io();
+        if (io)
+            file_io = std::move(*io);
+        else
+            fmt::print("{}, accessing files directly\n", io.error());
+    }
+    work_ctx.io_ = file_io.get();
+    work_ctx.max_seconds_ = configs.max_seconds_per_image_;
+    sung::set_pixel_pool_limit(size_t(configs.pixel_pool_mb_) << 20);
+
+    sung::ArchiveWriter archive_out;
+    if (configs.output_archive_) {
+        const auto err = archive_out.open(*configs.output_archive_);
+        if (!err.empty()) {
+            fmt::print("{}\n", err);
+            return 1;
+        }
+        work_ctx.archive_out_ = &archive_out;
+    }
+
+    // Sized by the container CPU quota, the gate lowers it while running
+    const auto cpu_limit = sung::get_cpu_limit();
+    sung::ConcurrencyGate gate(cpu_limit);
+    BS::thread_pool pool(cpu_limit);
+
+    // The CPU quota and the limits file again, on start and SIGHUP
+    const auto reload_limits = [&] {
+        auto cpus = sung::get_cpu_limit();
+        auto io_limit = configs.io_limit_;
+        if (configs.limits_file_) {
+            const auto limits = sung::read_limits_file(*configs.limits_file_);
+            if (!limits) {
+                fmt::print("Limits file not applied: {}\n", limits.error());
+            } else {
+                cpus = limits->cpus_.value_or(cpus);
+                io_limit = limits->io_limit_.value_or(io_limit);
+            }
+        }
+
+        // The pool does not grow, more only fills it
+        gate.set_limit(std::min<size_t>(cpus, pool.get_thread_count()));
+        sung::oiio::set_thread_limit(static_cast<unsigned>(gate.limit()));
+        sung::get_io_limiter().set_rate(io_limit);
+    };
+    reload_limits();
+    if (const auto rate = sung::get_io_limiter().rate())
+        fmt::print("{} workers, I/O limit {} B/s\n", gate.limit(), rate);
+    else
+        fmt::print("{} workers\n", gate.limit());
+
+#ifdef SIGHUP
+    std::signal(SIGHUP, ::on_hangup);
+#endif
+    std::jthread governor([&](std::stop_token stop) {
+        while (!stop.stop_requested()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            if (!g_reload_limits)
+                continue;
+            g_reload_limits = 0;
+            reload_limits();
+        }
     });
 
+    sung::metrics::Registry registry;
+    std::optional<sung::metrics::TextfileWriter> metrics_writer;
+    if (configs.metrics_file_) {
+        work_ctx.metrics_ = sung::make_work_metrics(registry);
+        registry.gauge_callback(
+            "imgref_pool_tasks_queued", "Tasks waiting in the pool", [&] {
+                return static_cast<double>(pool.get_tasks_queued());
+            }
+        );
+        registry.gauge_callback(
+            "imgref_pool_tasks_running", "Tasks being executed", [&] {
+                return static_cast<double>(pool.get_tasks_running());
+            }
+        );
+        registry.gauge_callback(
+            "imgref_worker_limit", "Tasks allowed to run at once", [&] {
+                return static_cast<double>(gate.limit());
+            }
+        );
+        registry.gauge_callback(
+            "imgref_io_limit_bytes_per_second", "0 when unlimited", [] {
+                return static_cast<double>(sung::get_io_limiter().rate());
+            }
+        );
+        registry.gauge_callback(
+            "imgref_resident_memory_bytes", "Resident set size", [] {
+                return static_cast<double>(
+                    sung::metrics::get_process_rss_bytes()
+                );
+            }
+        );
+        metrics_writer.emplace(
+            registry,
+            *configs.metrics_file_,
+            std::chrono::seconds(configs.metrics_interval_)
+        );
+    }
+
+    // Per-file outcome for rate() over files per second
+    constexpr auto OUTCOME_COUNT =
+        static_cast<size_t>(sung::WorkOutcome::timed_out) + 1;
+    std::array<sung::metrics::Counter*, OUTCOME_COUNT> file_counters{};
+    if (configs.metrics_file_) {
+        for (size_t i = 0; i < OUTCOME_COUNT; ++i) {
+            const auto outcome = static_cast<sung::WorkOutcome>(i);
+            file_counters[i] = &registry.counter(
+                "imgref_files_total",
+                "Files finished, by outcome",
+                fmt::format("result=\"{}\"", sung::to_str(outcome))
+            );
+        }
+    }
+    const auto count_file = [&](sung::WorkOutcome outcome) {
+        if (const auto counter = file_counters[static_cast<size_t>(outcome)])
+            counter->inc();
+    };
+
+    // Needs every file up front and duplicates copied on disk
+    const auto dedup_possible = !configs.input_manifest_ &&
+                                configs.input_archives_.empty() &&
+                                !configs.output_archive_ &&
+                                configs.renditions_.empty() &&
+                                !configs.merge_alpha_ && !storage;
+    const auto dedup_wanted = configs.dedup_ || configs.dedup_near_;
+    const auto dedup = dedup_wanted && dedup_possible;
+    if (dedup_wanted && !dedup_possible)
+        fmt::print("Deduplication needs plain file inputs and outputs\n");
+
+    std::vector<sung::DuplicateGroup> groups;
+    if (dedup) {
+        sung::DedupConfigs dedup_configs;
+        dedup_configs.near_ = configs.dedup_near_;
+        groups = sung::group_duplicates(
+            file_list.get_files(), dedup_configs, pool
+        );
+        const auto similar = std::count_if(
+            groups.begin(),
+            groups.end(),
+            [](const auto& g) { return g.similar_to_.has_value(); }
+        );
+        fmt::print(
+            "{} files in {} unique groups, {} look like another one\n",
+            files_vec.size(),
+            groups.size(),
+            similar
+        );
+    } else {
+        groups.reserve(files_vec.size());
+        for (const auto& path : files_vec)
+            groups.push_back({ path, {}, std::nullopt });
+    }
+
+    sung::ResultSinkConfigs sink_configs;
+    sink_configs.log_path_ = configs.result_log_;
+    sink_configs.manifest_path_ = configs.output_manifest_;
+    // One record per rendition or colour and opacity pair
+    sink_configs.total_ = files_vec.size() *
+                          std::max<size_t>(1, configs.renditions_.size());
+    if (configs.merge_alpha_)
+        sink_configs.total_ = alpha_pairs.size();
+    if (configs.watch_)
+        sink_configs.total_ = 0;
+    sink_configs.progress_ = !configs.quiet_;
+
+    sung::ResultSink sink;
+    if (const auto err = sink.start(sink_configs); !err.empty()) {
+        fmt::print("{}\n", err);
+        return 1;
+    }
+
+    // Written into input folders by --inplace, so the watcher skips them
+    std::mutex produced_mut;
+    std::set<fs::path> produced;
+    const auto push_record = [&](sung::WorkRecord rec) {
+        if (configs.watch_ && configs.inplace_ && !rec.output_path_.empty()) {
+            std::lock_guard lock(produced_mut);
+            produced.insert(rec.output_path_);
+        }
+        sink.push(std::move(rec));
+    };
+
+    // Timed out work is not recorded on the first pass but run again
+    // after the batch with a looser limit. Process functions return true
+    // when they held a result back for that.
+    using Ctx = sung::WorkContext;
+    using Task = std::function<bool(const Ctx&)>;
+    std::mutex retry_mut;
+    std::vector<Task> retries;
+    const auto hold_back = [&](const Ctx& ctx, sung::WorkOutcome outcome) {
+        return &ctx == &work_ctx && outcome == sung::WorkOutcome::timed_out;
+    };
+    // Worker seconds spent on first pass tasks, for the makespan report
+    std::atomic<double> busy_seconds = 0;
+    const auto run = [&](Task task) {
+        using clock_t = std::chrono::steady_clock;
+        gate.enter();
+        const auto start = clock_t::now();
+        const auto held_back = task(work_ctx);
+        const std::chrono::duration<double> elapsed = clock_t::now() - start;
+        gate.leave();
+        busy_seconds += elapsed.count();
+        if (!held_back)
+            return;
+        std::lock_guard lock(retry_mut);
+        retries.push_back(std::move(task));
+    };
+
+    using Bytes = std::vector<unsigned char>;
+    const auto process_renditions =
+        [&](const fs::path& path, const Bytes* data, const Ctx& ctx) {
+            std::vector<sung::WorkOutput> outputs;
+            if (data)
+                sung::refine_renditions(path, *data, ctx, outputs);
+            else
+                sung::refine_renditions(path, ctx, outputs);
+
+            for (const auto& output : outputs) {
+                if (hold_back(ctx, output.record_.outcome_))
+                    return true;
+            }
+            for (auto& output : outputs) {
+                count_file(output.record_.outcome_);
+                push_record(std::move(output.record_));
+            }
+            return false;
+        };
+
+    DedupReport dedup_report;
+    const auto process_group = [&](const sung::DuplicateGroup& group,
+                                   const Ctx& ctx) {
+        using clock_t = std::chrono::steady_clock;
+
+        if (!configs.renditions_.empty())
+            return process_renditions(group.representative_, nullptr, ctx);
+
+        sung::WorkOutput rep_output;
+        const auto start = clock_t::now();
+        const auto result = sung::refine_img(
+            group.representative_, ctx, rep_output
+        );
+        const auto elapsed = std::chrono::duration_cast<
+            std::chrono::microseconds>(clock_t::now() - start);
+
+        const auto& rep_rec = rep_output.record_;
+        if (hold_back(ctx, rep_rec.outcome_))
+            return true;
+        for (const auto& member : group.members_) {
+            std::error_code ec;
+            dedup_report.files_skipped_ += 1;
+            const auto member_size = sung::get_file_size(member, ec);
+            dedup_report.input_bytes_skipped_ += member_size;
+            dedup_report.cpu_us_saved_ += elapsed.count();
+
+            sung::WorkRecord member_rec;
+            member_rec.path_ = member;
+            member_rec.outcome_ = rep_rec.outcome_;
+            member_rec.message_ = result;
+            member_rec.candidate_ = rep_rec.candidate_;
+            member_rec.src_bytes_ = member_size;
+            member_rec.dst_bytes_ = rep_rec.dst_bytes_;
+            member_rec.duplicate_of_ = group.representative_;
+            member_rec.similar_to_ = group.similar_to_;
+            if (rep_rec.outcome_ == sung::WorkOutcome::success) {
+                member_rec.outcome_ = sung::WorkOutcome::failed;
+                member_rec.message_ = ::propagate_result(
+                    member,
+                    rep_output,
+                    output_loc,
+                    configs,
+                    dedup_report,
+                    member_rec
+                );
+            }
+
+            count_file(member_rec.outcome_);
+            push_record(std::move(member_rec));
+        }
+
+        rep_output.record_.message_ = result;
+        rep_output.record_.similar_to_ = group.similar_to_;
+        count_file(rep_rec.outcome_);
+        push_record(std::move(rep_output.record_));
+        return false;
+    };
+
+    const auto process_entry =
+        [&](const fs::path& path, const Bytes& data, const Ctx& ctx) {
+            if (!configs.renditions_.empty())
+                return process_renditions(path, &data, ctx);
+
+            sung::WorkOutput output;
+            const auto result = sung::refine_img(path, data, ctx, output);
+            if (hold_back(ctx, output.record_.outcome_))
+                return true;
+
+            output.record_.message_ = result;
+            count_file(output.record_.outcome_);
+            push_record(std::move(output.record_));
+            return false;
+        };
+
+    // Bounded so a huge manifest or archive is not read into the queue
+    const auto max_queued = pool.get_thread_count() * 4;
+    const auto wait_for_room = [&] {
+        while (pool.get_tasks_queued() >= max_queued)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    };
+
+    // With an I/O backend the read is in flight while the task is queued
+    const auto submit_file = [&](const fs::path& path) {
+        wait_for_room();
+        if (!file_io) {
+            pool.detach_task([&, path] {
+                run([&, path](const Ctx& ctx) {
+                    return process_group({ path, {}, std::nullopt }, ctx);
+                });
+            });
+            return;
+        }
+
+        const auto data = file_io->read(path).share();
+        pool.detach_task([&, path, data] {
+            const auto& bytes = data.get();
+            if (bytes) {
+                run([&, path, data](const Ctx& ctx) {
+                    return process_entry(path, *data.get(), ctx);
+                });
+                return;
+            }
+
+            sung::WorkRecord rec;
+            rec.path_ = path;
+            rec.message_ = bytes.error();
+            count_file(rec.outcome_);
+            push_record(std::move(rec));
+        });
+    };
+
+    // tex_a.png and tex_o.png are written as tex_ao_<candidate>
+    const auto process_pair = [&](const fs::path& color,
+                                  const fs::path& opacity,
+                                  const Ctx& ctx) {
+        auto stem = color.stem().u8string();
+        stem.resize(stem.size() - 2);
+        stem += u8"_ao";
+        const auto merged_name = color.parent_path() /
+                                 (stem + color.extension().u8string());
+
+        sung::WorkOutput output;
+        const auto result = sung::refine_alpha_pair(
+            color, opacity, merged_name, ctx, output
+        );
+        if (hold_back(ctx, output.record_.outcome_))
+            return true;
+
+        output.record_.message_ = result;
+        count_file(output.record_.outcome_);
+        push_record(std::move(output.record_));
+        return false;
+    };
+
+    // Estimated costs by group, probed from the image headers. Predicted
+    // for the workers the gate lets run when dispatching starts.
+    std::vector<double> costs;
+    std::optional<MakespanPrediction> prediction;
+    const auto make_order = [&]() {
+        // Headers of stored objects would cost a request each
+        costs.assign(groups.size(), 0);
+        if (!storage) {
+            pool.detach_sequence<size_t>(
+                0, groups.size(), [&](const size_t i) {
+                    costs[i] = sung::probe_job_cost(
+                        groups[i].representative_, configs
+                    );
+                }
+            );
+            pool.wait();
+        }
+        prediction = ::predict_makespan(costs, gate.limit());
+
+        if (!configs.path_order_)
+            return sung::make_lpt_order(costs);
+        std::vector<size_t> order(costs.size());
+        std::iota(order.begin(), order.end(), 0);
+        return order;
+    };
+
+    const auto start_time = std::chrono::steady_clock::now();
+    if (configs.merge_alpha_) {
+        pool.detach_sequence<size_t>(
+            0, alpha_pairs.size(), [&](const size_t i) {
+                run([&, i](const Ctx& ctx) {
+                    const auto& [color, opacity] = alpha_pairs[i];
+                    return process_pair(color, opacity, ctx);
+                });
+            }
+        );
+    } else if (configs.input_manifest_) {
+        sung::ManifestReader reader;
+        const auto err = reader.open(*configs.input_manifest_);
+        if (!err.empty()) {
+            fmt::print("{}\n", err);
+            return 1;
+        }
+
+        while (auto entry = reader.next()) {
+            const auto path = fs::absolute(*entry).lexically_normal();
+            if (!file_filter(path) || !in_shard(path))
+                continue;
+
+            if (!::is_under(path, input_root)) {
+                sung::WorkRecord rec;
+                rec.path_ = path;
+                rec.message_ = "Not under the input root";
+                count_file(rec.outcome_);
+                push_record(std::move(rec));
+                continue;
+            }
+
+            submit_file(path);
+        }
+    } else if (!configs.input_archives_.empty()) {
+        for (const auto& archive_path : archive_list.get_files()) {
+            if (!::is_under(archive_path, input_root)) {
+                fmt::print(
+                    "Archive not under the input root: {}\n",
+                    sung::make_utf8_str(archive_path)
+                );
+                continue;
+            }
+
+            sung::ArchiveReader reader;
+            const auto err = reader.open(archive_path);
+            if (!err.empty()) {
+                fmt::print("{}\n", err);
+                continue;
+            }
+
+            const auto accept = [&](const fs::path& entry) {
+                const auto path = archive_path / entry;
+                return file_filter(path) && in_shard(path);
+            };
+            while (auto entry = reader.next(accept)) {
+                wait_for_room();
+                pool.detach_task([&,
+                                  path = archive_path / entry->path_,
+                                  data = std::move(entry->data_)]() mutable {
+                    run([&, path, data = std::move(data)](const Ctx& ctx) {
+                        return process_entry(path, data, ctx);
+                    });
+                });
+            }
+            if (!reader.error().empty()) {
+                fmt::print(
+                    "Failed to read {}: {}\n",
+                    sung::make_utf8_str(archive_path),
+                    reader.error()
+                );
+            }
+        }
+    } else if (file_io && !dedup) {
+        // Without dedup there is one group per file
+        const auto order = make_order();
+        if (storage) {
+            std::vector<fs::path> paths;
+            paths.reserve(order.size());
+            for (const auto i : order)
+                paths.push_back(groups[i].representative_);
+            storage->prefetch(paths);
+        }
+        for (const auto i : order)
+            submit_file(groups[i].representative_);
+    } else {
+        for (const auto i : make_order()) {
+            pool.detach_task([&, i] {
+                run([&, i](const Ctx& ctx) {
+                    return process_group(groups[i], ctx);
+                });
+            });
+        }
+    }
+    pool.wait();
+
+    if (prediction)
+        ::print_makespan(
+            *prediction,
+            busy_seconds.load(),
+            std::chrono::steady_clock::now() - start_time,
+            configs.path_order_
+        );
+
+    if (watcher) {
+        const auto take = [&](const fs::path& path) {
+            std::error_code ec;
+            const auto time = fs::last_write_time(path, ec);
+            if (ec)
+                return false;
+            const auto [it, added] = taken.try_emplace(path, time);
+            if (!added && it->second == time)
+                return false;
+            it->second = time;
+            return true;
+        };
+
+        const auto is_produced = [&](const fs::path& path) {
+            if (!output_dir.empty() && ::is_under(path, output_dir))
+                return true;
+            std::lock_guard lock(produced_mut);
+            return produced.erase(path) > 0;
+        };
+
+        std::signal(SIGINT, ::on_interrupt);
+        std::signal(SIGTERM, ::on_interrupt);
+        fmt::print("Watching for new files, Ctrl+C to stop\n");
+        while (!g_stop_watching) {
+            for (const auto& path :
+                 watcher->poll(std::chrono::milliseconds(200))) {
+                if (!file_filter(path) || !in_shard(path))
+                    continue;
+                // Outputs are taken too so rescans skip them
+                if (!take(path) || is_produced(path))
+                    continue;
+                sung::forget_file(path);
+                submit_file(path);
+            }
+        }
+        pool.wait();
+    }
+
+    if (!retries.empty()) {
+        auto retry_ctx = work_ctx;
+        retry_ctx.max_seconds_ *= RETRY_TIME_FACTOR;
+        fmt::print(
+            "Retrying {} timed out files with {} seconds each\n",
+            retries.size(),
+            retry_ctx.max_seconds_
+        );
+        pool.detach_sequence<size_t>(0, retries.size(), [&](const size_t i) {
+            gate.enter();
+            retries[i](retry_ctx);
+            gate.leave();
+        });
+        pool.wait();
+    }
+    if (configs.output_archive_) {
+        const auto err = archive_out.close();
+        if (!err.empty())
+            fmt::print("{}\n", err);
+    }
+    sink.finish();
+
+    if (metrics_writer)
+        metrics_writer->stop();
+
+    const auto& summary = sink.summary();
+    for (const auto& [outcome, count] : summary.outcomes_)
+        fmt::print("{}: {}\n", sung::to_str(outcome), count);
+
+    if (dedup) {
+        fmt::print(
+            "Dedup: {} files not processed, {} input bytes skipped, "
+            "~{:.1f} CPU seconds saved, {} output bytes hardlinked\n",
+            dedup_report.files_skipped_.load(),
+            dedup_report.input_bytes_skipped_.load(),
+            dedup_report.cpu_us_saved_.load() / 1e6,
+            dedup_report.output_bytes_linked_.load()
+        );
+    }
+
+    const auto pool_stats = sung::get_pixel_pool_stats();
+    fmt::print(
+        "Pixel pool: {:.1f}% of buffers reused, peak {:.1f} MiB\n",
+        pool_stats.hit_rate() * 100,
+        pool_stats.peak_bytes_ / double(1 << 20)
+    );
+
+    if (configs.estimate_sizes_)
+        fmt::print("Size estimation:\n{}", estimator.make_report());
+
+    if (configs.stats_file_) {
+        const auto err = cand_stats.save(*configs.stats_file_);
+        if (!err.empty())
+            fmt::print("Candidate stats not saved: {}\n", err);
+    }
+
     return 0;
 }
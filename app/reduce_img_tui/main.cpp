@@ -1,7 +1,5 @@
 #include <vector>
 
-#include <OpenImageIO/imagebuf.h>
-#include <OpenImageIO/imagebufalgo.h>
 #include <fmt/core.h>
 #include <ftxui/component/component.hpp>
 #include <ftxui/component/component_base.hpp>
@@ -9,6 +7,9 @@
 #include <ftxui/dom/elements.hpp>
 
 #include "sung/imgref/filesys.hpp"
+#include "sung/imgref/governor.hpp"
+#include "sung/imgref/img_refinery.hpp"
+#include "sung/imgref/refine_engine.hpp"
 
 
 namespace {
@@ -42,7 +43,9 @@ namespace {
     public:
         using btn_click_callback_t = std::function<void()>;
 
-        Widget() : screen_(ftxui::ScreenInteractive::TerminalOutput()) {
+        explicit Widget(const sung::RefineEngine& engine)
+            : engine_(engine)
+            , screen_(ftxui::ScreenInteractive::TerminalOutput()) {
             input_path_ui_ = ftxui::Input(&input_path_data_, "Image path");
 
             checkbox_recur_ui_ = ftxui::Checkbox(
@@ -52,6 +55,7 @@ namespace {
             btn_add_.init("Add");
             btn_clear_.init("Clear");
             btn_start_.init("Start");
+            btn_cancel_.init("Cancel");
 
             components_ = ftxui::Container::Vertical({
                 input_path_ui_,
@@ -59,6 +63,7 @@ namespace {
                 btn_add_.ui_,
                 btn_clear_.ui_,
                 btn_start_.ui_,
+                btn_cancel_.ui_,
             });
 
             renderer_ = ftxui::Renderer(components_, [&] {
@@ -74,9 +79,13 @@ namespace {
 
         void set_output_text(const std::string& text) { output_text_ = text; }
 
+        // Thread safe, engine callbacks use it to get a redraw
+        void request_redraw() { screen_.PostEvent(ftxui::Event::Custom); }
+
         Button btn_add_;
         Button btn_clear_;
         Button btn_start_;
+        Button btn_cancel_;
 
     private:
         ftxui::Element render_function() {
@@ -92,11 +101,70 @@ namespace {
             ));
             elements.push_back(ftxui::text(output_text_));
             elements.push_back(ftxui::separator());
-            elements.push_back(btn_start_.ui_->Render());
+            elements.push_back(ftxui::hbox(
+                btn_start_.ui_->Render() | ftxui::xflex,
+                btn_cancel_.ui_->Render() | ftxui::xflex
+            ));
+            elements.push_back(this->render_status());
 
             return ftxui::vbox(elements) | ftxui::border;
         }
 
+        ftxui::Element render_status() const {
+            const auto snap = engine_.get_snapshot();
+            if (snap.total_ == 0)
+                return ftxui::text("Idle");
+
+            std::string state = "Finished";
+            if (snap.cancelling_)
+                state = snap.running_ ? "Cancelling" : "Cancelled";
+            else if (snap.running_)
+                state = "Running";
+
+            const auto rate = snap.elapsed_ > 0 ? snap.done_ / snap.elapsed_
+                                                : 0.0;
+            const auto saved = static_cast<double>(snap.src_bytes_) -
+                               static_cast<double>(snap.dst_bytes_);
+            const auto count = [&](sung::WorkOutcome outcome) {
+                const auto it = snap.outcomes_.find(outcome);
+                return it == snap.outcomes_.end() ? size_t{ 0 } : it->second;
+            };
+
+            ftxui::Elements elements;
+            elements.push_back(ftxui::text(fmt::format(
+                "{}: {}/{} files, {:.2f} files/s, {:.1f} MB saved",
+                state,
+                snap.done_,
+                snap.total_,
+                rate,
+                saved / 1e6
+            )));
+            elements.push_back(ftxui::gauge(
+                static_cast<float>(snap.done_) / snap.total_
+            ));
+            elements.push_back(ftxui::text(fmt::format(
+                "success {}, not reduced {}, failed {}, cancelled {}",
+                count(sung::WorkOutcome::success),
+                count(sung::WorkOutcome::not_reduced),
+                count(sung::WorkOutcome::failed),
+                count(sung::WorkOutcome::cancelled)
+            )));
+
+            for (size_t i = 0; i < snap.current_.size(); ++i) {
+                const auto& path = snap.current_[i];
+                elements.push_back(ftxui::text(fmt::format(
+                    " #{:<2} {}",
+                    i,
+                    path.empty() ? "-" : sung::make_utf8_str(path.filename())
+                )));
+            }
+
+            if (!snap.last_error_.empty())
+                elements.push_back(ftxui::text(snap.last_error_));
+
+            return ftxui::vbox(elements);
+        }
+
         std::string input_path_data_;
         ftxui::Component input_path_ui_;
 
@@ -104,6 +172,7 @@ namespace {
         ftxui::Component checkbox_recur_ui_;
 
         std::string output_text_;
+        const sung::RefineEngine& engine_;
 
         ftxui::Component components_;
         ftxui::Component renderer_;
@@ -119,51 +188,18 @@ namespace {
         return str;
     }
 
-    std::string do_work(const fs::path& path) {
-        OIIO::ImageBuf img(path.string());
-        const auto ok = img.read();
-        if (!ok)
-            return img.geterror();
-
-        const auto width = img.spec().width;
-        const auto height = img.spec().height;
-        const auto nc = img.nchannels();
-        const auto npixels = img.spec().image_pixels();
-
-        const OIIO::ROI roi(0, 640, 0, 480, 0, 1, 0, img.nchannels());
-        const auto resized = OIIO::ImageBufAlgo::resize(img, nullptr, roi);
-        if (resized.has_error())
-            return resized.geterror();
-
-        const auto new_name_ext = fmt::format(
-            "{}_resized.png", path.stem().string()
-        );
-        const auto out_path = path.parent_path() / new_name_ext;
-
-        OIIO::ImageSpec spec{
-            roi.width(), roi.height(), nc, OIIO::TypeDesc::UINT8
-        };
-        spec["png:compressionLevel"] = 9;
-
-        auto out = OIIO::ImageOutput::create(out_path.string());
-        out->open(out_path.string(), spec);
-
-        resized.write(
-            out.get(),
-            [](void* opaque_data, float portion_done) { return false; },
-            nullptr
-        );
-
-        return "success";
-    }
-
 }  // namespace
 
 
 int main() {
-    ::Widget widget;
+    sung::oiio::set_thread_limit(sung::get_cpu_limit());
+    sung::RefineEngine engine;
+    ::Widget widget(engine);
     sung::FileList file_list;
 
+    sung::ImgRefWorkConfigs configs;
+    configs.reduction_threshold_ = 0.9;
+
     widget.set_output_text(file_list.make_text());
 
     file_list.file_filter_ = [](fs::path path) {
@@ -193,14 +229,17 @@ int main() {
     };
 
     widget.btn_start_.on_click_ = [&]() {
-        for (const auto& path : file_list.get_files()) {
-            const auto result = ::do_work(path);
-            break;
-        }
-
-        widget.set_output_text("All files processed successfully");
+        const auto err = engine.start(file_list, configs);
+        if (!err.empty())
+            widget.set_output_text(err);
     };
 
+    widget.btn_cancel_.on_click_ = [&]() { engine.cancel(); };
+
+    engine.on_update_ = [&]() { widget.request_redraw(); };
+
     widget.start();
+    engine.cancel();
+    engine.wait();
     return 0;
 }
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+struct archive;
+
+
+namespace sung {
+
+    namespace fs = std::filesystem;
+
+
+    struct ArchiveEntry {
+        // Relative, never escapes the archive root
+        fs::path path_;
+        std::vector<unsigned char> data_;
+    };
+
+
+    // Streams regular file entries of a tar or zip archive, optionally
+    // compressed, in the order they are stored.
+    class ArchiveReader {
+
+    public:
+        using Filter = std::function<bool(const fs::path&)>;
+
+        ArchiveReader() = default;
+        ~ArchiveReader();
+
+        ArchiveReader(const ArchiveReader&) = delete;
+        ArchiveReader& operator=(const ArchiveReader&) = delete;
+
+        std::string open(const fs::path& path);
+        // Entries rejected by `filter` are skipped without being read.
+        // nullopt at the end or on error, see `error()`.
+        std::optional<ArchiveEntry> next(const Filter& filter = {});
+
+        const std::string& error() const { return error_; }
+
+    private:
+        void close();
+
+        ::archive* ar_ = nullptr;
+        std::string error_;
+    };
+
+
+    // Writes all outputs into a single archive, the format is picked from
+    // the extension, e.g. `.tar` or `.zip`. Entries are stored without
+    // further compression.
+    class ArchiveWriter {
+
+    public:
+        ArchiveWriter() = default;
+        ~ArchiveWriter();
+
+        ArchiveWriter(const ArchiveWriter&) = delete;
+        ArchiveWriter& operator=(const ArchiveWriter&) = delete;
+
+        std::string open(const fs::path& path);
+        // Thread safe, entries are appended in call order
+        std::string add(
+            const fs::path& entry_path, const std::vector<unsigned char>& data
+        );
+        // Writes the trailer, the archive is not valid before this
+        std::string close();
+
+    private:
+        std::mutex mut_;
+        ::archive* ar_ = nullptr;
+        std::string error_;
+    };
+
+}  // namespace sung
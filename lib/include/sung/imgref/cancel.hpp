@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+
+
+namespace sung {
+
+    // Shared between whoever requests cancellation and the code that polls
+    // it. Polling is a relaxed load, plus a clock read when a deadline is
+    // set, cheap enough for per-scanline checks.
+    class CancelToken {
+
+    public:
+        using clock_t = std::chrono::steady_clock;
+
+        CancelToken() = default;
+        // Also cancelled when `parent` is, or once `seconds` have passed.
+        // There is no deadline unless `seconds` is positive.
+        CancelToken(const CancelToken* parent, double seconds)
+            : parent_(parent), has_deadline_(seconds > 0) {
+            if (has_deadline_)
+                deadline_ = clock_t::now() +
+                            std::chrono::duration_cast<clock_t::duration>(
+                                std::chrono::duration<double>(seconds)
+                            );
+        }
+
+        void cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+        void reset() { cancelled_.store(false, std::memory_order_relaxed); }
+
+        bool is_cancelled() const {
+            if (cancelled_.load(std::memory_order_relaxed))
+                return true;
+            if (parent_ && parent_->is_cancelled())
+                return true;
+            return this->is_expired();
+        }
+
+        // The deadline has passed, whatever the parent says
+        bool is_expired() const {
+            return has_deadline_ && clock_t::now() >= deadline_;
+        }
+
+    private:
+        std::atomic<bool> cancelled_ = false;
+        const CancelToken* parent_ = nullptr;
+        bool has_deadline_ = false;
+        clock_t::time_point deadline_;
+    };
+
+}  // namespace sung
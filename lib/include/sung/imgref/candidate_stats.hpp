@@ -0,0 +1,94 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+
+namespace sung {
+
+    namespace fs = std::filesystem;
+
+
+    struct ImageClass {
+        bool transparent_ = false;
+        bool monochrome_ = false;
+        int width_ = 0;
+        int height_ = 0;
+        std::string src_ext_;
+
+        std::string make_key() const;
+    };
+
+
+    // Win counts of export candidates per image class. Thread safe.
+    class CandidateStats {
+
+    public:
+        struct Leader {
+            std::string name_;
+            double win_rate_ = 0;
+            uint64_t trials_ = 0;
+        };
+
+        // Only call this with outcomes where every candidate was encoded
+        // regardless of a leader, otherwise the statistics are biased by
+        // whatever was tried first.
+        void add_outcome(
+            const std::string& class_key, const std::string& winner
+        );
+
+        std::optional<Leader> get_leader(const std::string& class_key) const;
+
+        std::string load(const fs::path& path);
+        std::string save(const fs::path& path) const;
+
+    private:
+        struct Tally {
+            uint64_t trials_ = 0;
+            std::map<std::string, uint64_t> wins_;
+        };
+
+        mutable std::mutex mut_;
+        std::map<std::string, Tally> classes_;
+    };
+
+
+    struct CandidateSelectorConfigs {
+        // Fraction of images for which every candidate is encoded anyway
+        double explore_rate_ = 0.05;
+        // Leader must beat the reduction threshold by this much
+        double margin_ = 0.05;
+        double min_win_rate_ = 0.6;
+        uint64_t min_trials_ = 20;
+    };
+
+
+    class CandidateSelector {
+
+    public:
+        CandidateSelector(
+            CandidateStats& stats, const CandidateSelectorConfigs& configs
+        );
+
+        // Returns the candidate to encode first, or nullopt if everything
+        // should be encoded for this image.
+        std::optional<std::string> pick_leader(
+            const std::string& class_key,
+            const std::vector<std::string>& available
+        ) const;
+
+        // `ratio` is output size over input size
+        bool is_good_enough(double ratio, double threshold) const;
+
+        CandidateStats& stats() { return stats_; }
+
+    private:
+        CandidateStats& stats_;
+        CandidateSelectorConfigs configs_;
+    };
+
+}  // namespace sung
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <optional>
+#include <string>
 #include <vector>
 
+#include "sung/imgref/shard.hpp"
+
 
 namespace sung {
 
@@ -12,11 +16,62 @@ namespace sung {
 
     struct ImgRefWorkConfigs {
         std::vector<fs::path> inputs_;
+        // Streamed instead of scanning `inputs_`, "-" for stdin
+        std::optional<fs::path> input_manifest_;
+        std::optional<fs::path> output_manifest_;
+        // Output paths mirror input paths relative to this
+        std::optional<fs::path> input_root_;
+        // Entries are streamed into memory instead of scanning `inputs_`
+        std::vector<fs::path> input_archives_;
+        // Outputs go into this tar or zip instead of `output_dir_`
+        std::optional<fs::path> output_archive_;
+        ShardSpec shard_;
         std::optional<fs::path> output_dir_;
+        // file://DIR or http://HOST[:PORT][/PATH] holding inputs and
+        // outputs, which are then keys rather than local paths
+        std::optional<std::string> storage_url_;
+        // Bytes read ahead from the storage and not yet used
+        int prefetch_mb_ = 256;
+        // Profile names from RENDITION_PROFILES, one output each
+        std::vector<std::string> renditions_;
+        // Pairs *_a colour and *_o opacity inputs into one image with alpha
+        bool merge_alpha_ = false;
         double reduction_threshold_ = 1;
         bool inplace_ = false;
         bool recursive_ = false;
         bool allow_webp_ = false;
+        bool allow_jxl_ = false;
+        int jxl_effort_ = 7;
+        // Adaptive candidate selection is enabled when this is set
+        std::optional<fs::path> stats_file_;
+        double adaptive_margin_ = 0.05;
+        double explore_rate_ = 0.05;
+        bool estimate_sizes_ = false;
+        double estimate_band_ = 0.15;
+        bool dedup_ = false;
+        bool dedup_near_ = false;
+        bool dedup_hardlink_ = false;
+        bool native_encoders_ = false;
+        // Keep processing files written into input folders until stopped
+        bool watch_ = false;
+        // Dispatch in path order rather than largest estimated cost first
+        bool path_order_ = false;
+        // Bytes per second read and written over all workers, 0 for none
+        uint64_t io_limit_ = 0;
+        // Re-read on SIGHUP along with the cgroup CPU quota
+        std::optional<fs::path> limits_file_;
+        // Idle decoded pixel memory kept for reuse over all threads
+        int pixel_pool_mb_ = 256;
+        // Per image limit, 0 for none. Timed out files are retried last.
+        double max_seconds_per_image_ = 0;
+        // Batched reads and writes on Linux, direct access if unavailable
+        bool io_uring_ = false;
+        // Prometheus textfile, rewritten every `metrics_interval_` seconds
+        std::optional<fs::path> metrics_file_;
+        int metrics_interval_ = 10;
+        // JSONL record per file, "-" for stdout
+        std::optional<fs::path> result_log_;
+        bool quiet_ = false;
     };
 
 }  // namespace sung
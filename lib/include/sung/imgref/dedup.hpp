@@ -0,0 +1,51 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <BS_thread_pool.hpp>
+
+
+namespace sung {
+
+    namespace fs = std::filesystem;
+
+
+    struct DuplicateGroup {
+        fs::path representative_;
+        // Byte-identical to the representative, never contains it
+        std::vector<fs::path> members_;
+        // Largest file of another group with a close perceptual hash. Only
+        // reported, the group is still processed on its own.
+        std::optional<fs::path> similar_to_;
+    };
+
+
+    struct DedupConfigs {
+        bool near_ = false;
+        // Max differing bits of the 64-bit perceptual hash
+        int max_hamming_ = 4;
+    };
+
+
+    // 64-bit content hash, not cryptographic
+    std::optional<uint64_t> hash_file_content(const fs::path& path);
+
+    // dHash over a 9x8 luminance thumbnail. JPEG files use a 1/8 scale
+    // DCT-domain decode, everything else a full decode through OIIO.
+    std::optional<uint64_t> compute_perceptual_hash(const fs::path& path);
+
+    // Every input file ends up in exactly one group, singletons included.
+    // Exact duplicates are found by size and content hash, then confirmed
+    // byte by byte. Near duplicates are clustered by perceptual hash and
+    // point at the cluster's largest file, but are never merged.
+    std::vector<DuplicateGroup> group_duplicates(
+        const std::set<fs::path>& files,
+        const DedupConfigs& configs,
+        BS::thread_pool& pool
+    );
+
+}  // namespace sung
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sung/general/expected.hpp>
+
+
+namespace sung {
+
+    namespace fs = std::filesystem;
+
+
+    // Files closed after writing or moved into watched folders, reported
+    // once no event has arrived for them during the debounce time. When the
+    // event queue overflows, every file in the folders is reported again.
+    class IDirWatcher {
+
+    public:
+        virtual ~IDirWatcher() = default;
+
+        // Waits at most `timeout`, returns the files that settled
+        virtual std::vector<fs::path> poll(
+            std::chrono::milliseconds timeout
+        ) = 0;
+    };
+
+
+    // With `recursive`, subfolders are watched too, including ones created
+    // or moved in later. Files already in a new subfolder when its watch
+    // is added are reported as well. Fails where inotify is unavailable.
+    sung::Expected<std::unique_ptr<IDirWatcher>, std::string> make_dir_watcher(
+        const std::vector<fs::path>& folders,
+        bool recursive,
+        std::chrono::milliseconds debounce
+    );
+
+}  // namespace sung
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sung/general/expected.hpp>
+
+
+namespace sung {
+
+    namespace fs = std::filesystem;
+
+
+    using ReadResult = sung::Expected<std::vector<unsigned char>, std::string>;
+
+
+    // Whole file reads and writes completed asynchronously, so requests
+    // from many workers can be batched.
+    class IFileIO {
+
+    public:
+        virtual ~IFileIO() = default;
+
+        virtual std::future<ReadResult> read(const fs::path& path) = 0;
+        // Creates or truncates the file, but not its parent folders.
+        // `data` must stay alive until the future is ready.
+        virtual std::future<std::string> write(
+            const fs::path& path, const std::vector<unsigned char>& data
+        ) = 0;
+
+        // Set when write() needs no parent folders made by the caller
+        virtual bool makes_folders() const { return false; }
+    };
+
+
+    // Submits from a dedicated thread through io_uring with registered
+    // buffers reused across files. Fails where io_uring is not compiled
+    // in or not permitted, callers then access files directly.
+    sung::Expected<std::unique_ptr<IFileIO>, std::string> make_uring_file_io(
+        unsigned queue_depth = 256
+    );
+
+}  // namespace sung
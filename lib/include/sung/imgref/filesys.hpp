@@ -2,7 +2,12 @@
 
 #include <filesystem>
 #include <functional>
+#include <optional>
 #include <set>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
 
 #include <sung/general/expected.hpp>
 
@@ -12,18 +17,33 @@ namespace sung {
     namespace fs = std::filesystem;
 
 
+    class IStorage;
+
+
     std::string make_utf8_str(const fs::path& path);
 
     std::string normalize_utf8_str(const std::string& str);
     std::u8string normalize_utf8_str(const std::u8string& str);
     fs::path normalize_utf8_path(const fs::path& path);
 
+    // Folders created or found are remembered for the rest of the process
+    // so each one costs at most one create_directories. Thread safe.
     void create_folder(const fs::path& path);
 
+    // fs::file_size memoized for inputs that do not change during a run.
+    // Failures are not cached. Thread safe.
+    uintmax_t get_file_size(const fs::path& path, std::error_code& ec);
+    // Drops the memoized size of a file that was written since
+    void forget_file(const fs::path& path);
+
     fs::path replace_ext(const fs::path& path, const fs::path& new_ext);
 
     std::optional<fs::path> make_fol_path_with_suffix(const fs::path& path);
 
+    sung::Expected<std::vector<unsigned char>, std::string> read_file(
+        const fs::path& path
+    );
+
 
     class AllowedExtFileFilter {
 
@@ -43,9 +63,25 @@ namespace sung {
 
         void clear();
         void add(const fs::path& path, bool recursive);
+        // Keys under the `prefix` folder of `storage`, kept as they are
+        std::string add(
+            IStorage& storage, const fs::path& prefix, bool recursive
+        );
+        // Drops files for which `pred` returns false
+        void retain_if(const std::function<bool(const fs::path&)>& pred);
 
         const std::set<fs::path>& get_files() const;
 
+        // Files whose stem ends with `first_suffix`, each with the file in
+        // the same folder whose stem ends with `second_suffix` instead,
+        // e.g. "_a" and "_o". The extension may differ. Files with either
+        // suffix but no partner are appended to `unpaired`.
+        std::vector<std::pair<fs::path, fs::path>> pair_by_suffix(
+            const std::string& first_suffix,
+            const std::string& second_suffix,
+            std::vector<fs::path>* unpaired = nullptr
+        ) const;
+
         std::string make_text() const;
         std::set<fs::path> make_locations() const;
         fs::path get_longest_common_prefix() const;
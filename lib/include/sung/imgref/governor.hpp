@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include <sung/general/expected.hpp>
+
+
+namespace sung {
+
+    // CPUs this process may keep busy: the cgroup v2 cpu.max quota of its
+    // cgroup and ancestors rounded up, capped by the affinity mask. Falls
+    // back to the hardware thread count. Never less than 1.
+    unsigned get_cpu_limit();
+
+
+    // Caps how many tasks run at once, can be changed while they run
+    class ConcurrencyGate {
+
+    public:
+        explicit ConcurrencyGate(size_t limit);
+
+        // Waiting tasks are let in when raised. Running ones finish when
+        // lowered.
+        void set_limit(size_t limit);
+        size_t limit() const;
+
+        void enter();
+        void leave();
+
+    private:
+        mutable std::mutex mut_;
+        std::condition_variable cv_;
+        size_t limit_;
+        size_t active_ = 0;
+    };
+
+
+    // Token bucket over bytes read and written, bursts up to one second
+    // of the rate. Requests larger than that pass and the debt is repaid
+    // by later callers.
+    class IoLimiter {
+
+    public:
+        // Bytes per second, 0 for unlimited
+        void set_rate(uint64_t bytes_per_sec);
+        uint64_t rate() const;
+
+        // Blocks until `bytes` may pass
+        void acquire(uint64_t bytes);
+
+    private:
+        using clock_t = std::chrono::steady_clock;
+
+        std::atomic<uint64_t> rate_ = 0;
+        std::mutex mut_;
+        double tokens_ = 0;
+        clock_t::time_point last_ = clock_t::now();
+    };
+
+    // Shared by every read and write of the process
+    IoLimiter& get_io_limiter();
+
+    // Overrides read from a text file while running, lines of "cpus N" or
+    // "io-limit RATE" with RATE as in parse_byte_rate. '#' starts a comment.
+    struct ResourceLimits {
+        std::optional<unsigned> cpus_;
+        std::optional<uint64_t> io_limit_;
+    };
+
+    sung::Expected<ResourceLimits, std::string> read_limits_file(
+        const std::filesystem::path& path
+    );
+
+    // "50M" is 50 MiB per second. Suffixes K, M and G are binary, no
+    // suffix is bytes. "0" is unlimited.
+    sung::Expected<uint64_t, std::string> parse_byte_rate(
+        const std::string& str
+    );
+
+}  // namespace sung
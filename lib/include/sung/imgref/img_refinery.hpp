@@ -4,10 +4,14 @@
 #include <map>
 #include <memory>
 #include <set>
+#include <string>
 #include <vector>
 
 #include <sung/general/expected.hpp>
 
+#include "sung/imgref/cancel.hpp"
+#include "sung/imgref/native_codec.hpp"
+
 
 namespace sung::oiio {
 
@@ -23,9 +27,11 @@ namespace sung::oiio {
 
         void resize_to_fit_into(double frame_w, double frame_h);
         void resize_to_enclose(double frame_w, double frame_h);
+        void resize_to_fit_area(double max_pixels);
 
         void resize_for_jpeg();
         void resize_for_webp();
+        void resize_for_jxl();
 
         // iPhone 16 Pro
         void resize_for_i16p();
@@ -47,21 +53,80 @@ namespace sung::oiio {
         bool animated_ = false;
         bool transparent_ = false;
         bool monochrome_ = false;
+        int orientation_ = 1;  // EXIF orientation, 1 is upright
+    };
+
+
+    // Threads OIIO may use within one call such as a resize, process wide
+    void set_thread_limit(unsigned count);
+
+
+    // From the file header alone, no pixels are decoded
+    struct ImageHeader {
+        int width_ = 0;
+        int height_ = 0;
+        int nchannels_ = 0;
+        std::string format_;  // OIIO format name, e.g. "jpeg"
     };
 
+    sung::Expected<ImageHeader, std::string> probe_img(
+        const std::filesystem::path& path
+    );
+
 
     using ImgExpected = sung::Expected<std::unique_ptr<IImage2D>, std::string>;
 
-    ImgExpected open_img(const std::filesystem::path& path);
+    // With `cancel`, pixels are read up front and the read is aborted
+    // with "Cancelled" once it is set
+    ImgExpected open_img(
+        const std::filesystem::path& path,
+        const sung::CancelToken* cancel = nullptr
+    );
+    // Decodes a file already in memory, `name` only selects the format
+    ImgExpected open_img(
+        const std::filesystem::path& name,
+        const std::vector<unsigned char>& data,
+        const sung::CancelToken* cancel = nullptr
+    );
 
     ImageProperties get_img_properties(const IImage2D& img);
 
-    ImgExpected resize_img(const IImage2D& img, const ImageSize2D& img_dim);
+    // Pixels of `img` in place, read into memory first if they were loaded
+    // lazily. Fails unless samples are 8 or 16-bit unsigned integers.
+    // Alpha is straight, premultiplied pixels are converted in place.
+    sung::Expected<sung::codec::PixelView, std::string> get_pixel_view(
+        IImage2D& img
+    );
+    // Refers to `pixels` without copying, they must outlive the image.
+    // Alpha, the last of 2 or 4 channels, is taken as straight.
+    ImgExpected wrap_pixels(const sung::codec::PixelView& pixels);
+
+    // With `cancel`, rows are resized in bands with a check in between
+    ImgExpected resize_img(
+        const IImage2D& img,
+        const ImageSize2D& img_dim,
+        const sung::CancelToken* cancel = nullptr
+    );
 
     ImgExpected drop_alpha_ch(const IImage2D& img);
 
     ImgExpected merge_greyscale_channels(const IImage2D& img);
 
+    // RGB or grey of `color` with the luminance of `opacity` as alpha, 8
+    // bits per channel. Any alpha in `color` is replaced. Sizes must match.
+    ImgExpected merge_alpha(const IImage2D& color, const IImage2D& opacity);
+
+    // 8-bit luminance resampled to exactly `width` x `height`
+    sung::Expected<std::vector<uint8_t>, std::string> make_grey_thumbnail(
+        const IImage2D& img, int width, int height
+    );
+
+
+    enum class EncoderBackend {
+        oiio,    // OIIO ImageOutput plugins
+        native,  // libjpeg-turbo, libpng, libwebp directly, OIIO as fallback
+    };
+
 
     class ImageExportHarbor {
 
@@ -73,6 +138,7 @@ namespace sung::oiio {
 
 
         ImageExportHarbor();
+        explicit ImageExportHarbor(EncoderBackend backend);
         ~ImageExportHarbor();
 
         // Returns empty string on success, error message otherwise.
@@ -82,6 +148,14 @@ namespace sung::oiio {
             const int compression_level = 9
         );
 
+        // Lossless palette, grey and bit depth reduction, then the smallest
+        // of several filter/strategy trials. Independent of the backend.
+        std::string build_png_optimized(
+            const std::string_view& name,
+            const IImage2D& img,
+            const int compression_level = 9
+        );
+
         std::string build_jpeg(
             const std::string_view& name,
             const IImage2D& img,
@@ -98,6 +172,28 @@ namespace sung::oiio {
             const std::string_view& name, const IImage2D& img
         );
 
+        // Lossless DCT-domain rewrite of an existing JPEG file content.
+        // Independent of the encoder backend.
+        std::string build_jpeg_lossless(
+            const std::string_view& name,
+            const std::vector<unsigned char>& jpeg_data,
+            const bool progressive = true
+        );
+
+        std::string build_jxl(
+            const std::string_view& name,
+            const IImage2D& img,
+            const int quality_level,
+            const int effort = 7
+        );
+
+        // Lossless JPEG recompression, the JPEG can be restored exactly.
+        std::string build_jxl_from_jpeg(
+            const std::string_view& name,
+            const std::vector<unsigned char>& jpeg_data,
+            const int effort = 7
+        );
+
         void sort_by_size();
 
         using Iter_t = std::map<std::string, Record>::const_iterator;
@@ -105,8 +201,20 @@ namespace sung::oiio {
         std::vector<std::pair<std::string, const Record*>> get_sorted_by_size() const;
         Iter_t pick_the_smallest() const;
 
+        // Only used by EncoderBackend::native
+        sung::codec::JpegOptions jpeg_options_;
+        sung::codec::PngOptions png_options_;
+        sung::codec::WebpOptions webp_options_;
+
+        // Builds return "Cancelled" once this is set, OIIO writes in
+        // progress are aborted. Not owned.
+        const sung::CancelToken* cancel_token_ = nullptr;
+
     private:
+        bool is_cancelled() const;
+
         std::map<std::string, Record> data_;
+        EncoderBackend backend_ = EncoderBackend::oiio;
     };
 
 }  // namespace sung::oiio
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "sung/imgref/native_codec.hpp"
+
+
+namespace sung::codec {
+
+    struct JxlOptions {
+        // 1 (fastest) ~ 9 (slowest, smallest)
+        int effort_ = 7;
+    };
+
+
+    // `quality` follows the libjpeg scale, 100 means mathematically lossless.
+    // Pixels are taken as sRGB unless `metadata` has an ICC profile.
+    std::string encode_jxl(
+        std::vector<unsigned char>& out,
+        const PixelView& img,
+        float quality,
+        const JxlOptions& options,
+        const ImageMetadata& metadata = {}
+    );
+
+    // Lossless recompression of a JPEG stream. The original JPEG file can be
+    // reconstructed bit-exactly from the output.
+    std::string transcode_jpeg_to_jxl(
+        std::vector<unsigned char>& out,
+        const unsigned char* jpeg_data,
+        size_t jpeg_size,
+        const JxlOptions& options
+    );
+
+}  // namespace sung::codec
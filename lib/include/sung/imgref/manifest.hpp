@@ -0,0 +1,50 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <string>
+
+
+namespace sung {
+
+    namespace fs = std::filesystem;
+
+
+    // Streams UTF-8 paths separated by newlines or NULs. NUL separation is
+    // assumed if the first 64 KiB contain a NUL byte. Files are memory
+    // mapped on POSIX systems, "-" reads stdin.
+    class ManifestReader {
+
+    public:
+        ManifestReader() = default;
+        ~ManifestReader();
+
+        ManifestReader(const ManifestReader&) = delete;
+        ManifestReader& operator=(const ManifestReader&) = delete;
+
+        std::string open(const fs::path& path);
+        // Empty entries are skipped, nullopt at the end
+        std::optional<fs::path> next();
+
+    private:
+        bool refill();
+        void detect_separator();
+        void close();
+
+        const char* data_ = nullptr;
+        size_t size_ = 0;
+        size_t pos_ = 0;
+        char separator_ = '\n';
+
+        // Memory mapped file
+        void* map_ = nullptr;
+        size_t map_size_ = 0;
+
+        // Streamed input
+        std::istream* stream_ = nullptr;
+        std::ifstream file_;
+        std::string buffer_;
+    };
+
+}  // namespace sung
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace sung::metrics {
+
+    namespace fs = std::filesystem;
+
+
+    // Increments are spread over cache line padded slots so workers do not
+    // bounce the same line. Reads sum all slots.
+    class Counter {
+
+    public:
+        void inc(uint64_t n = 1);
+        uint64_t get() const;
+
+    private:
+        struct alignas(64) Slot {
+            std::atomic<uint64_t> value_ = 0;
+        };
+
+        static constexpr size_t SLOT_COUNT = 16;
+        std::array<Slot, SLOT_COUNT> slots_;
+    };
+
+
+    class Gauge {
+
+    public:
+        void set(double value);
+        void add(double delta);
+        double get() const;
+
+    private:
+        std::atomic<double> value_ = 0;
+    };
+
+
+    class Histogram {
+
+    public:
+        // Upper bounds in ascending order, +Inf is implicit
+        explicit Histogram(std::vector<double> bounds);
+
+        void observe(double value);
+
+        const std::vector<double>& bounds() const { return bounds_; }
+        // Non-cumulative, last one is the +Inf bucket
+        std::vector<uint64_t> get_counts() const;
+        double get_sum() const;
+        uint64_t get_count() const;
+
+    private:
+        std::vector<double> bounds_;
+        std::unique_ptr<std::atomic<uint64_t>[]> counts_;
+        std::atomic<double> sum_ = 0;
+        std::atomic<uint64_t> count_ = 0;
+    };
+
+
+    // 1ms ~ 2min, suitable for per-stage latencies in seconds
+    std::vector<double> make_latency_bounds();
+
+
+    // Metric creation takes a lock, updating a metric never does.
+    // Returned references are valid for the lifetime of the registry.
+    class Registry {
+
+    public:
+        // `labels` is in Prometheus syntax without braces, e.g. `stage="x"`
+        Counter& counter(
+            const std::string& name,
+            const std::string& help,
+            const std::string& labels = ""
+        );
+
+        Gauge& gauge(
+            const std::string& name,
+            const std::string& help,
+            const std::string& labels = ""
+        );
+
+        Histogram& histogram(
+            const std::string& name,
+            const std::string& help,
+            const std::string& labels = "",
+            std::vector<double> bounds = make_latency_bounds()
+        );
+
+        // Evaluated on every render, for values owned by someone else
+        void gauge_callback(
+            const std::string& name,
+            const std::string& help,
+            std::function<double()> callback
+        );
+
+        std::string render_prometheus() const;
+
+    private:
+        enum class Type { counter, gauge, histogram, callback };
+
+        struct Entry {
+            std::string name_;
+            std::string help_;
+            std::string labels_;
+            Type type_;
+            std::unique_ptr<Counter> counter_;
+            std::unique_ptr<Gauge> gauge_;
+            std::unique_ptr<Histogram> histogram_;
+            std::function<double()> callback_;
+        };
+
+        Entry* find(const std::string& name, const std::string& labels);
+
+        mutable std::mutex mut_;
+        std::deque<Entry> entries_;
+    };
+
+
+    // Observes the elapsed seconds into a histogram on destruction, and
+    // also stores them in `seconds` if given. Either may be null.
+    class StageTimer {
+
+    public:
+        explicit StageTimer(Histogram* histogram, double* seconds = nullptr);
+        ~StageTimer();
+
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+
+        // Observes now rather than on destruction
+        void finish();
+
+    private:
+        Histogram* histogram_;
+        double* seconds_;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+
+    // Writes the registry in Prometheus text format to `path` every
+    // `interval` on a background thread, replacing the file atomically
+    // so node_exporter's textfile collector never sees partial output.
+    class TextfileWriter {
+
+    public:
+        TextfileWriter(
+            const Registry& registry,
+            const fs::path& path,
+            std::chrono::milliseconds interval
+        );
+        ~TextfileWriter();
+
+        // Writes once more and stops the thread
+        void stop();
+
+    private:
+        void write_once() const;
+
+        const Registry& registry_;
+        fs::path path_;
+        std::chrono::milliseconds interval_;
+
+        std::mutex mut_;
+        std::condition_variable cv_;
+        bool stop_ = false;
+        std::thread thread_;
+    };
+
+
+    // Resident set size of this process, 0 if unknown on this platform
+    uint64_t get_process_rss_bytes();
+    // Highest resident set size so far, 0 if unknown on this platform
+    uint64_t get_peak_rss_bytes();
+
+}  // namespace sung::metrics
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+
+namespace sung::codec {
+
+    // Non-owning view of interleaved pixels.
+    // `bytes_per_ch_` is 1 for 8-bit and 2 for native-endian 16-bit samples.
+    struct PixelView {
+        const uint8_t* data_ = nullptr;
+        int width_ = 0;
+        int height_ = 0;
+        int nchannels_ = 0;
+        int bytes_per_ch_ = 1;
+        std::ptrdiff_t row_stride_ = 0;
+
+        const uint8_t* row(int y) const { return data_ + y * row_stride_; }
+    };
+
+
+    struct GreyImage {
+        std::vector<uint8_t> pixels_;
+        int width_ = 0;
+        int height_ = 0;
+    };
+
+
+    enum class ChromaSubsampling { s444, s422, s420 };
+
+    struct JpegOptions {
+        bool optimize_coding_ = true;
+        bool progressive_ = false;
+        ChromaSubsampling subsampling_ = ChromaSubsampling::s420;
+    };
+
+    struct PngOptions {
+        // Bit mask of PNG_FILTER_* values, 0 lets libpng choose
+        int filters_ = 0;
+        // One of Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE, ...; -1 for default
+        int zlib_strategy_ = -1;
+    };
+
+    // Colour space of the source image
+    struct ColorProfile {
+        std::vector<unsigned char> icc_;
+        bool srgb_ = false;
+        // Decoding gamma such as 2.2, 0 if unknown
+        float gamma_ = 0;
+
+        bool empty() const { return icc_.empty() && !srgb_ && gamma_ <= 0; }
+    };
+
+    // Written next to the pixels so viewers show them like the source
+    struct ImageMetadata {
+        std::vector<unsigned char> icc_;
+        // EXIF orientation, nothing is written for 1 (upright)
+        int orientation_ = 1;
+
+        bool empty() const { return icc_.empty() && orientation_ == 1; }
+    };
+
+    struct WebpOptions {
+        // 0 (fastest) ~ 6 (slowest, smallest)
+        int method_ = 4;
+        bool exact_ = false;
+    };
+
+
+    struct JpegTranscodeOptions {
+        bool progressive_ = true;
+        // ICC profiles are kept since dropping them shifts colours
+        bool keep_icc_ = true;
+    };
+
+
+    // All encoders return empty string on success, error message otherwise.
+    // Output is appended to `out`.
+
+    std::string encode_jpeg(
+        std::vector<unsigned char>& out,
+        const PixelView& img,
+        int quality,
+        const JpegOptions& options,
+        const ImageMetadata& metadata = {}
+    );
+
+    std::string encode_png(
+        std::vector<unsigned char>& out,
+        const PixelView& img,
+        int compression_level,
+        const PngOptions& options
+    );
+
+    // Adds one iCCP, sRGB or gAMA chunk, in that order of preference,
+    // right after the IHDR of the PNG stream in `png`.
+    std::string insert_png_color_chunks(
+        std::vector<unsigned char>& png, const ColorProfile& color
+    );
+
+    std::string encode_webp(
+        std::vector<unsigned char>& out,
+        const PixelView& img,
+        float quality,
+        bool lossless,
+        const WebpOptions& options
+    );
+
+    // Rewrites a JPEG stream from its DCT coefficients without decoding
+    // pixels. Huffman tables are always optimized and all markers other than
+    // ICC profiles are dropped. Pixels are bit-exact with the source.
+    std::string transcode_jpeg(
+        std::vector<unsigned char>& out,
+        const unsigned char* jpeg_data,
+        size_t jpeg_size,
+        const JpegTranscodeOptions& options
+    );
+
+    // Decodes luma only at 1/8 scale using libjpeg DCT scaling, which skips
+    // most of the IDCT and all of the colour conversion work.
+    std::string decode_jpeg_grey_reduced(
+        GreyImage& out, const unsigned char* jpeg_data, size_t jpeg_size
+    );
+
+}  // namespace sung::codec
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+namespace sung {
+
+    // Pixel storage taken from the calling thread's pool. Returned to the
+    // pool of whichever thread releases it, or freed if pools are full.
+    class PixelBuffer {
+
+    public:
+        PixelBuffer() = default;
+        ~PixelBuffer();
+        PixelBuffer(PixelBuffer&& other) noexcept = default;
+        PixelBuffer& operator=(PixelBuffer&& other) noexcept;
+
+        // At least `bytes` long, contents are uninitialized
+        static PixelBuffer acquire(size_t bytes);
+
+        uint8_t* data() { return data_.get(); }
+        size_t capacity() const { return capacity_; }
+        void release();
+
+    private:
+        std::unique_ptr<uint8_t[]> data_;
+        size_t capacity_ = 0;
+    };
+
+
+    struct PixelPoolStats {
+        double hit_rate() const {
+            const auto total = hits_ + misses_;
+            return total ? static_cast<double>(hits_) / total : 0;
+        }
+
+        uint64_t hits_ = 0;
+        uint64_t misses_ = 0;
+        // Held by images and idle in pools together
+        uint64_t peak_bytes_ = 0;
+        uint64_t idle_bytes_ = 0;
+    };
+
+    // Idle bytes kept over all threads, 0 frees buffers on release
+    void set_pixel_pool_limit(size_t bytes);
+    PixelPoolStats get_pixel_pool_stats();
+
+}  // namespace sung
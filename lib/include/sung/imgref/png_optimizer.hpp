@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "sung/imgref/cancel.hpp"
+#include "sung/imgref/native_codec.hpp"
+
+
+namespace sung::codec {
+
+    struct PngOptimizeOptions {
+        int compression_level_ = 9;
+        bool allow_palette_ = true;
+        bool allow_grey_ = true;
+        bool allow_bit_depth_reduction_ = true;
+        // Polled between rows and on every write, trials stop once set
+        const sung::CancelToken* cancel_ = nullptr;
+    };
+
+
+    struct PngOptimizeStats {
+        int color_type_ = -1;  // PNG_COLOR_TYPE_*
+        int bit_depth_ = 0;
+        int trials_ = 0;
+        int aborted_trials_ = 0;
+        int best_filters_ = 0;
+        int best_strategy_ = 0;
+    };
+
+
+    // Lossless. Picks the smallest colour type and bit depth that can hold
+    // every pixel exactly, then keeps the smallest of several filter and
+    // zlib strategy trials. Trials give up once they exceed the best so far.
+    std::string optimize_png(
+        std::vector<unsigned char>& out,
+        const PixelView& img,
+        const PngOptimizeOptions& options,
+        PngOptimizeStats* stats = nullptr
+    );
+
+}  // namespace sung::codec
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <BS_thread_pool.hpp>
+
+#include "sung/imgref/refinery.hpp"
+
+
+namespace sung {
+
+    // Runs refine_img over a batch on a worker pool in the background, for
+    // front ends that must stay responsive.
+    class RefineEngine {
+
+    public:
+        struct Snapshot {
+            bool running_ = false;
+            bool cancelling_ = false;
+            size_t total_ = 0;
+            size_t done_ = 0;
+            std::map<WorkOutcome, size_t> outcomes_;
+            // Of successful files only
+            uint64_t src_bytes_ = 0;
+            uint64_t dst_bytes_ = 0;
+            double elapsed_ = 0;
+            // Per worker, empty when idle
+            std::vector<fs::path> current_;
+            std::string last_error_;
+        };
+
+        // 0 sizes the pool by sung::get_cpu_limit()
+        explicit RefineEngine(size_t thread_count = 0);
+        // Cancels and waits for the running batch
+        ~RefineEngine();
+
+        RefineEngine(const RefineEngine&) = delete;
+        RefineEngine& operator=(const RefineEngine&) = delete;
+
+        // Returns immediately. Fails if a batch is already running.
+        std::string start(
+            const FileList& files, const ImgRefWorkConfigs& configs
+        );
+        void cancel();
+        void wait();
+
+        Snapshot get_snapshot() const;
+
+        // Called from worker threads whenever the snapshot changes. Must
+        // be thread safe and must not call back into the engine.
+        std::function<void()> on_update_;
+
+    private:
+        void process(size_t index);
+        void notify() const;
+
+        BS::thread_pool pool_;
+        std::thread batch_thread_;
+        CancelToken cancel_token_;
+
+        // Constant while a batch is running
+        ImgRefWorkConfigs configs_;
+        std::optional<ExternalResultLoc> output_loc_;
+        std::vector<fs::path> files_;
+
+        mutable std::mutex mut_;
+        Snapshot state_;
+        std::chrono::steady_clock::time_point start_time_;
+    };
+
+}  // namespace sung
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <filesystem>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "sung/imgref/archive.hpp"
+#include "sung/imgref/cancel.hpp"
+#include "sung/imgref/candidate_stats.hpp"
+#include "sung/imgref/configs.hpp"
+#include "sung/imgref/file_io.hpp"
+#include "sung/imgref/filesys.hpp"
+#include "sung/imgref/metrics.hpp"
+#include "sung/imgref/result_log.hpp"
+#include "sung/imgref/size_estimator.hpp"
+
+
+namespace sung {
+
+    namespace fs = std::filesystem;
+
+
+    // Members are null when metrics are disabled
+    struct WorkMetrics {
+        sung::metrics::Registry* registry_ = nullptr;
+        sung::metrics::Histogram* decode_ = nullptr;
+        sung::metrics::Histogram* resize_ = nullptr;
+        sung::metrics::Histogram* encode_ = nullptr;
+        sung::metrics::Histogram* write_ = nullptr;
+        sung::metrics::Counter* bytes_in_ = nullptr;
+        sung::metrics::Counter* bytes_out_ = nullptr;
+        // Per candidate name, created up front so add_win takes no lock
+        std::map<std::string, sung::metrics::Counter*> wins_;
+
+        void add_win(const std::string& candidate) const;
+    };
+
+    WorkMetrics make_work_metrics(sung::metrics::Registry& registry);
+
+
+    // Everything refine_img needs besides the file itself. Shared by all
+    // workers, so every pointee must be thread safe.
+    struct WorkContext {
+        const ImgRefWorkConfigs& configs_;
+        const ExternalResultLoc& output_loc_;
+        CandidateSelector* selector_ = nullptr;
+        SizeEstimator* estimator_ = nullptr;
+        WorkMetrics metrics_;
+        const CancelToken* cancel_ = nullptr;
+        // Outputs are added here instead of written under `output_loc_`,
+        // which then maps to entry paths
+        ArchiveWriter* archive_out_ = nullptr;
+        // Files are accessed directly when null
+        IFileIO* io_ = nullptr;
+        // Per image limit, unfinished work is then reported as timed out
+        double max_seconds_ = 0;
+    };
+
+
+    struct WorkOutput {
+        WorkRecord record_;
+        // Appended to duplicates of the same file
+        std::string suffix_;
+    };
+
+
+    // Decodes, resizes and encodes every candidate for one image, then
+    // writes the smallest if it beats the reduction threshold. Returns a
+    // human readable result, details are in `output.record_`.
+    std::string refine_img(
+        const fs::path& path, const WorkContext& ctx, WorkOutput& output
+    );
+
+    // Same with the file content already in memory, e.g. an archive entry.
+    // `path` names the input but is never opened.
+    std::string refine_img(
+        const fs::path& path,
+        const std::vector<unsigned char>& data,
+        const WorkContext& ctx,
+        WorkOutput& output
+    );
+
+
+    // Decodes once and writes one output per profile in `renditions_`.
+    // Each size is resized from the next larger one and encoded through its
+    // own harbor, one after another on the calling thread. The threshold
+    // does not apply. `outputs` gets a record per profile, even if decoding
+    // failed.
+    std::string refine_renditions(
+        const fs::path& path,
+        const WorkContext& ctx,
+        std::vector<WorkOutput>& outputs
+    );
+
+    std::string refine_renditions(
+        const fs::path& path,
+        const std::vector<unsigned char>& data,
+        const WorkContext& ctx,
+        std::vector<WorkOutput>& outputs
+    );
+
+
+    // Puts the opacity image into the alpha channel of the colour image and
+    // writes the smaller of lossless PNG and, if allowed, WebP. Outputs are
+    // named after `merged_name`, which does not need to exist. The record
+    // is keyed on `color` and counts both inputs as source bytes.
+    std::string refine_alpha_pair(
+        const fs::path& color,
+        const fs::path& opacity,
+        const fs::path& merged_name,
+        const WorkContext& ctx,
+        WorkOutput& output
+    );
+
+}  // namespace sung
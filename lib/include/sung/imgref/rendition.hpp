@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+
+#include "sung/imgref/img_refinery.hpp"
+
+
+namespace sung {
+
+    enum class FrameFit {
+        fit_into,  // Both sides within the frame
+        enclose,   // Covers the frame, the longer side may exceed it
+    };
+
+
+    // A target size, never upscaled
+    struct RenditionProfile {
+        std::string_view name_;
+        double frame_w_ = 0;
+        double frame_h_ = 0;
+        FrameFit fit_ = FrameFit::fit_into;
+        // Landscape images get a frame twice as wide, for two page spreads
+        bool spread_ = false;
+    };
+
+
+    constexpr std::array RENDITION_PROFILES{
+        RenditionProfile{ "2k", 2000, 2000, FrameFit::enclose },
+        RenditionProfile{ "i16p", 1206, 2622 },
+        RenditionProfile{ "i16p_pages", 1206, 2622, FrameFit::fit_into, true },
+        RenditionProfile{ "hd", 1920, 1080 },
+        RenditionProfile{ "thumb", 320, 320 },
+    };
+
+
+    constexpr const RenditionProfile* find_rendition_profile(
+        std::string_view name
+    ) {
+        for (const auto& profile : RENDITION_PROFILES) {
+            if (profile.name_ == name)
+                return &profile;
+        }
+        return nullptr;
+    }
+
+    static_assert(
+        [] {
+            for (size_t i = 0; i < RENDITION_PROFILES.size(); ++i) {
+                const auto name = RENDITION_PROFILES[i].name_;
+                if (find_rendition_profile(name) != &RENDITION_PROFILES[i])
+                    return false;
+            }
+            return true;
+        }(),
+        "Rendition profile names must be unique"
+    );
+
+
+    inline sung::oiio::ImageSize2D make_rendition_size(
+        const RenditionProfile& profile, int width, int height
+    ) {
+        sung::oiio::ImageSize2D out(width, height);
+        auto frame_w = profile.frame_w_;
+        if (profile.spread_ && width > height)
+            frame_w *= 2;
+
+        if (profile.fit_ == FrameFit::enclose)
+            out.resize_to_enclose(frame_w, profile.frame_h_);
+        else
+            out.resize_to_fit_into(frame_w, profile.frame_h_);
+        return out;
+    }
+
+}  // namespace sung
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace sung {
+
+    namespace fs = std::filesystem;
+
+
+    enum class WorkOutcome {
+        success,
+        not_reduced,
+        failed,
+        cancelled,
+        timed_out,
+    };
+
+    const char* to_str(WorkOutcome outcome);
+    std::optional<WorkOutcome> parse_work_outcome(const std::string& str);
+
+
+    struct StageTimings {
+        double decode_ = 0;
+        double resize_ = 0;
+        double encode_ = 0;
+        double write_ = 0;
+    };
+
+
+    // One line of the result log
+    struct WorkRecord {
+        fs::path path_;
+        // Profile name when one input has several outputs
+        std::string rendition_;
+        WorkOutcome outcome_ = WorkOutcome::failed;
+        std::string message_;
+        std::string candidate_;
+        fs::path output_path_;
+        uint64_t src_bytes_ = 0;
+        uint64_t dst_bytes_ = 0;
+        // Set when the result was copied from an identical file
+        std::optional<fs::path> duplicate_of_;
+        // Set when a perceptual hash matched another input, only reported
+        std::optional<fs::path> similar_to_;
+        StageTimings timings_;
+
+        std::string make_json() const;
+        // Accepts lines produced by make_json
+        static std::optional<WorkRecord> from_json(const std::string& line);
+    };
+
+
+    // Lock-free multi producer, single consumer queue (Vyukov). push is
+    // wait-free; pop may briefly miss an item whose push is in progress.
+    template <typename T>
+    class MpscQueue {
+
+    public:
+        MpscQueue() : head_(new Node), tail_(head_.load()) {}
+
+        ~MpscQueue() {
+            while (this->pop()) {
+            }
+            delete tail_;
+        }
+
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+
+        void push(T value) {
+            const auto node = new Node;
+            node->value_.emplace(std::move(value));
+            const auto prev = head_.exchange(node, std::memory_order_acq_rel);
+            prev->next_.store(node, std::memory_order_release);
+        }
+
+        // Consumer thread only
+        std::optional<T> pop() {
+            const auto next = tail_->next_.load(std::memory_order_acquire);
+            if (!next)
+                return std::nullopt;
+
+            std::optional<T> out = std::move(next->value_);
+            next->value_.reset();
+            delete tail_;
+            tail_ = next;
+            return out;
+        }
+
+    private:
+        struct Node {
+            std::optional<T> value_;
+            std::atomic<Node*> next_ = nullptr;
+        };
+
+        std::atomic<Node*> head_;
+        Node* tail_;
+    };
+
+
+    struct ResultSinkConfigs {
+        // JSONL destination, "-" for stdout, nothing to only keep tallies
+        std::optional<fs::path> log_path_;
+        // TSV of input, output, src and dst bytes for each written output
+        std::optional<fs::path> manifest_path_;
+        // For the ETA, 0 if unknown
+        uint64_t total_ = 0;
+        bool progress_ = true;
+    };
+
+
+    // Workers push records, one writer thread serializes them with large
+    // buffered writes, at least every few seconds, and redraws a single
+    // progress line.
+    class ResultSink {
+
+    public:
+        struct Summary {
+            std::map<WorkOutcome, uint64_t> outcomes_;
+            // Of successful records only
+            uint64_t src_bytes_ = 0;
+            uint64_t dst_bytes_ = 0;
+            double elapsed_ = 0;
+        };
+
+        ResultSink() = default;
+        ~ResultSink();
+
+        ResultSink(const ResultSink&) = delete;
+        ResultSink& operator=(const ResultSink&) = delete;
+
+        std::string start(const ResultSinkConfigs& configs);
+        void push(WorkRecord record);
+        // Drains the queue, flushes and joins the writer
+        void finish();
+
+        // Only valid after finish
+        const Summary& summary() const { return summary_; }
+
+    private:
+        void run();
+        void flush();
+        void print_progress(bool final);
+
+        ResultSinkConfigs configs_;
+        MpscQueue<WorkRecord> queue_;
+        std::atomic<bool> stop_ = false;
+        std::thread thread_;
+
+        // Owned by the writer thread
+        std::ofstream file_;
+        std::ostream* out_ = nullptr;
+        std::string buffer_;
+        std::ofstream manifest_file_;
+        std::string manifest_buffer_;
+        Summary summary_;
+        uint64_t done_ = 0;
+        std::chrono::steady_clock::time_point start_time_;
+    };
+
+
+    // Combines result logs of several shards into one sorted by path and
+    // rendition. When one is in more than one log, the later log wins.
+    std::string merge_result_logs(
+        const std::vector<fs::path>& inputs,
+        const fs::path& output,
+        ResultSink::Summary* summary = nullptr
+    );
+
+}  // namespace sung
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <filesystem>
+#include <vector>
+
+#include "sung/imgref/configs.hpp"
+#include "sung/imgref/img_refinery.hpp"
+
+
+namespace sung {
+
+    namespace fs = std::filesystem;
+
+
+    // Single-core seconds of one cost unit, a JPEG encode of a megapixel.
+    // Only used to turn costs into predictions before anything is timed.
+    constexpr double SECONDS_PER_COST_UNIT = 0.02;
+
+    // Relative cost of refining an image, roughly megapixels times the
+    // number of full encodes. Only the ratio between jobs matters.
+    double estimate_job_cost(
+        const sung::oiio::ImageHeader& header, const ImgRefWorkConfigs& configs
+    );
+
+    // Reads the header only. Unreadable files cost nothing since they fail
+    // right after opening.
+    double probe_job_cost(
+        const fs::path& path, const ImgRefWorkConfigs& configs
+    );
+
+    // Longest processing time first. Idle workers take the next job, so
+    // the small ones at the end fill the gaps left by the big ones.
+    std::vector<size_t> make_lpt_order(const std::vector<double>& costs);
+
+    // Greedy list scheduling of `order` onto `workers`, in cost units
+    double simulate_makespan(
+        const std::vector<double>& costs,
+        const std::vector<size_t>& order,
+        size_t workers
+    );
+
+}  // namespace sung
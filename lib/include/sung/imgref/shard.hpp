@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include <sung/general/expected.hpp>
+
+
+namespace sung {
+
+    namespace fs = std::filesystem;
+
+
+    // One slice of a batch split across processes, `index_` in [0, count_)
+    struct ShardSpec {
+        uint32_t index_ = 0;
+        uint32_t count_ = 1;
+
+        // `rel_path` must be relative to the batch root so that every
+        // process and host agrees regardless of where storage is mounted
+        bool contains(const fs::path& rel_path) const;
+    };
+
+    // Parses "i/N"
+    sung::Expected<ShardSpec, std::string> parse_shard_spec(
+        const std::string& str
+    );
+
+    // FNV-1a over the UTF-8 generic form, identical on every platform
+    uint64_t hash_path_stable(const fs::path& path);
+
+}  // namespace sung
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+
+
+namespace sung {
+
+    // Predicts full-size encode sizes from encodes of a downscaled proxy.
+    //
+    //   full bytes ~= proxy bytes * (full pixels / proxy pixels) * k
+    //
+    // `k` is calibrated per candidate from actual full-size encodes, since
+    // detail density and fixed overhead differ between formats. Thread safe.
+    class SizeEstimator {
+
+    public:
+        // Of the predictions predict() would have made, warm-up excluded
+        struct Error {
+            uint64_t samples_ = 0;
+            double sum_abs_rel_error_ = 0;
+            double sum_rel_error_ = 0;
+        };
+
+        explicit SizeEstimator(
+            double smoothing = 0.1, uint64_t min_samples = 5
+        );
+
+        // Returns nullopt until the candidate has enough calibration samples
+        std::optional<double> predict(
+            const std::string& candidate, size_t proxy_bytes, double pixel_ratio
+        ) const;
+
+        // Feeds an actual full-size result back into the calibration
+        void calibrate(
+            const std::string& candidate,
+            size_t proxy_bytes,
+            double pixel_ratio,
+            size_t actual_bytes
+        );
+
+        std::string make_report() const;
+
+    private:
+        struct Entry {
+            double factor_ = 1;
+            uint64_t samples_ = 0;
+            Error error_;
+        };
+
+        mutable std::mutex mut_;
+        std::map<std::string, Entry> entries_;
+        double smoothing_;
+        uint64_t min_samples_;
+    };
+
+}  // namespace sung
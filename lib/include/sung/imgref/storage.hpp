@@ -0,0 +1,55 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sung/general/expected.hpp>
+
+#include "sung/imgref/file_io.hpp"
+
+
+namespace sung {
+
+    namespace fs = std::filesystem;
+
+
+    // Where inputs are listed and read from and outputs written to. Paths
+    // are keys relative to the root of the store, written with '/'.
+    class IStorage : public IFileIO {
+
+    public:
+        // Files under the `prefix` folder, only its direct children unless
+        // `recursive`. Empty `prefix` is the root.
+        virtual sung::Expected<std::vector<fs::path>, std::string> list(
+            const fs::path& prefix, bool recursive
+        ) = 0;
+
+        // Hint that `paths` will be read in this order
+        virtual void prefetch(const std::vector<fs::path>& paths) {}
+    };
+
+
+    // Keys are paths under `root`
+    std::unique_ptr<IStorage> make_local_storage(const fs::path& root);
+
+
+    struct HttpStorageConfigs {
+        // http://host[:port][/path], keys are appended to the path
+        std::string url_;
+        // Requests in flight at once, also the prefetch parallelism
+        size_t connections_ = 8;
+        // Prefetched bytes not yet read, one object per connection more
+        // may be on the way when it is reached
+        size_t max_prefetch_bytes_ = size_t(256) << 20;
+    };
+
+    // Objects are read with GET and written with PUT. Listing is a GET of
+    // the root with `?list=<prefix>`, plus `&recursive=1`, answered with
+    // one key per line. py/object_store.py serves a folder this way.
+    sung::Expected<std::unique_ptr<IStorage>, std::string> make_http_storage(
+        const HttpStorageConfigs& configs
+    );
+
+}  // namespace sung
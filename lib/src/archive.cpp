@@ -0,0 +1,239 @@
+#include "sung/imgref/archive.hpp"
+
+#include <ctime>
+
+#include <archive.h>
+#include <archive_entry.h>
+#include <fmt/core.h>
+
+#include "sung/imgref/filesys.hpp"
+
+
+namespace {
+
+    namespace fs = std::filesystem;
+
+
+    // Large enough that each entry costs only a few reads or writes
+    constexpr size_t BLOCK_SIZE = 1024 * 1024;
+    constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+
+    std::string get_error(::archive* ar) {
+        const auto msg = ::archive_error_string(ar);
+        return msg ? msg : "Unknown archive error";
+    }
+
+    std::string make_generic_utf8_str(const fs::path& path) {
+        const auto path_str = path.generic_u8string();
+        return std::string(
+            reinterpret_cast<const char*>(path_str.c_str()), path_str.size()
+        );
+    }
+
+    // Absolute paths are made relative, paths leaving the root rejected
+    std::optional<fs::path> make_entry_path(::archive_entry* entry) {
+        auto name = ::archive_entry_pathname_utf8(entry);
+        if (!name)
+            name = ::archive_entry_pathname(entry);
+        if (!name)
+            return std::nullopt;
+
+        const std::u8string name_str(reinterpret_cast<const char8_t*>(name));
+        const auto path = fs::path(name_str).lexically_normal().relative_path();
+        if (path.empty() || *path.begin() == "..")
+            return std::nullopt;
+        return path;
+    }
+
+}  // namespace
+
+
+// ArchiveReader
+namespace sung {
+
+    ArchiveReader::~ArchiveReader() { this->close(); }
+
+    std::string ArchiveReader::open(const fs::path& path) {
+        this->close();
+
+        ar_ = ::archive_read_new();
+        ::archive_read_support_filter_all(ar_);
+        ::archive_read_support_format_tar(ar_);
+        ::archive_read_support_format_zip(ar_);
+
+#ifdef _WIN32
+        const auto res = ::archive_read_open_filename_w(
+            ar_, path.c_str(), BLOCK_SIZE
+        );
+#else
+        const auto res = ::archive_read_open_filename(
+            ar_, path.c_str(), BLOCK_SIZE
+        );
+#endif
+        if (res != ARCHIVE_OK) {
+            const auto err = fmt::format(
+                "Failed to open archive '{}': {}",
+                sung::make_utf8_str(path),
+                ::get_error(ar_)
+            );
+            this->close();
+            return err;
+        }
+
+        return {};
+    }
+
+    std::optional<ArchiveEntry> ArchiveReader::next(const Filter& filter) {
+        if (!ar_)
+            return std::nullopt;
+
+        ::archive_entry* entry = nullptr;
+        while (true) {
+            const auto res = ::archive_read_next_header(ar_, &entry);
+            if (res == ARCHIVE_EOF)
+                return std::nullopt;
+            if (res < ARCHIVE_WARN) {
+                error_ = ::get_error(ar_);
+                return std::nullopt;
+            }
+
+            if (::archive_entry_filetype(entry) != AE_IFREG)
+                continue;
+            auto path = ::make_entry_path(entry);
+            if (!path || (filter && !filter(*path)))
+                continue;
+
+            ArchiveEntry out;
+            out.path_ = std::move(*path);
+
+            // One spare byte so the final read that reports the end fits
+            size_t capacity = CHUNK_SIZE;
+            if (::archive_entry_size_is_set(entry))
+                capacity = static_cast<size_t>(::archive_entry_size(entry)) + 1;
+            out.data_.resize(capacity);
+
+            size_t used = 0;
+            while (true) {
+                if (used == out.data_.size())
+                    out.data_.resize(used * 2);
+                const auto read = ::archive_read_data(
+                    ar_, out.data_.data() + used, out.data_.size() - used
+                );
+                if (read < 0) {
+                    error_ = ::get_error(ar_);
+                    return std::nullopt;
+                }
+                if (read == 0)
+                    break;
+                used += static_cast<size_t>(read);
+            }
+            out.data_.resize(used);
+
+            return out;
+        }
+    }
+
+    void ArchiveReader::close() {
+        if (ar_)
+            ::archive_read_free(ar_);
+        ar_ = nullptr;
+        error_.clear();
+    }
+
+}  // namespace sung
+
+
+// ArchiveWriter
+namespace sung {
+
+    ArchiveWriter::~ArchiveWriter() { this->close(); }
+
+    std::string ArchiveWriter::open(const fs::path& path) {
+        this->close();
+
+        std::lock_guard lock(mut_);
+        error_.clear();
+        ar_ = ::archive_write_new();
+
+        const auto path_str = sung::make_utf8_str(path);
+        if (::archive_write_set_format_filter_by_ext(ar_, path_str.c_str()) !=
+            ARCHIVE_OK) {
+            ::archive_write_free(ar_);
+            ar_ = nullptr;
+            return fmt::format("Unsupported archive type: {}", path_str);
+        }
+
+        // Images are compressed already, ignored by formats other than zip
+        ::archive_write_set_options(ar_, "zip:compression=store");
+        ::archive_write_set_bytes_per_block(ar_, BLOCK_SIZE);
+        ::archive_write_set_bytes_in_last_block(ar_, 1);
+
+#ifdef _WIN32
+        const auto res = ::archive_write_open_filename_w(ar_, path.c_str());
+#else
+        const auto res = ::archive_write_open_filename(ar_, path.c_str());
+#endif
+        if (res != ARCHIVE_OK) {
+            const auto err = fmt::format(
+                "Failed to create archive '{}': {}", path_str, ::get_error(ar_)
+            );
+            ::archive_write_free(ar_);
+            ar_ = nullptr;
+            return err;
+        }
+
+        return {};
+    }
+
+    std::string ArchiveWriter::add(
+        const fs::path& entry_path, const std::vector<unsigned char>& data
+    ) {
+        std::lock_guard lock(mut_);
+        if (!error_.empty())
+            return error_;
+        if (!ar_)
+            return "Archive is not open";
+
+        const auto name = ::make_generic_utf8_str(entry_path);
+        auto entry = ::archive_entry_new();
+        ::archive_entry_set_pathname_utf8(entry, name.c_str());
+        ::archive_entry_set_filetype(entry, AE_IFREG);
+        ::archive_entry_set_perm(entry, 0644);
+        ::archive_entry_set_size(entry, data.size());
+        ::archive_entry_set_mtime(entry, std::time(nullptr), 0);
+
+        if (::archive_write_header(ar_, entry) != ARCHIVE_OK) {
+            error_ = fmt::format(
+                "Failed to add '{}' to archive: {}", name, ::get_error(ar_)
+            );
+        } else {
+            const auto written = ::archive_write_data(
+                ar_, data.data(), data.size()
+            );
+            if (written < 0 || static_cast<size_t>(written) != data.size())
+                error_ = fmt::format(
+                    "Failed to write '{}' to archive: {}",
+                    name,
+                    ::get_error(ar_)
+                );
+        }
+        ::archive_entry_free(entry);
+
+        return error_;
+    }
+
+    std::string ArchiveWriter::close() {
+        std::lock_guard lock(mut_);
+        if (!ar_)
+            return error_;
+
+        if (::archive_write_close(ar_) != ARCHIVE_OK && error_.empty())
+            error_ = "Failed to finish archive: " + ::get_error(ar_);
+        ::archive_write_free(ar_);
+        ar_ = nullptr;
+
+        return error_;
+    }
+
+}  // namespace sung
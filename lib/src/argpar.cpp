@@ -1,6 +1,12 @@
 #include "sung/imgref/argpar.hpp"
 
+#include <algorithm>
+
 #include <argparse/argparse.hpp>
+#include <fmt/core.h>
+
+#include "sung/imgref/governor.hpp"
+#include "sung/imgref/rendition.hpp"
 
 
 namespace sung {
@@ -13,11 +19,48 @@ namespace sung {
         std::vector<std::string> inputs;
         p.add_argument("inputs")
             .help("Input image file and folder paths")
+            .nargs(argparse::nargs_pattern::any)
             .append()
             .store_into(inputs);
 
+        p.add_argument("--input-manifest")
+            .help("File listing input paths by line or NUL, '-' for stdin");
+
+        p.add_argument("--output-manifest")
+            .help("Write input, output and sizes of each output as TSV");
+
+        std::vector<std::string> input_archives;
+        p.add_argument("--input-archive")
+            .help("Tar or zip archive to read images from, repeatable")
+            .append()
+            .store_into(input_archives);
+
+        p.add_argument("--output-archive")
+            .help("Write outputs into this .tar or .zip instead of -o");
+
+        p.add_argument("--input-root")
+            .help("Root of the output tree for manifest and archive inputs");
+
+        p.add_argument("--shard")
+            .help("Only process slice i of N, e.g. 0/4, for split runs");
+
         p.add_argument("-o", "--output").help("Output folder path");
 
+        p.add_argument("--storage")
+            .help("Read inputs and write -o through file://DIR or http://HOST");
+
+        p.add_argument("--prefetch-mb")
+            .help("Storage data read ahead and not yet used, in MiB")
+            .default_value(256)
+            .store_into(out.prefetch_mb_);
+
+        p.add_argument("--renditions")
+            .help("Comma separated profiles to output from one decode");
+
+        p.add_argument("--merge-alpha")
+            .help("Merge *_a colour and *_o opacity pairs into *_ao images")
+            .store_into(out.merge_alpha_);
+
         p.add_argument("-i", "--inplace")
             .help("Replace input files with output files")
             .store_into(out.inplace_);
@@ -37,6 +80,116 @@ namespace sung {
             .implicit_value(true)
             .store_into(out.allow_webp_);
 
+        p.add_argument("--jxl")
+            .help("Allow conversion to JPEG XL format")
+            .default_value(false)
+            .implicit_value(true)
+            .store_into(out.allow_jxl_);
+
+        p.add_argument("--jxl-effort")
+            .help("JPEG XL encoder effort, 1 (fast) ~ 9 (small)")
+            .default_value(7)
+            .store_into(out.jxl_effort_);
+
+        p.add_argument("--stats-file")
+            .help("Candidate win statistics file for adaptive selection");
+
+        p.add_argument("--adaptive-margin")
+            .help("Encode all candidates if the leader is this close to -t")
+            .default_value(0.05)
+            .store_into(out.adaptive_margin_);
+
+        p.add_argument("--explore-rate")
+            .help("Fraction of images that encode all candidates anyway")
+            .default_value(0.05)
+            .store_into(out.explore_rate_);
+
+        p.add_argument("--estimate")
+            .help("Skip candidates predicted to lose by a proxy encode")
+            .default_value(false)
+            .implicit_value(true)
+            .store_into(out.estimate_sizes_);
+
+        p.add_argument("--estimate-band")
+            .help("Fully encode candidates predicted within this of the best")
+            .default_value(0.15)
+            .store_into(out.estimate_band_);
+
+        p.add_argument("--dedup")
+            .help("Process byte-identical files once")
+            .default_value(false)
+            .implicit_value(true)
+            .store_into(out.dedup_);
+
+        p.add_argument("--dedup-near")
+            .help("Also report visually identical files by perceptual hash")
+            .default_value(false)
+            .implicit_value(true)
+            .store_into(out.dedup_near_);
+
+        p.add_argument("--dedup-hardlink")
+            .help("Hardlink duplicate results instead of copying them")
+            .default_value(false)
+            .implicit_value(true)
+            .store_into(out.dedup_hardlink_);
+
+        p.add_argument("--native-encoders")
+            .help("Encode with libjpeg-turbo, libpng and libwebp directly")
+            .default_value(false)
+            .implicit_value(true)
+            .store_into(out.native_encoders_);
+
+        p.add_argument("--io-uring")
+            .help("Read inputs ahead and write outputs through io_uring")
+            .default_value(false)
+            .implicit_value(true)
+            .store_into(out.io_uring_);
+
+        p.add_argument("--watch")
+            .help("After the first pass, process new files until Ctrl+C")
+            .default_value(false)
+            .implicit_value(true)
+            .store_into(out.watch_);
+
+        p.add_argument("--path-order")
+            .help("Process files in path order instead of largest first")
+            .default_value(false)
+            .implicit_value(true)
+            .store_into(out.path_order_);
+
+        p.add_argument("--pixel-pool-mb")
+            .help("Idle pixel buffer memory kept for reuse, 0 to disable")
+            .default_value(256)
+            .store_into(out.pixel_pool_mb_);
+
+        p.add_argument("--max-seconds-per-image")
+            .help("Abort images taking longer, they are retried at the end")
+            .default_value(0.0)
+            .store_into(out.max_seconds_per_image_);
+
+        p.add_argument("--io-limit")
+            .help("Bytes per second read and written, e.g. 50M, 0 for none");
+
+        p.add_argument("--limits-file")
+            .help("'cpus N' and 'io-limit RATE' lines re-read on SIGHUP");
+
+        p.add_argument("--metrics-file")
+            .help("Periodically write Prometheus metrics to this file");
+
+        p.add_argument("--metrics-interval")
+            .help("Seconds between metrics file updates")
+            .default_value(10)
+            .store_into(out.metrics_interval_);
+
+        p.add_argument("--result-log")
+            .help("Write one JSON line per file here, '-' for stdout");
+
+        p.add_argument("-q", "--quiet")
+            .help("Do not draw the progress line")
+            .default_value(false)
+            .implicit_value(true)
+            .store_into(out.quiet_);
+
         try {
             p.parse_args(argc, argv);
         } catch (const std::exception& err) {
@@ -45,6 +198,104 @@ namespace sung {
 
         for (auto& x : inputs) out.inputs_.emplace_back(x);
 
+        if (p.is_used("--input-manifest")) {
+            const auto manifest_str = p.get<std::string>("--input-manifest");
+            out.input_manifest_ = fs::path(manifest_str).lexically_normal();
+        }
+        for (auto& x : input_archives)
+            out.input_archives_.emplace_back(fs::path(x).lexically_normal());
+
+        const auto input_modes = (out.inputs_.empty() ? 0 : 1) +
+                                 (out.input_manifest_ ? 1 : 0) +
+                                 (out.input_archives_.empty() ? 0 : 1);
+        if (input_modes == 0)
+            return "No inputs given";
+        if (input_modes > 1)
+            return "Inputs, --input-manifest and --input-archive are exclusive";
+
+        if (p.is_used("--output-archive")) {
+            const auto archive_str = p.get<std::string>("--output-archive");
+            out.output_archive_ = fs::path(archive_str).lexically_normal();
+        }
+
+        const auto uses_archive = !out.input_archives_.empty() ||
+                                  out.output_archive_;
+        if (out.inplace_ && uses_archive)
+            return "--inplace cannot be used with archives";
+
+        if (p.is_used("--renditions")) {
+            const auto list = p.get<std::string>("--renditions");
+            size_t begin = 0;
+            while (begin <= list.size()) {
+                auto end = list.find(',', begin);
+                if (end == std::string::npos)
+                    end = list.size();
+
+                const auto name = list.substr(begin, end - begin);
+                if (!sung::find_rendition_profile(name)) {
+                    std::string names;
+                    for (const auto& x : sung::RENDITION_PROFILES)
+                        names += fmt::format(" {}", x.name_);
+                    return fmt::format(
+                        "Unknown rendition '{}', choose from:{}", name, names
+                    );
+                }
+                auto& renditions = out.renditions_;
+                const auto it = std::find(
+                    renditions.begin(), renditions.end(), name
+                );
+                if (it == renditions.end())
+                    renditions.push_back(name);
+                begin = end + 1;
+            }
+            if (out.inplace_)
+                return "--inplace cannot be used with --renditions";
+        }
+
+        if (out.watch_) {
+            if (out.inputs_.empty())
+                return "--watch needs input folders";
+            if (out.merge_alpha_)
+                return "--merge-alpha cannot be used with --watch";
+        }
+
+        if (out.metrics_interval_ < 1)
+            return "--metrics-interval must be at least 1";
+        if (out.jxl_effort_ < 1 || out.jxl_effort_ > 9)
+            return "--jxl-effort must be between 1 and 9";
+        if (out.pixel_pool_mb_ < 0)
+            return "--pixel-pool-mb must not be negative";
+        if (out.max_seconds_per_image_ < 0)
+            return "--max-seconds-per-image must not be negative";
+
+        if (out.merge_alpha_) {
+            if (out.inputs_.empty())
+                return "--merge-alpha needs plain file inputs";
+            if (out.inplace_)
+                return "--inplace cannot be used with --merge-alpha";
+            if (!out.renditions_.empty())
+                return "--renditions cannot be used with --merge-alpha";
+        }
+
+        if (p.is_used("--output-manifest")) {
+            const auto manifest_str = p.get<std::string>("--output-manifest");
+            out.output_manifest_ = fs::path(manifest_str).lexically_normal();
+        }
+
+        if (p.is_used("--input-root")) {
+            const auto root_str = p.get<std::string>("--input-root");
+            out.input_root_ = fs::path(root_str).lexically_normal();
+        }
+
+        if (p.is_used("--shard")) {
+            const auto shard = sung::parse_shard_spec(
+                p.get<std::string>("--shard")
+            );
+            if (!shard)
+                return shard.error();
+            out.shard_ = *shard;
+        }
+
         if (p.is_used("--output")) {
             const auto output_dir_str = p.get<std::string>("--output");
             out.output_dir_ = fs::path(output_dir_str).lexically_normal();
@@ -52,6 +303,51 @@ namespace sung {
             out.output_dir_ = std::nullopt;
         }
 
+        if (p.is_used("--stats-file")) {
+            const auto stats_file_str = p.get<std::string>("--stats-file");
+            out.stats_file_ = fs::path(stats_file_str).lexically_normal();
+        }
+
+        if (p.is_used("--io-limit")) {
+            const auto rate = sung::parse_byte_rate(
+                p.get<std::string>("--io-limit")
+            );
+            if (!rate)
+                return rate.error();
+            out.io_limit_ = *rate;
+        }
+
+        if (p.is_used("--limits-file")) {
+            const auto limits_str = p.get<std::string>("--limits-file");
+            out.limits_file_ = fs::path(limits_str).lexically_normal();
+        }
+
+        if (p.is_used("--metrics-file")) {
+            const auto metrics_str = p.get<std::string>("--metrics-file");
+            out.metrics_file_ = fs::path(metrics_str).lexically_normal();
+        }
+
+        if (p.is_used("--result-log")) {
+            const auto log_str = p.get<std::string>("--result-log");
+            out.result_log_ = fs::path(log_str).lexically_normal();
+        }
+
+        if (p.is_used("--storage")) {
+            out.storage_url_ = p.get<std::string>("--storage");
+            if (out.inputs_.empty())
+                return "--storage needs input prefixes";
+            if (!out.output_dir_)
+                return "--storage needs an output prefix with -o";
+            if (out.inplace_ || out.merge_alpha_ || out.watch_)
+                return "--storage cannot be used with --inplace, "
+                       "--merge-alpha or --watch";
+            if (out.output_archive_ || out.io_uring_)
+                return "--storage cannot be used with --output-archive "
+                       "or --io-uring";
+        }
+        if (out.prefetch_mb_ < 0)
+            return "--prefetch-mb must not be negative";
+
         return std::nullopt;
     }
 
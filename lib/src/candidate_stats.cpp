@@ -0,0 +1,194 @@
+#include "sung/imgref/candidate_stats.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+
+#include <fmt/core.h>
+
+
+namespace {
+
+    const char* size_bucket(int width, int height) {
+        const auto pixels = static_cast<double>(width) * height;
+        if (pixels < 250'000)
+            return "s";
+        if (pixels < 1'000'000)
+            return "m";
+        if (pixels < 4'000'000)
+            return "l";
+        return "xl";
+    }
+
+    double random_unit() {
+        thread_local std::mt19937 rng{ std::random_device{}() };
+        thread_local std::uniform_real_distribution<double> dist(0, 1);
+        return dist(rng);
+    }
+
+    std::vector<std::string> split_tabs(const std::string& line) {
+        std::vector<std::string> out;
+        std::stringstream ss(line);
+        std::string token;
+        while (std::getline(ss, token, '\t')) out.push_back(token);
+        return out;
+    }
+
+}  // namespace
+
+
+// ImageClass
+namespace sung {
+
+    std::string ImageClass::make_key() const {
+        auto ext = src_ext_;
+        std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+        return fmt::format(
+            "{}{}_{}_{}",
+            transparent_ ? "t" : "o",
+            monochrome_ ? "m" : "c",
+            ::size_bucket(width_, height_),
+            ext
+        );
+    }
+
+}  // namespace sung
+
+
+// CandidateStats
+namespace sung {
+
+    void CandidateStats::add_outcome(
+        const std::string& class_key, const std::string& winner
+    ) {
+        std::lock_guard lock(mut_);
+        auto& tally = classes_[class_key];
+        tally.trials_ += 1;
+        tally.wins_[winner] += 1;
+    }
+
+    std::optional<CandidateStats::Leader> CandidateStats::get_leader(
+        const std::string& class_key
+    ) const {
+        std::lock_guard lock(mut_);
+
+        const auto it = classes_.find(class_key);
+        if (it == classes_.end() || it->second.trials_ == 0)
+            return std::nullopt;
+
+        const auto& tally = it->second;
+        Leader out;
+        uint64_t best_wins = 0;
+        for (const auto& [name, wins] : tally.wins_) {
+            if (wins > best_wins) {
+                best_wins = wins;
+                out.name_ = name;
+            }
+        }
+
+        out.trials_ = tally.trials_;
+        out.win_rate_ = static_cast<double>(best_wins) / tally.trials_;
+        return out;
+    }
+
+    // Tab separated lines of either "class * trials" or "class name wins"
+    std::string CandidateStats::load(const fs::path& path) {
+        std::ifstream file(path);
+        if (!file)
+            return "Failed to open stats file";
+
+        std::map<std::string, Tally> loaded;
+        std::string line;
+        while (std::getline(file, line)) {
+            const auto tokens = ::split_tabs(line);
+            if (tokens.size() != 3)
+                continue;
+
+            uint64_t count = 0;
+            try {
+                count = std::stoull(tokens[2]);
+            } catch (const std::exception&) {
+                continue;
+            }
+
+            auto& tally = loaded[tokens[0]];
+            if (tokens[1] == "*")
+                tally.trials_ = count;
+            else
+                tally.wins_[tokens[1]] = count;
+        }
+
+        std::lock_guard lock(mut_);
+        classes_ = std::move(loaded);
+        return {};
+    }
+
+    std::string CandidateStats::save(const fs::path& path) const {
+        auto tmp_path = path;
+        tmp_path += ".tmp";
+
+        {
+            std::ofstream file(tmp_path, std::ios::trunc);
+            if (!file)
+                return "Failed to open stats file";
+
+            std::lock_guard lock(mut_);
+            for (const auto& [key, tally] : classes_) {
+                file << key << "\t*\t" << tally.trials_ << '\n';
+                for (const auto& [name, wins] : tally.wins_)
+                    file << key << '\t' << name << '\t' << wins << '\n';
+            }
+            if (!file)
+                return "Failed to write stats file";
+        }
+
+        std::error_code ec;
+        fs::rename(tmp_path, path, ec);
+        if (ec)
+            return fmt::format("Failed to move stats file: {}", ec.message());
+
+        return {};
+    }
+
+}  // namespace sung
+
+
+// CandidateSelector
+namespace sung {
+
+    CandidateSelector::CandidateSelector(
+        CandidateStats& stats, const CandidateSelectorConfigs& configs
+    )
+        : stats_(stats), configs_(configs) {}
+
+    std::optional<std::string> CandidateSelector::pick_leader(
+        const std::string& class_key, const std::vector<std::string>& available
+    ) const {
+        if (::random_unit() < configs_.explore_rate_)
+            return std::nullopt;
+
+        const auto leader = stats_.get_leader(class_key);
+        if (!leader)
+            return std::nullopt;
+        if (leader->trials_ < configs_.min_trials_)
+            return std::nullopt;
+        if (leader->win_rate_ < configs_.min_win_rate_)
+            return std::nullopt;
+
+        const auto it = std::find(
+            available.begin(), available.end(), leader->name_
+        );
+        if (it == available.end())
+            return std::nullopt;
+
+        return leader->name_;
+    }
+
+    bool CandidateSelector::is_good_enough(
+        double ratio, double threshold
+    ) const {
+        return ratio < threshold - configs_.margin_;
+    }
+
+}  // namespace sung
@@ -0,0 +1,347 @@
+#include "sung/imgref/dedup.hpp"
+
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <unordered_map>
+
+#include "sung/imgref/filesys.hpp"
+#include "sung/imgref/img_refinery.hpp"
+#include "sung/imgref/native_codec.hpp"
+
+
+namespace {
+
+    constexpr int DHASH_W = 9;
+    constexpr int DHASH_H = 8;
+
+
+    uint64_t mix64(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    uint64_t hash_bytes(uint64_t state, const unsigned char* data, size_t n) {
+        constexpr uint64_t PRIME = 0x9E3779B97F4A7C15ULL;
+
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            state = (state ^ ::mix64(word)) * PRIME;
+        }
+
+        uint64_t tail = 0;
+        std::memcpy(&tail, data + i, n - i);
+        state = (state ^ ::mix64(tail ^ (n - i))) * PRIME;
+        return state;
+    }
+
+    bool is_same_content(const sung::fs::path& a, const sung::fs::path& b) {
+        std::ifstream file_a(a, std::ios::binary);
+        std::ifstream file_b(b, std::ios::binary);
+        if (!file_a || !file_b)
+            return false;
+
+        std::vector<char> buf_a(1 << 20);
+        std::vector<char> buf_b(1 << 20);
+        while (true) {
+            file_a.read(buf_a.data(), buf_a.size());
+            file_b.read(buf_b.data(), buf_b.size());
+            const auto n = file_a.gcount();
+            if (n != file_b.gcount())
+                return false;
+            if (n == 0)
+                return true;
+            if (std::memcmp(buf_a.data(), buf_b.data(), n) != 0)
+                return false;
+        }
+    }
+
+    bool is_jpeg_path(const sung::fs::path& path) {
+        sung::AllowedExtFileFilter filter;
+        filter.add_allowed_ext(".jpg");
+        filter.add_allowed_ext(".jpeg");
+        return filter(path);
+    }
+
+    // Box filter, good enough for a 9x8 hash input
+    std::vector<uint8_t> downsample_grey(
+        const sung::codec::GreyImage& img, int width, int height
+    ) {
+        std::vector<uint8_t> out(size_t(width) * height);
+        for (int y = 0; y < height; ++y) {
+            const auto y0 = y * img.height_ / height;
+            const auto y1 = std::max(y0 + 1, (y + 1) * img.height_ / height);
+            for (int x = 0; x < width; ++x) {
+                const auto x0 = x * img.width_ / width;
+                const auto x1 = std::max(x0 + 1, (x + 1) * img.width_ / width);
+
+                uint64_t sum = 0;
+                for (int sy = y0; sy < y1; ++sy) {
+                    const auto row = img.pixels_.data() + sy * img.width_;
+                    for (int sx = x0; sx < x1; ++sx) sum += row[sx];
+                }
+                const auto count = uint64_t(y1 - y0) * (x1 - x0);
+                out[y * width + x] = static_cast<uint8_t>(sum / count);
+            }
+        }
+        return out;
+    }
+
+    uint64_t make_dhash(const std::vector<uint8_t>& thumb) {
+        uint64_t out = 0;
+        for (int y = 0; y < DHASH_H; ++y) {
+            for (int x = 0; x < DHASH_W - 1; ++x) {
+                const auto left = thumb[y * DHASH_W + x];
+                const auto right = thumb[y * DHASH_W + x + 1];
+                out = (out << 1) | (left < right ? 1 : 0);
+            }
+        }
+        return out;
+    }
+
+
+    class UnionFind {
+
+    public:
+        explicit UnionFind(size_t n) : parent_(n) {
+            std::iota(parent_.begin(), parent_.end(), size_t{ 0 });
+        }
+
+        size_t find(size_t x) {
+            while (parent_[x] != x) {
+                parent_[x] = parent_[parent_[x]];
+                x = parent_[x];
+            }
+            return x;
+        }
+
+        void merge(size_t a, size_t b) {
+            parent_[this->find(a)] = this->find(b);
+        }
+
+    private:
+        std::vector<size_t> parent_;
+    };
+
+
+    std::vector<sung::DuplicateGroup> group_exact(
+        const std::set<sung::fs::path>& files, BS::thread_pool& pool
+    ) {
+        std::map<uintmax_t, std::vector<sung::fs::path>> by_size;
+        for (const auto& path : files) {
+            std::error_code ec;
+            const auto size = sung::get_file_size(path, ec);
+            by_size[ec ? 0 : size].push_back(path);
+        }
+
+        std::vector<sung::fs::path> to_hash;
+        for (const auto& [size, paths] : by_size) {
+            if (size > 0 && paths.size() > 1)
+                to_hash.insert(to_hash.end(), paths.begin(), paths.end());
+        }
+
+        std::vector<std::optional<uint64_t>> hashes(to_hash.size());
+        pool.submit_sequence<size_t>(0, to_hash.size(), [&](size_t i) {
+            hashes[i] = sung::hash_file_content(to_hash[i]);
+        }).wait();
+
+        std::map<sung::fs::path, uint64_t> hash_of;
+        for (size_t i = 0; i < to_hash.size(); ++i) {
+            if (hashes[i])
+                hash_of[to_hash[i]] = *hashes[i];
+        }
+
+        std::vector<sung::DuplicateGroup> out;
+        for (const auto& [size, paths] : by_size) {
+            std::map<uint64_t, size_t> group_of_hash;
+            for (const auto& path : paths) {
+                const auto it = hash_of.find(path);
+                if (it == hash_of.end()) {
+                    out.push_back({ path, {}, std::nullopt });
+                    continue;
+                }
+
+                const auto found = group_of_hash.find(it->second);
+                if (found == group_of_hash.end()) {
+                    group_of_hash[it->second] = out.size();
+                    out.push_back({ path, {}, std::nullopt });
+                } else {
+                    out[found->second].members_.push_back(path);
+                }
+            }
+        }
+
+        // The hash only narrows it down, members replaced by the result of
+        // the representative must really be identical
+        std::vector<std::pair<size_t, size_t>> to_compare;
+        for (size_t g = 0; g < out.size(); ++g) {
+            for (size_t m = 0; m < out[g].members_.size(); ++m)
+                to_compare.emplace_back(g, m);
+        }
+        std::vector<char> same(to_compare.size());
+        pool.submit_sequence<size_t>(0, to_compare.size(), [&](size_t i) {
+            const auto& group = out[to_compare[i].first];
+            same[i] = ::is_same_content(
+                group.representative_, group.members_[to_compare[i].second]
+            );
+        }).wait();
+
+        std::vector<sung::DuplicateGroup> collided;
+        for (size_t i = to_compare.size(); i-- > 0;) {
+            if (same[i])
+                continue;
+            auto& members = out[to_compare[i].first].members_;
+            const auto it = members.begin() + to_compare[i].second;
+            collided.push_back({ std::move(*it), {}, std::nullopt });
+            members.erase(it);
+        }
+        out.insert(
+            out.end(),
+            std::make_move_iterator(collided.begin()),
+            std::make_move_iterator(collided.end())
+        );
+
+        return out;
+    }
+
+    std::vector<sung::DuplicateGroup> merge_near(
+        std::vector<sung::DuplicateGroup> groups,
+        const sung::DedupConfigs& configs,
+        BS::thread_pool& pool
+    ) {
+        std::vector<std::optional<uint64_t>> phashes(groups.size());
+        pool.submit_sequence<size_t>(0, groups.size(), [&](size_t i) {
+            phashes[i] = sung::compute_perceptual_hash(
+                groups[i].representative_
+            );
+        }).wait();
+
+        // Pigeonhole: within max_hamming bits, at least one of
+        // max_hamming + 1 bands must match exactly.
+        const auto nbands = configs.max_hamming_ + 1;
+        UnionFind uf(groups.size());
+        for (int band = 0; band < nbands; ++band) {
+            const auto bit_begin = band * 64 / nbands;
+            const auto bit_end = (band + 1) * 64 / nbands;
+            const auto width = bit_end - bit_begin;
+            const auto mask = width >= 64 ? ~uint64_t{ 0 }
+                                          : (uint64_t{ 1 } << width) - 1;
+
+            std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+            for (size_t i = 0; i < groups.size(); ++i) {
+                if (phashes[i])
+                    buckets[(*phashes[i] >> bit_begin) & mask].push_back(i);
+            }
+
+            for (const auto& [key, indices] : buckets) {
+                for (size_t a = 0; a < indices.size(); ++a) {
+                    for (size_t b = a + 1; b < indices.size(); ++b) {
+                        const auto ia = indices[a];
+                        const auto ib = indices[b];
+                        const auto dist = std::popcount(
+                            *phashes[ia] ^ *phashes[ib]
+                        );
+                        if (dist <= configs.max_hamming_)
+                            uf.merge(ia, ib);
+                    }
+                }
+            }
+        }
+
+        std::map<size_t, std::vector<size_t>> clusters;
+        for (size_t i = 0; i < groups.size(); ++i)
+            clusters[uf.find(i)].push_back(i);
+
+        for (const auto& [root, indices] : clusters) {
+            if (indices.size() == 1)
+                continue;
+
+            // Largest source is most likely the least degraded one
+            const auto best = *std::max_element(
+                indices.begin(),
+                indices.end(),
+                [&](const size_t a, const size_t b) {
+                    std::error_code ec;
+                    return sung::get_file_size(groups[a].representative_, ec) <
+                           sung::get_file_size(groups[b].representative_, ec);
+                }
+            );
+            for (const auto i : indices) {
+                if (i != best)
+                    groups[i].similar_to_ = groups[best].representative_;
+            }
+        }
+
+        return groups;
+    }
+
+}  // namespace
+
+
+namespace sung {
+
+    std::optional<uint64_t> hash_file_content(const fs::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return std::nullopt;
+
+        std::vector<unsigned char> buf(1 << 20);
+        uint64_t state = 0x243F6A8885A308D3ULL;
+        while (file) {
+            file.read(reinterpret_cast<char*>(buf.data()), buf.size());
+            const auto n = static_cast<size_t>(file.gcount());
+            if (n == 0)
+                break;
+            state = ::hash_bytes(state, buf.data(), n);
+        }
+
+        return ::mix64(state);
+    }
+
+    std::optional<uint64_t> compute_perceptual_hash(const fs::path& path) {
+        if (::is_jpeg_path(path)) {
+            if (const auto data = sung::read_file(path)) {
+                sung::codec::GreyImage grey;
+                const auto err = sung::codec::decode_jpeg_grey_reduced(
+                    grey, data->data(), data->size()
+                );
+                if (err.empty() && grey.width_ > 0 && grey.height_ > 0)
+                    return ::make_dhash(
+                        ::downsample_grey(grey, DHASH_W, DHASH_H)
+                    );
+            }
+        }
+
+        const auto img = sung::oiio::open_img(path);
+        if (!img)
+            return std::nullopt;
+
+        const auto thumb = sung::oiio::make_grey_thumbnail(
+            **img, DHASH_W, DHASH_H
+        );
+        if (!thumb)
+            return std::nullopt;
+
+        return ::make_dhash(*thumb);
+    }
+
+    std::vector<DuplicateGroup> group_duplicates(
+        const std::set<fs::path>& files,
+        const DedupConfigs& configs,
+        BS::thread_pool& pool
+    ) {
+        auto groups = ::group_exact(files, pool);
+        if (configs.near_)
+            groups = ::merge_near(std::move(groups), configs, pool);
+        return groups;
+    }
+
+}  // namespace sung
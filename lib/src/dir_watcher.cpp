@@ -0,0 +1,218 @@
+#include "sung/imgref/dir_watcher.hpp"
+
+#ifdef __linux__
+    #include <algorithm>
+    #include <cerrno>
+    #include <cstring>
+    #include <map>
+    #include <set>
+    #include <unordered_map>
+
+    #include <poll.h>
+    #include <sys/inotify.h>
+    #include <unistd.h>
+
+    #include <fmt/core.h>
+#endif
+
+
+#ifdef __linux__
+namespace {
+
+    namespace fs = std::filesystem;
+    using clock_t = std::chrono::steady_clock;
+
+    constexpr uint32_t DIR_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE |
+                                  IN_DELETE_SELF | IN_MOVE_SELF |
+                                  IN_ONLYDIR;
+
+
+    class InotifyDirWatcher : public sung::IDirWatcher {
+
+    public:
+        ~InotifyDirWatcher() override {
+            if (fd_ >= 0)
+                ::close(fd_);
+        }
+
+        std::string init(
+            const std::vector<fs::path>& folders,
+            const bool recursive,
+            const std::chrono::milliseconds debounce
+        ) {
+            recursive_ = recursive;
+            debounce_ = debounce;
+
+            fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (fd_ < 0)
+                return fmt::format("inotify_init1: {}", std::strerror(errno));
+
+            for (const auto& x : folders) {
+                const auto err = this->add_folder(x, false);
+                if (!err.empty())
+                    return err;
+            }
+            return {};
+        }
+
+        std::vector<fs::path> poll(
+            const std::chrono::milliseconds timeout
+        ) override {
+            auto wait = timeout;
+            if (!pending_.empty()) {
+                const auto until_settled = std::chrono::ceil<
+                    std::chrono::milliseconds>(
+                    this->next_settle_time() - clock_t::now()
+                );
+                wait = std::clamp(
+                    until_settled, std::chrono::milliseconds(0), timeout
+                );
+            }
+
+            pollfd pfd{ fd_, POLLIN, 0 };
+            if (::poll(&pfd, 1, static_cast<int>(wait.count())) > 0)
+                this->read_events();
+
+            std::vector<fs::path> out;
+            const auto now = clock_t::now();
+            for (auto it = pending_.begin(); it != pending_.end();) {
+                if (now - it->second >= debounce_) {
+                    out.push_back(it->first);
+                    it = pending_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            return out;
+        }
+
+    private:
+        // With `scan`, files already inside count as new
+        std::string add_folder(const fs::path& folder, const bool scan) {
+            const auto wd = ::inotify_add_watch(
+                fd_, folder.c_str(), DIR_MASK
+            );
+            if (wd < 0) {
+                return fmt::format(
+                    "Failed to watch '{}': {}",
+                    folder.string(),
+                    std::strerror(errno)
+                );
+            }
+            folders_[wd] = folder;
+
+            std::error_code ec;
+            for (const auto& e : fs::directory_iterator(folder, ec)) {
+                if (e.is_directory(ec)) {
+                    if (recursive_)
+                        this->add_folder(e.path(), scan);
+                } else if (scan && e.is_regular_file(ec)) {
+                    pending_[e.path()] = clock_t::now();
+                }
+            }
+            return {};
+        }
+
+        void read_events() {
+            alignas(inotify_event) char buf[64 * 1024];
+            while (true) {
+                const auto len = ::read(fd_, buf, sizeof(buf));
+                if (len <= 0)
+                    return;
+
+                for (ssize_t i = 0; i < len;) {
+                    const auto& e = *reinterpret_cast<const inotify_event*>(
+                        buf + i
+                    );
+                    this->handle_event(e);
+                    i += sizeof(inotify_event) + e.len;
+                }
+            }
+        }
+
+        // Events were dropped, so anything in the folders may be new
+        void rescan() {
+            std::set<fs::path> watched;
+            for (const auto& [wd, folder] : folders_)
+                watched.insert(folder);
+
+            std::error_code ec;
+            for (const auto& folder : watched) {
+                for (const auto& e : fs::directory_iterator(folder, ec)) {
+                    if (e.is_directory(ec)) {
+                        if (recursive_ && !watched.contains(e.path()))
+                            this->add_folder(e.path(), true);
+                    } else if (e.is_regular_file(ec)) {
+                        pending_[e.path()] = clock_t::now();
+                    }
+                }
+            }
+        }
+
+        void handle_event(const inotify_event& e) {
+            if (e.mask & IN_Q_OVERFLOW) {
+                this->rescan();
+                return;
+            }
+            if (e.mask & IN_IGNORED) {
+                folders_.erase(e.wd);
+                return;
+            }
+
+            const auto it = folders_.find(e.wd);
+            if (it == folders_.end() || e.len == 0)
+                return;
+            const auto path = it->second / e.name;
+
+            if (e.mask & IN_ISDIR) {
+                // Created empty or moved in with content
+                if (recursive_ && (e.mask & (IN_CREATE | IN_MOVED_TO)))
+                    this->add_folder(path, true);
+                return;
+            }
+
+            // Creation only tells that a write is coming
+            if (e.mask & (IN_CLOSE_WRITE | IN_MOVED_TO))
+                pending_[path] = clock_t::now();
+            else if (e.mask & IN_CREATE)
+                pending_.erase(path);
+        }
+
+        clock_t::time_point next_settle_time() const {
+            auto out = clock_t::time_point::max();
+            for (const auto& [path, time] : pending_)
+                out = std::min(out, time + debounce_);
+            return out;
+        }
+
+        int fd_ = -1;
+        bool recursive_ = false;
+        std::chrono::milliseconds debounce_{ 0 };
+        std::unordered_map<int, fs::path> folders_;
+        // Last event time of files that may still be written
+        std::map<fs::path, clock_t::time_point> pending_;
+    };
+
+}  // namespace
+#endif
+
+
+namespace sung {
+
+    sung::Expected<std::unique_ptr<IDirWatcher>, std::string> make_dir_watcher(
+        const std::vector<fs::path>& folders,
+        const bool recursive,
+        const std::chrono::milliseconds debounce
+    ) {
+#ifdef __linux__
+        auto out = std::make_unique<::InotifyDirWatcher>();
+        const auto err = out->init(folders, recursive, debounce);
+        if (!err.empty())
+            return sung::unexpected(err);
+        return std::unique_ptr<IDirWatcher>(std::move(out));
+#else
+        return sung::unexpected("Watching folders needs inotify");
+#endif
+    }
+
+}  // namespace sung
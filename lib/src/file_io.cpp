@@ -0,0 +1,463 @@
+#include "sung/imgref/file_io.hpp"
+
+#ifdef SUNG_IMGREF_IO_URING
+    #include <algorithm>
+    #include <atomic>
+    #include <cstring>
+    #include <deque>
+    #include <thread>
+
+    #include <fcntl.h>
+    #include <liburing.h>
+    #include <sys/eventfd.h>
+    #include <unistd.h>
+
+    #include <fmt/core.h>
+
+    #include "sung/imgref/result_log.hpp"
+#endif
+
+
+#ifdef SUNG_IMGREF_IO_URING
+namespace {
+
+    namespace fs = std::filesystem;
+
+
+    // Files up to this size go through a registered buffer
+    constexpr size_t FIXED_BUF_SIZE = 256 * 1024;
+    constexpr size_t MAX_FIXED_BUFS = 64;
+
+    // Set in `user_data` of statx completions, Op is at least 8 aligned
+    constexpr uint64_t STATX_TAG = 1;
+    // `user_data` of the eventfd read that wakes the I/O thread
+    constexpr uint64_t WAKE_TAG = 0;
+
+
+    std::string make_errno_str(
+        const char* what, const std::string& path, const int err
+    ) {
+        return fmt::format("{} '{}': {}", what, path, std::strerror(err));
+    }
+
+
+    struct Op {
+        enum class Kind { read, write };
+        enum class Stage { open, io, close };
+
+        Kind kind_ = Kind::read;
+        Stage stage_ = Stage::open;
+        std::string path_;
+        int fd_ = -1;
+        // Completions to wait for before the next stage
+        int pending_ = 0;
+        size_t size_ = 0;
+        size_t done_ = 0;
+        int buf_index_ = -1;
+        struct statx stx_ {};
+        std::string error_;
+
+        std::vector<unsigned char> data_;
+        std::promise<sung::ReadResult> read_promise_;
+
+        const std::vector<unsigned char>* src_ = nullptr;
+        std::promise<std::string> write_promise_;
+    };
+
+
+    // Reads open and statx in parallel, then read, then close. Writes open,
+    // write, then close. Everything past submission runs on `thread_`.
+    class UringFileIO : public sung::IFileIO {
+
+    public:
+        ~UringFileIO() override;
+
+        std::string init(unsigned queue_depth);
+
+        std::future<sung::ReadResult> read(const fs::path& path) override;
+        std::future<std::string> write(
+            const fs::path& path, const std::vector<unsigned char>& data
+        ) override;
+
+    private:
+        void submit(Op* op);
+        void notify();
+
+        void run();
+        void arm_wakeup();
+        void drain_incoming();
+        void start_waiting();
+        void handle(uint64_t user_data, int res);
+
+        void start(Op& op);
+        void on_open(Op& op, int res);
+        void on_statx(Op& op, int res);
+        void start_io(Op& op);
+        void submit_io(Op& op);
+        void on_io(Op& op, int res);
+        void finish(Op& op);
+        void complete(Op* op);
+
+        io_uring_sqe* get_sqe();
+
+        io_uring ring_{};
+        bool ring_ready_ = false;
+        int wake_fd_ = -1;
+        uint64_t wake_value_ = 0;
+        std::atomic<bool> stop_ = false;
+        sung::MpscQueue<Op*> incoming_;
+        std::thread thread_;
+
+        // I/O thread only
+        std::deque<Op*> waiting_;
+        size_t active_ = 0;
+        size_t max_active_ = 1;
+        std::vector<std::vector<unsigned char>> buffers_;
+        std::vector<int> free_buffers_;
+    };
+
+
+    UringFileIO::~UringFileIO() {
+        if (thread_.joinable()) {
+            stop_ = true;
+            this->notify();
+            thread_.join();
+        }
+
+        if (ring_ready_)
+            io_uring_queue_exit(&ring_);
+        if (wake_fd_ >= 0)
+            ::close(wake_fd_);
+    }
+
+    std::string UringFileIO::init(unsigned queue_depth) {
+        queue_depth = std::max(queue_depth, 8u);
+        const auto res = io_uring_queue_init(queue_depth, &ring_, 0);
+        if (res < 0)
+            return fmt::format(
+                "io_uring not available: {}", std::strerror(-res)
+            );
+        ring_ready_ = true;
+
+        wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+        if (wake_fd_ < 0)
+            return fmt::format(
+                "Failed to create eventfd: {}", std::strerror(errno)
+            );
+
+        // An op has at most two SQEs in flight, plus one for the wakeup
+        max_active_ = (queue_depth - 1) / 2;
+
+        // Without them, e.g. over RLIMIT_MEMLOCK, all I/O uses plain buffers
+        buffers_.resize(std::min(max_active_, MAX_FIXED_BUFS));
+        std::vector<iovec> iovecs;
+        for (auto& buf : buffers_) {
+            buf.resize(FIXED_BUF_SIZE);
+            iovecs.push_back({ buf.data(), buf.size() });
+        }
+        if (io_uring_register_buffers(&ring_, iovecs.data(), iovecs.size()))
+            buffers_.clear();
+        for (size_t i = 0; i < buffers_.size(); ++i)
+            free_buffers_.push_back(static_cast<int>(i));
+
+        thread_ = std::thread([this] { this->run(); });
+        return {};
+    }
+
+    std::future<sung::ReadResult> UringFileIO::read(const fs::path& path) {
+        auto op = new Op;
+        op->kind_ = Op::Kind::read;
+        op->path_ = path.string();
+        auto out = op->read_promise_.get_future();
+        this->submit(op);
+        return out;
+    }
+
+    std::future<std::string> UringFileIO::write(
+        const fs::path& path, const std::vector<unsigned char>& data
+    ) {
+        auto op = new Op;
+        op->kind_ = Op::Kind::write;
+        op->path_ = path.string();
+        op->src_ = &data;
+        auto out = op->write_promise_.get_future();
+        this->submit(op);
+        return out;
+    }
+
+    void UringFileIO::submit(Op* op) {
+        incoming_.push(op);
+        this->notify();
+    }
+
+    void UringFileIO::notify() {
+        const uint64_t one = 1;
+        [[maybe_unused]] const auto res = ::write(wake_fd_, &one, sizeof(one));
+    }
+
+    void UringFileIO::run() {
+        this->arm_wakeup();
+
+        while (true) {
+            io_uring_submit_and_wait(&ring_, 1);
+
+            io_uring_cqe* cqe = nullptr;
+            while (io_uring_peek_cqe(&ring_, &cqe) == 0) {
+                const auto user_data = cqe->user_data;
+                const auto res = cqe->res;
+                io_uring_cqe_seen(&ring_, cqe);
+                this->handle(user_data, res);
+            }
+
+            if (stop_) {
+                this->drain_incoming();
+                if (active_ == 0 && waiting_.empty())
+                    break;
+            }
+        }
+    }
+
+    void UringFileIO::arm_wakeup() {
+        const auto sqe = this->get_sqe();
+        io_uring_prep_read(sqe, wake_fd_, &wake_value_, sizeof(wake_value_), 0);
+        io_uring_sqe_set_data64(sqe, WAKE_TAG);
+    }
+
+    void UringFileIO::drain_incoming() {
+        while (const auto op = incoming_.pop()) waiting_.push_back(*op);
+        this->start_waiting();
+    }
+
+    void UringFileIO::start_waiting() {
+        while (active_ < max_active_ && !waiting_.empty()) {
+            const auto op = waiting_.front();
+            waiting_.pop_front();
+            ++active_;
+            this->start(*op);
+        }
+    }
+
+    void UringFileIO::handle(uint64_t user_data, int res) {
+        if (user_data == WAKE_TAG) {
+            this->arm_wakeup();
+            this->drain_incoming();
+            return;
+        }
+
+        const auto op = reinterpret_cast<Op*>(user_data & ~STATX_TAG);
+        if (user_data & STATX_TAG) {
+            this->on_statx(*op, res);
+            return;
+        }
+
+        switch (op->stage_) {
+            case Op::Stage::open:
+                this->on_open(*op, res);
+                break;
+            case Op::Stage::io:
+                this->on_io(*op, res);
+                break;
+            case Op::Stage::close:
+                if (res < 0 && op->error_.empty()) {
+                    op->error_ = ::make_errno_str(
+                        "Failed to close", op->path_, -res
+                    );
+                }
+                this->complete(op);
+                break;
+        }
+    }
+
+    void UringFileIO::start(Op& op) {
+        const auto is_read = op.kind_ == Op::Kind::read;
+        const auto flags = is_read ? O_RDONLY | O_CLOEXEC
+                                   : O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+        op.stage_ = Op::Stage::open;
+        op.pending_ = 1;
+        auto sqe = this->get_sqe();
+        io_uring_prep_openat(sqe, AT_FDCWD, op.path_.c_str(), flags, 0644);
+        io_uring_sqe_set_data64(sqe, reinterpret_cast<uint64_t>(&op));
+
+        if (is_read) {
+            op.pending_ = 2;
+            sqe = this->get_sqe();
+            io_uring_prep_statx(
+                sqe, AT_FDCWD, op.path_.c_str(), 0, STATX_SIZE, &op.stx_
+            );
+            io_uring_sqe_set_data64(
+                sqe, reinterpret_cast<uint64_t>(&op) | STATX_TAG
+            );
+        }
+    }
+
+    void UringFileIO::on_open(Op& op, int res) {
+        if (res < 0)
+            op.error_ = ::make_errno_str("Failed to open", op.path_, -res);
+        else
+            op.fd_ = res;
+
+        if (--op.pending_ == 0)
+            this->start_io(op);
+    }
+
+    void UringFileIO::on_statx(Op& op, int res) {
+        if (res < 0 && op.error_.empty())
+            op.error_ = ::make_errno_str("Failed to stat", op.path_, -res);
+        else if (res >= 0)
+            op.size_ = op.stx_.stx_size;
+
+        if (--op.pending_ == 0)
+            this->start_io(op);
+    }
+
+    void UringFileIO::start_io(Op& op) {
+        if (!op.error_.empty())
+            return this->finish(op);
+
+        op.stage_ = Op::Stage::io;
+        if (op.kind_ == Op::Kind::read)
+            op.data_.resize(op.size_);
+        else
+            op.size_ = op.src_->size();
+        if (op.size_ == 0)
+            return this->finish(op);
+
+        if (op.size_ <= FIXED_BUF_SIZE && !free_buffers_.empty()) {
+            op.buf_index_ = free_buffers_.back();
+            free_buffers_.pop_back();
+            if (op.kind_ == Op::Kind::write) {
+                std::memcpy(
+                    buffers_[op.buf_index_].data(), op.src_->data(), op.size_
+                );
+            }
+        }
+
+        this->submit_io(op);
+    }
+
+    void UringFileIO::submit_io(Op& op) {
+        const auto remaining = static_cast<unsigned>(op.size_ - op.done_);
+        const auto sqe = this->get_sqe();
+
+        if (op.buf_index_ >= 0) {
+            const auto buf = buffers_[op.buf_index_].data() + op.done_;
+            if (op.kind_ == Op::Kind::read)
+                io_uring_prep_read_fixed(
+                    sqe, op.fd_, buf, remaining, op.done_, op.buf_index_
+                );
+            else
+                io_uring_prep_write_fixed(
+                    sqe, op.fd_, buf, remaining, op.done_, op.buf_index_
+                );
+        } else {
+            if (op.kind_ == Op::Kind::read)
+                io_uring_prep_read(
+                    sqe, op.fd_, op.data_.data() + op.done_, remaining, op.done_
+                );
+            else
+                io_uring_prep_write(
+                    sqe, op.fd_, op.src_->data() + op.done_, remaining, op.done_
+                );
+        }
+
+        io_uring_sqe_set_data64(sqe, reinterpret_cast<uint64_t>(&op));
+    }
+
+    void UringFileIO::on_io(Op& op, int res) {
+        const auto is_read = op.kind_ == Op::Kind::read;
+
+        if (res < 0) {
+            op.error_ = ::make_errno_str(
+                is_read ? "Failed to read" : "Failed to write", op.path_, -res
+            );
+            return this->finish(op);
+        }
+        if (res == 0) {
+            // The file shrank since statx
+            if (is_read)
+                op.size_ = op.done_;
+            else
+                op.error_ = ::make_errno_str("Failed to write", op.path_, EIO);
+            return this->finish(op);
+        }
+
+        op.done_ += static_cast<size_t>(res);
+        if (op.done_ < op.size_)
+            return this->submit_io(op);
+        this->finish(op);
+    }
+
+    void UringFileIO::finish(Op& op) {
+        const auto is_read = op.kind_ == Op::Kind::read;
+
+        if (op.buf_index_ >= 0) {
+            if (is_read && op.error_.empty()) {
+                std::memcpy(
+                    op.data_.data(), buffers_[op.buf_index_].data(), op.done_
+                );
+            }
+            free_buffers_.push_back(op.buf_index_);
+            op.buf_index_ = -1;
+        }
+
+        // Readers need not wait for the close
+        if (is_read) {
+            if (op.error_.empty()) {
+                op.data_.resize(op.size_);
+                op.read_promise_.set_value(std::move(op.data_));
+            } else {
+                op.read_promise_.set_value(sung::unexpected(op.error_));
+            }
+        }
+
+        if (op.fd_ >= 0) {
+            op.stage_ = Op::Stage::close;
+            const auto sqe = this->get_sqe();
+            io_uring_prep_close(sqe, op.fd_);
+            io_uring_sqe_set_data64(sqe, reinterpret_cast<uint64_t>(&op));
+            return;
+        }
+
+        this->complete(&op);
+    }
+
+    void UringFileIO::complete(Op* op) {
+        if (op->kind_ == Op::Kind::write)
+            op->write_promise_.set_value(op->error_);
+
+        delete op;
+        --active_;
+        this->start_waiting();
+    }
+
+    io_uring_sqe* UringFileIO::get_sqe() {
+        auto sqe = io_uring_get_sqe(&ring_);
+        while (!sqe) {
+            io_uring_submit(&ring_);
+            sqe = io_uring_get_sqe(&ring_);
+        }
+        return sqe;
+    }
+
+}  // namespace
+#endif
+
+
+namespace sung {
+
+    sung::Expected<std::unique_ptr<IFileIO>, std::string> make_uring_file_io(
+        unsigned queue_depth
+    ) {
+#ifdef SUNG_IMGREF_IO_URING
+        auto out = std::make_unique<::UringFileIO>();
+        const auto err = out->init(queue_depth);
+        if (!err.empty())
+            return sung::unexpected(err);
+        return std::unique_ptr<IFileIO>(std::move(out));
+#else
+        return sung::unexpected("Built without io_uring support");
+#endif
+    }
+
+}  // namespace sung
@@ -1,13 +1,19 @@
 #include "sung/imgref/filesys.hpp"
 
 #include <filesystem>
+#include <fstream>
 #include <functional>
+#include <map>
+#include <mutex>
 #include <set>
+#include <shared_mutex>
 
 #include <fmt/core.h>
 #include <uni_algo/norm.h>
 #include <sung/general/stringtool.hpp>
 
+#include "sung/imgref/storage.hpp"
+
 
 namespace {
 
@@ -18,6 +24,76 @@ namespace {
             return get_deepest_folder(path.parent_path());
     }
 
+    // Folder and stem without `suffix`, or empty if the stem lacks it
+    sung::fs::path strip_stem_suffix(
+        const sung::fs::path& path, const std::u8string& suffix
+    ) {
+        const auto stem = path.stem().u8string();
+        if (stem.size() <= suffix.size() || !stem.ends_with(suffix))
+            return {};
+        return path.parent_path() /
+               stem.substr(0, stem.size() - suffix.size());
+    }
+
+    // Most lookups hit, so readers share the lock
+    class FsCache {
+
+    public:
+        void create_folder(const sung::fs::path& path) {
+            {
+                std::shared_lock lock(mut_);
+                if (folders_.contains(path))
+                    return;
+            }
+
+            // Held while creating so racing workers do not repeat it
+            std::unique_lock lock(mut_);
+            if (folders_.contains(path))
+                return;
+            sung::fs::create_directories(path);
+            for (auto x = path; !x.empty(); x = x.parent_path()) {
+                if (!folders_.insert(x).second)
+                    break;
+            }
+        }
+
+        uintmax_t get_file_size(
+            const sung::fs::path& path, std::error_code& ec
+        ) {
+            {
+                std::shared_lock lock(mut_);
+                const auto it = sizes_.find(path);
+                if (it != sizes_.end()) {
+                    ec.clear();
+                    return it->second;
+                }
+            }
+
+            const auto size = sung::fs::file_size(path, ec);
+            if (!ec) {
+                std::unique_lock lock(mut_);
+                sizes_.emplace(path, size);
+            }
+            return size;
+        }
+
+        void forget_file(const sung::fs::path& path) {
+            std::unique_lock lock(mut_);
+            sizes_.erase(path);
+        }
+
+    private:
+        std::shared_mutex mut_;
+        std::set<sung::fs::path> folders_;
+        std::map<sung::fs::path, uintmax_t> sizes_;
+    };
+
+    FsCache& get_fs_cache() {
+        static FsCache cache;
+        return cache;
+    }
+
+
     std::string make_str_lower(std::string str) {
         std::transform(str.begin(), str.end(), str.begin(), ::tolower);
         return str;
@@ -67,8 +143,65 @@ namespace sung {
         }
     }
 
+    std::string FileList::add(
+        IStorage& storage, const fs::path& prefix, const bool recursive
+    ) {
+        const auto keys = storage.list(prefix, recursive);
+        if (!keys)
+            return keys.error();
+
+        for (const auto& x : *keys) {
+            if (file_filter_(x))
+                files_.insert(x);
+        }
+        return {};
+    }
+
+    void FileList::retain_if(
+        const std::function<bool(const fs::path&)>& pred
+    ) {
+        std::erase_if(files_, [&](const fs::path& x) { return !pred(x); });
+    }
+
     const std::set<fs::path>& FileList::get_files() const { return files_; }
 
+    std::vector<std::pair<fs::path, fs::path>> FileList::pair_by_suffix(
+        const std::string& first_suffix,
+        const std::string& second_suffix,
+        std::vector<fs::path>* unpaired
+    ) const {
+        const std::u8string first(first_suffix.begin(), first_suffix.end());
+        const std::u8string second(second_suffix.begin(), second_suffix.end());
+
+        std::map<fs::path, fs::path> seconds;
+        for (const auto& x : files_) {
+            auto key = ::strip_stem_suffix(x, second);
+            if (!key.empty())
+                seconds.emplace(std::move(key), x);
+        }
+
+        std::vector<std::pair<fs::path, fs::path>> out;
+        for (const auto& x : files_) {
+            const auto key = ::strip_stem_suffix(x, first);
+            if (key.empty())
+                continue;
+
+            const auto it = seconds.find(key);
+            if (it == seconds.end()) {
+                if (unpaired)
+                    unpaired->push_back(x);
+                continue;
+            }
+            out.emplace_back(x, it->second);
+            seconds.erase(it);
+        }
+
+        if (unpaired) {
+            for (const auto& [key, x] : seconds) unpaired->push_back(x);
+        }
+        return out;
+    }
+
     std::string FileList::make_text() const {
         return fmt::format(
             "{} files in {} locations",
@@ -181,11 +314,15 @@ namespace sung {
         if (path.empty())
             return;
 
-        const auto parent = path.parent_path();
-        if (!fs::exists(parent))
-            create_folder(parent);
+        ::get_fs_cache().create_folder(path);
+    }
+
+    uintmax_t get_file_size(const fs::path& path, std::error_code& ec) {
+        return ::get_fs_cache().get_file_size(path, ec);
+    }
 
-        fs::create_directories(path);
+    void forget_file(const fs::path& path) {
+        ::get_fs_cache().forget_file(path);
     }
 
     fs::path replace_ext(const fs::path& path, const fs::path& new_ext) {
@@ -208,6 +345,21 @@ namespace sung {
         return path;
     }
 
+    sung::Expected<std::vector<unsigned char>, std::string> read_file(
+        const fs::path& path
+    ) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return sung::unexpected("Failed to open file");
+
+        std::vector<unsigned char> out(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        if (!file.read(reinterpret_cast<char*>(out.data()), out.size()))
+            return sung::unexpected("Failed to read file");
+
+        return out;
+    }
+
 }  // namespace sung
 
 
@@ -243,12 +395,12 @@ namespace sung {
 
         const auto new_path = sung::replace_ext(src_, sel->extension());
 
-        const auto status = fs::status(new_path);
         const auto src_time = fs::last_write_time(src_);
         fs::last_write_time(*sel, src_time);
 
         if (!fs::remove(src_))
             return sung::unexpected("Failed to remove old file");
+        ::get_fs_cache().forget_file(src_);
 
         try {
             fs::rename(*sel, new_path);
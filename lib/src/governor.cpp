@@ -0,0 +1,233 @@
+#include "sung/imgref/governor.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <fmt/core.h>
+
+#ifdef __linux__
+    #include <sched.h>
+#endif
+
+
+namespace {
+
+    namespace fs = std::filesystem;
+
+
+#ifdef __linux__
+    // This process's cgroup v2 folder, empty without one
+    fs::path find_cgroup_dir() {
+        std::ifstream file("/proc/self/cgroup");
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.starts_with("0::"))
+                return fs::path("/sys/fs/cgroup" + line.substr(3));
+        }
+        return {};
+    }
+
+    // Quota in CPUs, 0 if unlimited or unknown
+    double read_cpu_max(const fs::path& cgroup_dir) {
+        std::ifstream file(cgroup_dir / "cpu.max");
+        std::string quota;
+        double period = 0;
+        if (!(file >> quota >> period) || quota == "max" || period <= 0)
+            return 0;
+        return std::strtod(quota.c_str(), nullptr) / period;
+    }
+#endif
+
+}  // namespace
+
+
+// ConcurrencyGate
+namespace sung {
+
+    ConcurrencyGate::ConcurrencyGate(size_t limit)
+        : limit_(std::max<size_t>(limit, 1)) {}
+
+    void ConcurrencyGate::set_limit(size_t limit) {
+        {
+            std::lock_guard lock(mut_);
+            limit_ = std::max<size_t>(limit, 1);
+        }
+        cv_.notify_all();
+    }
+
+    size_t ConcurrencyGate::limit() const {
+        std::lock_guard lock(mut_);
+        return limit_;
+    }
+
+    void ConcurrencyGate::enter() {
+        std::unique_lock lock(mut_);
+        cv_.wait(lock, [&] { return active_ < limit_; });
+        ++active_;
+    }
+
+    void ConcurrencyGate::leave() {
+        {
+            std::lock_guard lock(mut_);
+            --active_;
+        }
+        cv_.notify_one();
+    }
+
+}  // namespace sung
+
+
+// IoLimiter
+namespace sung {
+
+    void IoLimiter::set_rate(uint64_t bytes_per_sec) {
+        std::lock_guard lock(mut_);
+        rate_ = bytes_per_sec;
+        tokens_ = std::min<double>(tokens_, bytes_per_sec);
+        last_ = clock_t::now();
+    }
+
+    uint64_t IoLimiter::rate() const { return rate_.load(); }
+
+    void IoLimiter::acquire(uint64_t bytes) {
+        const auto rate = static_cast<double>(rate_.load());
+        if (rate <= 0 || bytes == 0)
+            return;
+
+        double wait_sec = 0;
+        {
+            std::lock_guard lock(mut_);
+            const auto now = clock_t::now();
+            const std::chrono::duration<double> elapsed = now - last_;
+            last_ = now;
+            tokens_ = std::min(rate, tokens_ + elapsed.count() * rate);
+            tokens_ -= static_cast<double>(bytes);
+            if (tokens_ < 0)
+                wait_sec = -tokens_ / rate;
+        }
+
+        if (wait_sec > 0) {
+            const std::chrono::duration<double> wait(wait_sec);
+            std::this_thread::sleep_for(wait);
+        }
+    }
+
+}  // namespace sung
+
+
+// Free functions
+namespace sung {
+
+    unsigned get_cpu_limit() {
+        auto out = std::thread::hardware_concurrency();
+
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (::sched_getaffinity(0, sizeof(set), &set) == 0 &&
+            CPU_COUNT(&set) > 0)
+            out = static_cast<unsigned>(CPU_COUNT(&set));
+
+        // Limits of every ancestor apply too
+        const fs::path root = "/sys/fs/cgroup";
+        for (auto dir = ::find_cgroup_dir(); !dir.empty();
+             dir = dir.parent_path()) {
+            const auto quota = ::read_cpu_max(dir);
+            if (quota > 0)
+                out = std::min(out, static_cast<unsigned>(std::ceil(quota)));
+            if (dir == root || dir == dir.parent_path())
+                break;
+        }
+#endif
+
+        return std::max(out, 1u);
+    }
+
+    IoLimiter& get_io_limiter() {
+        static IoLimiter limiter;
+        return limiter;
+    }
+
+    sung::Expected<uint64_t, std::string> parse_byte_rate(
+        const std::string& str
+    ) {
+        char* end = nullptr;
+        const auto value = std::strtod(str.c_str(), &end);
+        if (end == str.c_str() || value < 0)
+            return sung::unexpected(fmt::format("Invalid byte rate '{}'", str));
+
+        double scale = 1;
+        const std::string suffix(end);
+        if (suffix.size() > 1)
+            return sung::unexpected(fmt::format("Invalid byte rate '{}'", str));
+        if (!suffix.empty()) {
+            switch (std::toupper(static_cast<unsigned char>(suffix[0]))) {
+                case 'K':
+                    scale = 1 << 10;
+                    break;
+                case 'M':
+                    scale = 1 << 20;
+                    break;
+                case 'G':
+                    scale = 1 << 30;
+                    break;
+                default:
+                    return sung::unexpected(
+                        fmt::format("Invalid byte rate '{}'", str)
+                    );
+            }
+        }
+        return static_cast<uint64_t>(value * scale);
+    }
+
+    sung::Expected<ResourceLimits, std::string> read_limits_file(
+        const std::filesystem::path& path
+    ) {
+        std::ifstream file(path);
+        if (!file)
+            return sung::unexpected("Failed to open limits file");
+
+        ResourceLimits out;
+        std::string line;
+        for (int line_no = 1; std::getline(file, line); ++line_no) {
+            line = line.substr(0, line.find('#'));
+            std::istringstream iss(line);
+            std::string key;
+            std::string value;
+            if (!(iss >> key))
+                continue;
+            if (!(iss >> value)) {
+                return sung::unexpected(
+                    fmt::format("No value on line {}", line_no)
+                );
+            }
+
+            if (key == "cpus") {
+                const auto cpus = std::strtol(value.c_str(), nullptr, 10);
+                if (cpus < 1) {
+                    return sung::unexpected(
+                        fmt::format("Invalid cpus on line {}", line_no)
+                    );
+                }
+                out.cpus_ = static_cast<unsigned>(cpus);
+            } else if (key == "io-limit") {
+                const auto rate = sung::parse_byte_rate(value);
+                if (!rate)
+                    return sung::unexpected(rate.error());
+                out.io_limit_ = *rate;
+            } else {
+                return sung::unexpected(fmt::format(
+                    "Unknown key '{}' on line {}", key, line_no
+                ));
+            }
+        }
+        return out;
+    }
+
+}  // namespace sung
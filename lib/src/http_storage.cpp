@@ -0,0 +1,494 @@
+#include "sung/imgref/storage.hpp"
+
+#ifndef _WIN32
+    #include <algorithm>
+    #include <cctype>
+    #include <cerrno>
+    #include <condition_variable>
+    #include <cstdlib>
+    #include <cstring>
+    #include <deque>
+    #include <map>
+    #include <mutex>
+    #include <set>
+    #include <thread>
+
+    #include <netdb.h>
+    #include <sys/socket.h>
+    #include <sys/time.h>
+    #include <unistd.h>
+
+    #include <fmt/core.h>
+#endif
+
+
+#ifndef _WIN32
+namespace {
+
+    namespace fs = std::filesystem;
+    using Bytes = std::vector<unsigned char>;
+    using AddrList = std::unique_ptr<addrinfo, decltype(&::freeaddrinfo)>;
+
+    constexpr int SOCKET_TIMEOUT_SEC = 30;
+
+
+    struct HttpUrl {
+        std::string host_;
+        std::string port_ = "80";
+        // Without a trailing '/'
+        std::string path_;
+    };
+
+    sung::Expected<HttpUrl, std::string> parse_url(const std::string& url) {
+        constexpr std::string_view SCHEME = "http://";
+        if (!url.starts_with(SCHEME))
+            return sung::unexpected("Only http:// storage URLs are supported");
+
+        const auto rest = url.substr(SCHEME.size());
+        const auto slash = rest.find('/');
+        auto authority = rest.substr(0, slash);
+
+        HttpUrl out;
+        if (slash != std::string::npos)
+            out.path_ = rest.substr(slash);
+        while (out.path_.ends_with('/')) out.path_.pop_back();
+
+        const auto colon = authority.rfind(':');
+        if (colon != std::string::npos) {
+            out.port_ = authority.substr(colon + 1);
+            authority.resize(colon);
+        }
+        if (authority.empty())
+            return sung::unexpected("No host in the storage URL");
+        out.host_ = authority;
+        return out;
+    }
+
+    std::string make_key_str(const fs::path& path) {
+        const auto str = path.generic_u8string();
+        return std::string(str.begin(), str.end());
+    }
+
+    // Keeps '/' and the unreserved characters of RFC 3986
+    std::string percent_encode(const std::string& str) {
+        std::string out;
+        out.reserve(str.size());
+        for (const auto c : str) {
+            const auto u = static_cast<unsigned char>(c);
+            if (std::isalnum(u) || c == '-' || c == '.' || c == '_' ||
+                c == '~' || c == '/')
+                out += c;
+            else
+                out += fmt::format("%{:02X}", u);
+        }
+        return out;
+    }
+
+
+    class Socket {
+
+    public:
+        explicit Socket(int fd) : fd_(fd) {}
+        ~Socket() {
+            if (fd_ >= 0)
+                ::close(fd_);
+        }
+        Socket(const Socket&) = delete;
+        Socket& operator=(const Socket&) = delete;
+
+        int get() const { return fd_; }
+
+    private:
+        int fd_ = -1;
+    };
+
+    bool send_all(const int fd, const void* data, size_t size) {
+        auto ptr = static_cast<const char*>(data);
+        while (size > 0) {
+            const auto n = ::send(fd, ptr, size, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            ptr += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    // Chunked transfer coding removed in place
+    bool dechunk(Bytes& body) {
+        size_t in = 0;
+        size_t out = 0;
+        while (true) {
+            size_t eol = in;
+            while (eol + 1 < body.size() &&
+                   !(body[eol] == '\r' && body[eol + 1] == '\n'))
+                ++eol;
+            if (eol + 1 >= body.size())
+                return false;
+
+            const std::string size_str(body.begin() + in, body.begin() + eol);
+            char* end = nullptr;
+            const auto size = std::strtoul(size_str.c_str(), &end, 16);
+            if (end == size_str.c_str())
+                return false;
+
+            in = eol + 2;
+            if (size == 0)
+                break;
+            if (in + size > body.size())
+                return false;
+            std::memmove(body.data() + out, body.data() + in, size);
+            out += size;
+            in += size + 2;
+        }
+        body.resize(out);
+        return true;
+    }
+
+
+    struct HttpResponse {
+        int status_ = 0;
+        Bytes body_;
+    };
+
+    // One connection per request, closed by the server after responding
+    sung::Expected<HttpResponse, std::string> send_request(
+        const addrinfo* addrs,
+        const HttpUrl& url,
+        const char* method,
+        const std::string& target,
+        const Bytes* body
+    ) {
+        int fd = -1;
+        for (auto ai = addrs; ai; ai = ai->ai_next) {
+            fd = ::socket(
+                ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol
+            );
+            if (fd < 0)
+                continue;
+            if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+                break;
+            ::close(fd);
+            fd = -1;
+        }
+        if (fd < 0) {
+            return sung::unexpected(fmt::format(
+                "Failed to connect to {}:{}: {}",
+                url.host_,
+                url.port_,
+                std::strerror(errno)
+            ));
+        }
+        const Socket sock(fd);
+
+        timeval timeout{ SOCKET_TIMEOUT_SEC, 0 };
+        ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        ::setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        const auto header = fmt::format(
+            "{} {} HTTP/1.1\r\nHost: {}:{}\r\nConnection: close\r\n"
+            "Content-Length: {}\r\n\r\n",
+            method,
+            target,
+            url.host_,
+            url.port_,
+            body ? body->size() : 0
+        );
+        if (!::send_all(fd, header.data(), header.size()))
+            return sung::unexpected("Failed to send request");
+        if (body && !::send_all(fd, body->data(), body->size()))
+            return sung::unexpected("Failed to send request body");
+
+        Bytes raw;
+        size_t received = 0;
+        while (true) {
+            if (raw.size() - received < 64 * 1024)
+                raw.resize(std::max<size_t>(raw.size() * 2, 256 * 1024));
+
+            const auto n = ::recv(
+                fd, raw.data() + received, raw.size() - received, 0
+            );
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                return sung::unexpected("Failed to receive response");
+            if (n == 0)
+                break;
+            received += n;
+        }
+        raw.resize(received);
+
+        constexpr std::string_view HEADER_END = "\r\n\r\n";
+        const auto header_end = std::search(
+            raw.begin(), raw.end(), HEADER_END.begin(), HEADER_END.end()
+        );
+        if (header_end == raw.end())
+            return sung::unexpected("Malformed HTTP response");
+
+        std::string head(raw.begin(), header_end);
+        std::transform(head.begin(), head.end(), head.begin(), ::tolower);
+        raw.erase(raw.begin(), header_end + HEADER_END.size());
+
+        HttpResponse out;
+        if (!head.starts_with("http/1.") || head.size() < 12)
+            return sung::unexpected("Malformed HTTP status line");
+        out.status_ = std::atoi(head.c_str() + 9);
+
+        if (head.find("transfer-encoding: chunked") != std::string::npos) {
+            if (!::dechunk(raw))
+                return sung::unexpected("Malformed chunked response");
+        } else if (const auto pos = head.find("content-length:");
+                   pos != std::string::npos) {
+            const auto length = std::strtoull(head.c_str() + pos + 15, 0, 10);
+            if (raw.size() < length)
+                return sung::unexpected("Response ended early");
+            raw.resize(length);
+        }
+
+        out.body_ = std::move(raw);
+        return out;
+    }
+
+
+    class HttpStorage : public sung::IStorage {
+
+    public:
+        ~HttpStorage() override {
+            {
+                std::lock_guard lock(mut_);
+                stop_ = true;
+            }
+            cv_.notify_all();
+            for (auto& x : threads_) x.join();
+
+            for (auto& x : demand_)
+                x->promise_.set_value(sung::unexpected("Storage closed"));
+        }
+
+        std::string init(const sung::HttpStorageConfigs& configs) {
+            auto url = ::parse_url(configs.url_);
+            if (!url)
+                return url.error();
+            url_ = std::move(*url);
+            max_prefetch_bytes_ = configs.max_prefetch_bytes_;
+
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* addrs = nullptr;
+            const auto err = ::getaddrinfo(
+                url_.host_.c_str(), url_.port_.c_str(), &hints, &addrs
+            );
+            if (err != 0) {
+                return fmt::format(
+                    "Failed to resolve {}: {}", url_.host_, ::gai_strerror(err)
+                );
+            }
+            addrs_.reset(addrs);
+
+            const auto count = std::max<size_t>(1, configs.connections_);
+            for (size_t i = 0; i < count; ++i)
+                threads_.emplace_back([this] { this->run(); });
+            return {};
+        }
+
+        sung::Expected<std::vector<fs::path>, std::string> list(
+            const fs::path& prefix, const bool recursive
+        ) override {
+            auto target = fmt::format(
+                "{}/?list={}",
+                url_.path_,
+                ::percent_encode(::make_key_str(prefix))
+            );
+            if (recursive)
+                target += "&recursive=1";
+
+            const auto res = ::send_request(
+                addrs_.get(), url_, "GET", target, nullptr
+            );
+            if (!res)
+                return sung::unexpected(res.error());
+            if (res->status_ != 200)
+                return sung::unexpected(
+                    fmt::format("Listing failed with HTTP {}", res->status_)
+                );
+
+            std::vector<fs::path> out;
+            const auto& body = res->body_;
+            auto begin = body.begin();
+            while (begin != body.end()) {
+                const auto end = std::find(begin, body.end(), '\n');
+                if (end != begin)
+                    out.emplace_back(std::u8string(begin, end));
+                begin = end == body.end() ? end : end + 1;
+            }
+            return out;
+        }
+
+        std::future<sung::ReadResult> read(const fs::path& path) override {
+            std::unique_lock lock(mut_);
+            ahead_set_.erase(path);
+
+            std::shared_ptr<Fetch> fetch;
+            const auto it = fetches_.find(path);
+            if (it != fetches_.end()) {
+                fetch = it->second;
+                fetches_.erase(it);
+            } else {
+                fetch = std::make_shared<Fetch>(path);
+                demand_.push_back(fetch);
+            }
+            fetch->claimed_ = true;
+            buffered_ -= fetch->bytes_;
+            auto out = std::move(fetch->future_);
+            lock.unlock();
+
+            // For the new demand, or for room freed in the prefetch budget
+            cv_.notify_all();
+            return out;
+        }
+
+        std::future<std::string> write(
+            const fs::path& path, const Bytes& data
+        ) override {
+            std::promise<std::string> promise;
+            const auto res = ::send_request(
+                addrs_.get(), url_, "PUT", this->make_target(path), &data
+            );
+            if (!res)
+                promise.set_value(res.error());
+            else if (res->status_ < 200 || res->status_ >= 300)
+                promise.set_value(
+                    fmt::format("PUT failed with HTTP {}", res->status_)
+                );
+            else
+                promise.set_value({});
+            return promise.get_future();
+        }
+
+        bool makes_folders() const override { return true; }
+
+        void prefetch(const std::vector<fs::path>& paths) override {
+            {
+                std::lock_guard lock(mut_);
+                for (const auto& x : paths) {
+                    if (ahead_set_.insert(x).second)
+                        ahead_.push_back(x);
+                }
+            }
+            cv_.notify_all();
+        }
+
+    private:
+        struct Fetch {
+            Fetch(const fs::path& path)
+                : path_(path), future_(promise_.get_future()) {}
+
+            fs::path path_;
+            std::promise<sung::ReadResult> promise_;
+            std::future<sung::ReadResult> future_;
+            // Set once fetched
+            size_t bytes_ = 0;
+            // Handed to a reader, so no longer counted as buffered
+            bool claimed_ = false;
+        };
+
+        std::string make_target(const fs::path& path) const {
+            return url_.path_ + "/" + ::percent_encode(::make_key_str(path));
+        }
+
+        sung::ReadResult get(const fs::path& path) const {
+            auto res = ::send_request(
+                addrs_.get(), url_, "GET", this->make_target(path), nullptr
+            );
+            if (!res)
+                return sung::unexpected(res.error());
+            if (res->status_ == 404)
+                return sung::unexpected("Not found");
+            if (res->status_ != 200)
+                return sung::unexpected(
+                    fmt::format("GET failed with HTTP {}", res->status_)
+                );
+            return std::move(res->body_);
+        }
+
+        bool can_prefetch() const {
+            return !ahead_.empty() && buffered_ < max_prefetch_bytes_;
+        }
+
+        // Reads asked for come first, then prefetches within the budget
+        void run() {
+            std::unique_lock lock(mut_);
+            while (true) {
+                cv_.wait(lock, [&] {
+                    return stop_ || !demand_.empty() || this->can_prefetch();
+                });
+                if (stop_)
+                    return;
+
+                std::shared_ptr<Fetch> fetch;
+                if (!demand_.empty()) {
+                    fetch = std::move(demand_.front());
+                    demand_.pop_front();
+                } else {
+                    auto path = std::move(ahead_.front());
+                    ahead_.pop_front();
+                    // Already read meanwhile
+                    if (ahead_set_.erase(path) == 0)
+                        continue;
+                    fetch = std::make_shared<Fetch>(path);
+                    fetches_.emplace(std::move(path), fetch);
+                }
+
+                lock.unlock();
+                auto res = this->get(fetch->path_);
+                lock.lock();
+
+                fetch->bytes_ = res ? res->size() : 0;
+                if (!fetch->claimed_)
+                    buffered_ += fetch->bytes_;
+                fetch->promise_.set_value(std::move(res));
+            }
+        }
+
+        HttpUrl url_;
+        AddrList addrs_{ nullptr, &::freeaddrinfo };
+        size_t max_prefetch_bytes_ = 0;
+
+        std::mutex mut_;
+        std::condition_variable cv_;
+        bool stop_ = false;
+        std::vector<std::thread> threads_;
+        // Reads not prefetched, waiting for a connection
+        std::deque<std::shared_ptr<Fetch>> demand_;
+        // Paths to prefetch in order, the set drops ones already read
+        std::deque<fs::path> ahead_;
+        std::set<fs::path> ahead_set_;
+        // Prefetches started but not yet read
+        std::map<fs::path, std::shared_ptr<Fetch>> fetches_;
+        size_t buffered_ = 0;
+    };
+
+}  // namespace
+#endif
+
+
+namespace sung {
+
+    sung::Expected<std::unique_ptr<IStorage>, std::string> make_http_storage(
+        const HttpStorageConfigs& configs
+    ) {
+#ifndef _WIN32
+        auto out = std::make_unique<::HttpStorage>();
+        const auto err = out->init(configs);
+        if (!err.empty())
+            return sung::unexpected(err);
+        return std::unique_ptr<IStorage>(std::move(out));
+#else
+        return sung::unexpected("HTTP storage is not available on Windows");
+#endif
+    }
+
+}  // namespace sung
@@ -5,6 +5,10 @@
 #include <OpenImageIO/imagebufalgo.h>
 
 #include "sung/imgref/filesys.hpp"
+#include "sung/imgref/jxl_codec.hpp"
+#include "sung/imgref/native_codec.hpp"
+#include "sung/imgref/pixel_pool.hpp"
+#include "sung/imgref/png_optimizer.hpp"
 
 
 namespace {
@@ -19,12 +23,21 @@ namespace {
     class OIIOImage2D : public sung::oiio::IImage2D {
 
     public:
-        OIIOImage2D(const OIIO::string_view path) : img_(path) {}
+        OIIOImage2D() = default;
+
+        // Uninitialized pixels in a pooled buffer wrapped by the ImageBuf
+        void allocate(const OIIO::ImageSpec& spec) {
+            auto pixels = sung::PixelBuffer::acquire(spec.image_bytes());
+            img_.reset(spec, pixels.data());
+            pixels_ = std::move(pixels);
+        }
 
         OIIO::ImageBuf& get() { return img_; }
         const OIIO::ImageBuf& get() const { return img_; }
 
     private:
+        // Declared first so the ImageBuf lets go of it before it is freed
+        sung::PixelBuffer pixels_;
         OIIO::ImageBuf img_;
     };
 
@@ -50,12 +63,235 @@ namespace {
             return true;
     }
 
+    // Native encoders and the files they write expect straight alpha
+    bool is_premultiplied(const OIIO::ImageSpec& spec) {
+        return spec.alpha_channel >= 0 &&
+               spec.get_int_attribute("oiio:UnassociatedAlpha", 0) == 0;
+    }
+
     bool is_img_monochrome(const OIIO::ImageBuf& img) {
         auto roi = OIIO::get_roi(img.spec());
         roi.chend = std::min(3, roi.chend);  // only test RGB, not alpha
         return OIIO::ImageBufAlgo::isMonochrome(img, 0.075f, roi);
     }
 
+
+    // OIIO progress callback, returning true aborts the read or write
+    bool poll_cancel(void* opaque_data, float portion_done) {
+        const auto token = static_cast<const sung::CancelToken*>(opaque_data);
+        return token && token->is_cancelled();
+    }
+
+    // Decodes the first subimage into pooled pixels, `proxy` is only read
+    // before returning
+    sung::oiio::ImgExpected read_pooled(
+        const std::string& name,
+        OIIO::Filesystem::IOProxy* proxy,
+        const sung::CancelToken* cancel
+    ) {
+        // Keeps the straight alpha PNG and WebP store, readers that cannot
+        // return premultiplied pixels without the attribute
+        OIIO::ImageSpec config;
+        config.attribute("oiio:UnassociatedAlpha", 1);
+        auto input = OIIO::ImageInput::open(name, &config, proxy);
+        if (!input)
+            return sung::unexpected(OIIO::geterror());
+
+        const auto& spec = input->spec();
+        auto out = std::make_unique<OIIOImage2D>();
+        out->allocate(spec);
+        const auto ok = input->read_image(
+            0,
+            0,
+            0,
+            spec.nchannels,
+            spec.format,
+            out->get().localpixels(),
+            OIIO::AutoStride,
+            OIIO::AutoStride,
+            OIIO::AutoStride,
+            ::poll_cancel,
+            const_cast<sung::CancelToken*>(cancel)
+        );
+        if (!ok)
+            return sung::unexpected(
+                cancel && cancel->is_cancelled() ? "Cancelled"
+                                                 : input->geterror()
+            );
+
+        return std::move(out);
+    }
+
+    // The first `nch` channels of `img` into pooled pixels
+    sung::oiio::ImgExpected copy_channels(
+        const OIIO::ImageBuf& img, const int nch
+    ) {
+        auto spec = img.spec();
+        spec.nchannels = nch;
+        spec.channelnames.resize(nch);
+        spec.channelformats.clear();
+        if (spec.alpha_channel >= nch)
+            spec.alpha_channel = -1;
+
+        auto out = std::make_unique<OIIOImage2D>();
+        out->allocate(spec);
+
+        auto roi = img.roi();
+        roi.chbegin = 0;
+        roi.chend = nch;
+        if (!OIIO::ImageBufAlgo::copy(out->get(), img, {}, roi))
+            return sung::unexpected(OIIO::geterror());
+
+        return std::move(out);
+    }
+
+    std::string write_with_oiio(
+        std::vector<unsigned char>& out,
+        const char* format_name,
+        const OIIO::ImageSpec& spec,
+        const OIIO::ImageBuf& img,
+        const sung::CancelToken* cancel
+    ) {
+        OIIO::Filesystem::IOVecOutput vecout{ out };
+
+        auto output = OIIO::ImageOutput::create(format_name, &vecout);
+        if (!output)
+            return OIIO::geterror();
+        if (!output->open(format_name, spec))
+            return OIIO::geterror();
+
+        const auto ok = img.write(
+            output.get(),
+            ::poll_cancel,
+            const_cast<sung::CancelToken*>(cancel)
+        );
+        if (!ok)
+            return cancel && cancel->is_cancelled() ? "Cancelled"
+                                                    : img.geterror();
+
+        return {};
+    }
+
+    // Points directly at the ImageBuf pixels when they are already in a
+    // layout the native encoders accept, converts into `scratch` otherwise.
+    // Premultiplied pixels are converted to straight alpha on the way.
+    std::optional<sung::codec::PixelView> make_pixel_view(
+        const OIIO::ImageBuf& img,
+        std::vector<uint8_t>& scratch,
+        const bool allow_16bit
+    ) {
+        const auto& spec = img.spec();
+
+        sung::codec::PixelView view;
+        view.width_ = spec.width;
+        view.height_ = spec.height;
+        view.nchannels_ = spec.nchannels;
+
+        const auto is_u8 = spec.format == OIIO::TypeDesc::UINT8;
+        const auto is_u16 = allow_16bit &&
+                            spec.format == OIIO::TypeDesc::UINT16;
+        const auto local = img.localpixels();
+        const auto packed = img.pixel_stride() ==
+                            static_cast<OIIO::stride_t>(spec.pixel_bytes());
+
+        const auto premultiplied = ::is_premultiplied(spec);
+
+        if ((is_u8 || is_u16) && local && packed && !premultiplied) {
+            view.data_ = static_cast<const uint8_t*>(local);
+            view.bytes_per_ch_ = is_u16 ? 2 : 1;
+            view.row_stride_ = img.scanline_stride();
+            return view;
+        }
+
+        const auto* src = &img;
+        OIIO::ImageBuf straight;
+        if (premultiplied) {
+            if (!OIIO::ImageBufAlgo::unpremult(straight, img))
+                return std::nullopt;
+            src = &straight;
+        }
+
+        const auto format = is_u16 ? OIIO::TypeDesc::UINT16
+                                   : OIIO::TypeDesc::UINT8;
+        const auto bytes_per_ch = is_u16 ? 2 : 1;
+        const auto row_size = static_cast<size_t>(spec.width) *
+                              spec.nchannels * bytes_per_ch;
+        scratch.resize(row_size * spec.height);
+        if (!src->get_pixels(src->roi(), format, scratch.data()))
+            return std::nullopt;
+
+        view.data_ = scratch.data();
+        view.bytes_per_ch_ = bytes_per_ch;
+        view.row_stride_ = static_cast<std::ptrdiff_t>(row_size);
+        return view;
+    }
+
+
+    // What the OIIO readers report of the source colour space, which the
+    // OIIO writers would have stored again
+    std::vector<unsigned char> get_icc_profile(const OIIO::ImageSpec& spec) {
+        const auto icc = spec.find_attribute("ICCProfile");
+        if (!icc)
+            return {};
+        const auto data = static_cast<const unsigned char*>(icc->data());
+        return { data, data + icc->type().size() };
+    }
+
+    sung::codec::ColorProfile make_color_profile(const OIIO::ImageSpec& spec) {
+        sung::codec::ColorProfile out;
+        out.icc_ = ::get_icc_profile(spec);
+        if (!out.icc_.empty())
+            return out;
+
+        auto color_space = spec.get_string_attribute("oiio:ColorSpace");
+        for (auto& c : color_space)
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        if (color_space.starts_with("srgb"))
+            out.srgb_ = true;
+        else
+            out.gamma_ = spec.get_float_attribute("oiio:Gamma", 0);
+        return out;
+    }
+
+    // From the colour space signature in the profile header
+    bool is_rgb_profile(const sung::codec::ColorProfile& color) {
+        const auto& icc = color.icc_;
+        if (icc.size() < 20)
+            return false;
+        const auto data = reinterpret_cast<const char*>(icc.data());
+        return std::string_view(data + 16, 4) == "RGB ";
+    }
+
+    sung::codec::ImageMetadata make_metadata(const OIIO::ImageSpec& spec) {
+        sung::codec::ImageMetadata out;
+        out.icc_ = ::get_icc_profile(spec);
+        out.orientation_ = spec.get_int_attribute("Orientation", 1);
+        return out;
+    }
+
+
+    // Same weights and rounding as PIL's convert("L")
+    void make_luma(const uint8_t* rgb, uint8_t* out, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            const uint32_t r = rgb[i * 3 + 0];
+            const uint32_t g = rgb[i * 3 + 1];
+            const uint32_t b = rgb[i * 3 + 2];
+            out[i] = (r * 19595 + g * 38470 + b * 7471 + 0x8000) >> 16;
+        }
+    }
+
+    // Channel count is a template argument so the loop vectorizes
+    template <int CH>
+    void interleave_alpha(
+        const uint8_t* color, const uint8_t* alpha, uint8_t* out, size_t count
+    ) {
+        for (size_t i = 0; i < count; ++i) {
+            for (int c = 0; c < CH; ++c)
+                out[i * (CH + 1) + c] = color[i * CH + c];
+            out[i * (CH + 1) + CH] = alpha[i];
+        }
+    }
+
 }  // namespace
 
 
@@ -79,6 +315,11 @@ namespace sung::oiio {
         factors_.insert(ratio);
     }
 
+    void ImageSize2D::resize_to_fit_area(double max_pixels) {
+        const auto ratio = std::sqrt(max_pixels / (width_ * height_));
+        factors_.insert(ratio);
+    }
+
     void ImageSize2D::resize_for_jpeg() {
         constexpr double MAX_LEN = 65535;
         this->resize_to_fit_into(MAX_LEN, MAX_LEN);
@@ -89,6 +330,14 @@ namespace sung::oiio {
         this->resize_to_fit_into(MAX_LEN, MAX_LEN);
     }
 
+    // JPEG XL Main profile level 5
+    void ImageSize2D::resize_for_jxl() {
+        constexpr double MAX_LEN = 262144;
+        constexpr double MAX_PIXELS = 268435456;
+        this->resize_to_fit_into(MAX_LEN, MAX_LEN);
+        this->resize_to_fit_area(MAX_PIXELS);
+    }
+
     void ImageSize2D::resize_for_i16p() {
         this->resize_to_fit_into(1206, 2622);
     }
@@ -124,17 +373,68 @@ namespace sung::oiio {
 
     ImageExportHarbor::ImageExportHarbor() {}
 
+    ImageExportHarbor::ImageExportHarbor(EncoderBackend backend)
+        : backend_(backend) {}
+
     ImageExportHarbor::~ImageExportHarbor() {}
 
+    bool ImageExportHarbor::is_cancelled() const {
+        return cancel_token_ && cancel_token_->is_cancelled();
+    }
+
     std::string ImageExportHarbor::build_png(
         const std::string_view& name,
         const IImage2D& img_ptr,
         const int compression_level
     ) {
+        if (this->is_cancelled())
+            return "Cancelled";
+
         const auto& img = dynamic_cast<const OIIOImage2D&>(img_ptr).get();
 
+        auto it = data_.emplace(name, Record{});
+        if (!it.second)
+            return "Name already exists";
+
+        auto& record = it.first->second;
+        record.file_ext_ = "png";
+
+        if (backend_ == EncoderBackend::native) {
+            std::vector<uint8_t> scratch;
+            if (const auto view = ::make_pixel_view(img, scratch, true)) {
+                auto err = sung::codec::encode_png(
+                    record.data_, *view, compression_level, png_options_
+                );
+                if (err.empty()) {
+                    err = sung::codec::insert_png_color_chunks(
+                        record.data_, ::make_color_profile(img.spec())
+                    );
+                }
+                if (err.empty())
+                    return {};
+                record.data_.clear();
+            }
+        }
+
         auto spec = img.spec();
         spec["png:compressionLevel"] = compression_level;
+        const auto err = ::write_with_oiio(
+            record.data_, "png", spec, img, cancel_token_
+        );
+        if (!err.empty())
+            data_.erase(it.first);
+        return err;
+    }
+
+    std::string ImageExportHarbor::build_png_optimized(
+        const std::string_view& name,
+        const IImage2D& img_ptr,
+        const int compression_level
+    ) {
+        if (this->is_cancelled())
+            return "Cancelled";
+
+        const auto& img = dynamic_cast<const OIIOImage2D&>(img_ptr).get();
 
         auto it = data_.emplace(name, Record{});
         if (!it.second)
@@ -142,19 +442,27 @@ namespace sung::oiio {
 
         auto& record = it.first->second;
         record.file_ext_ = "png";
-        OIIO::Filesystem::IOVecOutput vecout{ record.data_ };
 
-        auto out = OIIO::ImageOutput::create("png", &vecout);
-        if (!out)
-            return OIIO::geterror();
-        if (!out->open("png", spec))
-            return OIIO::geterror();
+        std::vector<uint8_t> scratch;
+        const auto view = ::make_pixel_view(img, scratch, true);
+        if (!view) {
+            data_.erase(it.first);
+            return "Failed to get pixels";
+        }
 
-        img.write(
-            out.get(),
-            [](void* opaque_data, float portion_done) { return false; },
-            nullptr
-        );
+        // PNG forbids an RGB profile on a grey image
+        const auto color = ::make_color_profile(img.spec());
+        sung::codec::PngOptimizeOptions options;
+        options.compression_level_ = compression_level;
+        options.allow_grey_ = !::is_rgb_profile(color);
+        options.cancel_ = cancel_token_;
+        auto err = sung::codec::optimize_png(record.data_, *view, options);
+        if (err.empty())
+            err = sung::codec::insert_png_color_chunks(record.data_, color);
+        if (!err.empty()) {
+            data_.erase(it.first);
+            return err;
+        }
 
         return {};
     }
@@ -164,10 +472,10 @@ namespace sung::oiio {
         const IImage2D& img_ptr,
         const int quality_level
     ) {
-        const auto& img = dynamic_cast<const OIIOImage2D&>(img_ptr).get();
+        if (this->is_cancelled())
+            return "Cancelled";
 
-        auto spec = img.spec();
-        spec["CompressionQuality"] = quality_level;
+        const auto& img = dynamic_cast<const OIIOImage2D&>(img_ptr).get();
 
         auto it = data_.emplace(name, Record{});
         if (!it.second)
@@ -175,21 +483,31 @@ namespace sung::oiio {
 
         auto& record = it.first->second;
         record.file_ext_ = "jpg";
-        OIIO::Filesystem::IOVecOutput vecout{ record.data_ };
 
-        auto out = OIIO::ImageOutput::create("jpeg", &vecout);
-        if (!out)
-            return OIIO::geterror();
-        if (!out->open("jpeg", spec))
-            return OIIO::geterror();
+        if (backend_ == EncoderBackend::native) {
+            std::vector<uint8_t> scratch;
+            if (const auto view = ::make_pixel_view(img, scratch, false)) {
+                const auto err = sung::codec::encode_jpeg(
+                    record.data_,
+                    *view,
+                    quality_level,
+                    jpeg_options_,
+                    ::make_metadata(img.spec())
+                );
+                if (err.empty())
+                    return {};
+                record.data_.clear();
+            }
+        }
 
-        img.write(
-            out.get(),
-            [](void* opaque_data, float portion_done) { return false; },
-            nullptr
+        auto spec = img.spec();
+        spec["CompressionQuality"] = quality_level;
+        const auto err = ::write_with_oiio(
+            record.data_, "jpeg", spec, img, cancel_token_
         );
-
-        return {};
+        if (!err.empty())
+            data_.erase(it.first);
+        return err;
     }
 
     std::string ImageExportHarbor::build_webp(
@@ -197,10 +515,10 @@ namespace sung::oiio {
         const IImage2D& img_ptr,
         const int compression_level
     ) {
-        const auto& img = dynamic_cast<const OIIOImage2D&>(img_ptr).get();
+        if (this->is_cancelled())
+            return "Cancelled";
 
-        auto spec = img.spec();
-        spec["CompressionQuality"] = compression_level;
+        const auto& img = dynamic_cast<const OIIOImage2D&>(img_ptr).get();
 
         auto it = data_.emplace(name, Record{});
         if (!it.second)
@@ -208,50 +526,170 @@ namespace sung::oiio {
 
         auto& record = it.first->second;
         record.file_ext_ = "webp";
-        OIIO::Filesystem::IOVecOutput vecout{ record.data_ };
 
-        auto out = OIIO::ImageOutput::create("webp", &vecout);
-        if (!out)
-            return OIIO::geterror();
-        if (!out->open("webp", spec))
-            return OIIO::geterror();
+        // The native encoder writes no ICC profile or orientation
+        const auto native = backend_ == EncoderBackend::native &&
+                            ::make_metadata(img.spec()).empty();
+        if (native) {
+            std::vector<uint8_t> scratch;
+            if (const auto view = ::make_pixel_view(img, scratch, false)) {
+                const auto err = sung::codec::encode_webp(
+                    record.data_,
+                    *view,
+                    static_cast<float>(compression_level),
+                    false,
+                    webp_options_
+                );
+                if (err.empty())
+                    return {};
+                record.data_.clear();
+            }
+        }
 
-        img.write(
-            out.get(),
-            [](void* opaque_data, float portion_done) { return false; },
-            nullptr
+        auto spec = img.spec();
+        spec["CompressionQuality"] = compression_level;
+        const auto err = ::write_with_oiio(
+            record.data_, "webp", spec, img, cancel_token_
         );
-
-        return {};
+        if (!err.empty())
+            data_.erase(it.first);
+        return err;
     }
 
     std::string ImageExportHarbor::build_webp_lossless(
         const std::string_view& name, const IImage2D& img_ptr
     ) {
+        if (this->is_cancelled())
+            return "Cancelled";
+
         const auto& img = dynamic_cast<const OIIOImage2D&>(img_ptr).get();
 
+        auto it = data_.emplace(name, Record{});
+        if (!it.second)
+            return "Name already exists";
+
+        auto& record = it.first->second;
+        record.file_ext_ = "webp";
+
+        // The native encoder writes no ICC profile or orientation
+        const auto native = backend_ == EncoderBackend::native &&
+                            ::make_metadata(img.spec()).empty();
+        if (native) {
+            std::vector<uint8_t> scratch;
+            if (const auto view = ::make_pixel_view(img, scratch, false)) {
+                const auto err = sung::codec::encode_webp(
+                    record.data_, *view, 100, true, webp_options_
+                );
+                if (err.empty())
+                    return {};
+                record.data_.clear();
+            }
+        }
+
         auto spec = img.spec();
         spec["Compression"] = "lossless";
+        const auto err = ::write_with_oiio(
+            record.data_, "webp", spec, img, cancel_token_
+        );
+        if (!err.empty())
+            data_.erase(it.first);
+        return err;
+    }
+
+    std::string ImageExportHarbor::build_jpeg_lossless(
+        const std::string_view& name,
+        const std::vector<unsigned char>& jpeg_data,
+        const bool progressive
+    ) {
+        if (this->is_cancelled())
+            return "Cancelled";
 
         auto it = data_.emplace(name, Record{});
         if (!it.second)
             return "Name already exists";
 
         auto& record = it.first->second;
-        record.file_ext_ = "webp";
-        OIIO::Filesystem::IOVecOutput vecout{ record.data_ };
+        record.file_ext_ = "jpg";
 
-        auto out = OIIO::ImageOutput::create("webp", &vecout);
-        if (!out)
-            return OIIO::geterror();
-        if (!out->open("webp", spec))
-            return OIIO::geterror();
+        sung::codec::JpegTranscodeOptions options;
+        options.progressive_ = progressive;
+        const auto err = sung::codec::transcode_jpeg(
+            record.data_, jpeg_data.data(), jpeg_data.size(), options
+        );
+        if (!err.empty()) {
+            data_.erase(it.first);
+            return err;
+        }
+
+        return {};
+    }
+
+    std::string ImageExportHarbor::build_jxl(
+        const std::string_view& name,
+        const IImage2D& img_ptr,
+        const int quality_level,
+        const int effort
+    ) {
+        if (this->is_cancelled())
+            return "Cancelled";
 
-        img.write(
-            out.get(),
-            [](void* opaque_data, float portion_done) { return false; },
-            nullptr
+        const auto& img = dynamic_cast<const OIIOImage2D&>(img_ptr).get();
+
+        auto it = data_.emplace(name, Record{});
+        if (!it.second)
+            return "Name already exists";
+
+        auto& record = it.first->second;
+        record.file_ext_ = "jxl";
+
+        std::vector<uint8_t> scratch;
+        const auto view = ::make_pixel_view(img, scratch, true);
+        if (!view) {
+            data_.erase(it.first);
+            return "Failed to get pixels";
+        }
+
+        sung::codec::JxlOptions options;
+        options.effort_ = effort;
+        const auto err = sung::codec::encode_jxl(
+            record.data_,
+            *view,
+            static_cast<float>(quality_level),
+            options,
+            ::make_metadata(img.spec())
+        );
+        if (!err.empty()) {
+            data_.erase(it.first);
+            return err;
+        }
+
+        return {};
+    }
+
+    std::string ImageExportHarbor::build_jxl_from_jpeg(
+        const std::string_view& name,
+        const std::vector<unsigned char>& jpeg_data,
+        const int effort
+    ) {
+        if (this->is_cancelled())
+            return "Cancelled";
+
+        auto it = data_.emplace(name, Record{});
+        if (!it.second)
+            return "Name already exists";
+
+        auto& record = it.first->second;
+        record.file_ext_ = "jxl";
+
+        sung::codec::JxlOptions options;
+        options.effort_ = effort;
+        const auto err = sung::codec::transcode_jpeg_to_jxl(
+            record.data_, jpeg_data.data(), jpeg_data.size(), options
         );
+        if (!err.empty()) {
+            data_.erase(it.first);
+            return err;
+        }
 
         return {};
     }
@@ -290,13 +728,40 @@ namespace sung::oiio {
 // namespace sung::oiio
 namespace sung::oiio {
 
-    ImgExpected open_img(const std::filesystem::path& path) {
-        auto ptr = std::make_unique<::OIIOImage2D>(make_utf8_str(path));
-        auto& img = ptr->get();
-        if (!img.read())
-            sung::unexpected(img.geterror());
+    void set_thread_limit(const unsigned count) {
+        OIIO::attribute("threads", static_cast<int>(count));
+    }
+
+    sung::Expected<ImageHeader, std::string> probe_img(
+        const std::filesystem::path& path
+    ) {
+        auto input = OIIO::ImageInput::open(make_utf8_str(path));
+        if (!input)
+            return sung::unexpected(OIIO::geterror());
 
-        return std::move(ptr);
+        const auto& spec = input->spec();
+        ImageHeader out;
+        out.width_ = spec.width;
+        out.height_ = spec.height;
+        out.nchannels_ = spec.nchannels;
+        out.format_ = input->format_name();
+        input->close();
+        return out;
+    }
+
+    ImgExpected open_img(
+        const std::filesystem::path& path, const sung::CancelToken* cancel
+    ) {
+        return ::read_pooled(make_utf8_str(path), nullptr, cancel);
+    }
+
+    ImgExpected open_img(
+        const std::filesystem::path& name,
+        const std::vector<unsigned char>& data,
+        const sung::CancelToken* cancel
+    ) {
+        OIIO::Filesystem::IOMemReader reader(data.data(), data.size());
+        return ::read_pooled(make_utf8_str(name), &reader, cancel);
     }
 
     ImageProperties get_img_properties(const IImage2D& img) {
@@ -310,28 +775,132 @@ namespace sung::oiio {
         props.animated_ = 0 != spec.get_int_attribute("oiio:Movie", 0);
         props.transparent_ = ::is_img_transparent(img_buf);
         props.monochrome_ = ::is_img_monochrome(img_buf);
+        props.orientation_ = spec.get_int_attribute("Orientation", 1);
 
         return props;
     }
 
-    ImgExpected resize_img(const IImage2D& img, const ImageSize2D& img_dim) {
-        const auto& img_buf = dynamic_cast<const OIIOImage2D&>(img).get();
-        const OIIO::ROI roi(
-            0,
-            img_dim.width(),
-            0,
-            img_dim.height(),
-            0,
-            1,
-            0,
-            img_buf.nchannels()
-        );
+    sung::Expected<sung::codec::PixelView, std::string> get_pixel_view(
+        IImage2D& img_ptr
+    ) {
+        auto& img = dynamic_cast<OIIOImage2D&>(img_ptr).get();
+        if (!img.localpixels() && !img.read(0, 0, true))
+            return sung::unexpected(img.geterror());
+        if (::is_premultiplied(img.spec())) {
+            if (!OIIO::ImageBufAlgo::unpremult(img, img))
+                return sung::unexpected(OIIO::geterror());
+            img.specmod().attribute("oiio:UnassociatedAlpha", 1);
+        }
+
+        const auto& spec = img.spec();
+        const auto is_u8 = spec.format == OIIO::TypeDesc::UINT8;
+        const auto is_u16 = spec.format == OIIO::TypeDesc::UINT16;
+        if (!is_u8 && !is_u16) {
+            return sung::unexpected(fmt::format(
+                "Pixel format {} cannot be shared", spec.format.c_str()
+            ));
+        }
+        if (img.pixel_stride() !=
+            static_cast<OIIO::stride_t>(spec.pixel_bytes()))
+            return sung::unexpected("Pixels are not packed");
+
+        sung::codec::PixelView view;
+        view.data_ = static_cast<const uint8_t*>(img.localpixels());
+        view.width_ = spec.width;
+        view.height_ = spec.height;
+        view.nchannels_ = spec.nchannels;
+        view.bytes_per_ch_ = is_u16 ? 2 : 1;
+        view.row_stride_ = img.scanline_stride();
+        return view;
+    }
+
+    ImgExpected wrap_pixels(const sung::codec::PixelView& pixels) {
+        if (pixels.nchannels_ < 1 || pixels.nchannels_ > 4)
+            return sung::unexpected(fmt::format(
+                "{} channels not supported", pixels.nchannels_
+            ));
 
-        auto out = std::make_unique<OIIOImage2D>("");
-        const auto res = OIIO::ImageBufAlgo::resize(
-            out->get(), img_buf, nullptr, roi
+        OIIO::ImageSpec spec(
+            pixels.width_,
+            pixels.height_,
+            pixels.nchannels_,
+            pixels.bytes_per_ch_ == 2 ? OIIO::TypeDesc::UINT16
+                                      : OIIO::TypeDesc::UINT8
         );
-        if (!res)
+        if (pixels.nchannels_ == 2) {
+            spec.channelnames = { "Y", "A" };
+            spec.alpha_channel = 1;
+        }
+        if (spec.alpha_channel >= 0)
+            spec.attribute("oiio:UnassociatedAlpha", 1);
+
+        auto out = std::make_unique<OIIOImage2D>();
+        out->get().reset(
+            spec,
+            const_cast<uint8_t*>(pixels.data_),
+            static_cast<OIIO::stride_t>(pixels.nchannels_) *
+                pixels.bytes_per_ch_,
+            pixels.row_stride_
+        );
+        return std::move(out);
+    }
+
+    ImgExpected resize_img(
+        const IImage2D& img,
+        const ImageSize2D& img_dim,
+        const sung::CancelToken* cancel
+    ) {
+        const auto& img_buf = dynamic_cast<const OIIOImage2D&>(img).get();
+        const auto width = img_dim.width();
+        const auto height = img_dim.height();
+        const auto nch = img_buf.nchannels();
+        const OIIO::ROI roi(0, width, 0, height, 0, 1, 0, nch);
+
+        // Laid out as ImageBufAlgo would, so each band maps the whole
+        // source onto the whole output
+        auto spec = img_buf.spec();
+        spec.x = spec.y = spec.full_x = spec.full_y = 0;
+        spec.width = spec.full_width = width;
+        spec.height = spec.full_height = height;
+        spec.tile_width = spec.tile_height = 0;
+        auto out = std::make_unique<OIIOImage2D>();
+        out->allocate(spec);
+
+        // Filtering straight colour bleeds the hidden colour of transparent
+        // pixels into the edges, so resize premultiplied
+        const auto* src = &img_buf;
+        OIIO::ImageBuf premultiplied;
+        const auto straight = spec.alpha_channel >= 0 &&
+                              !::is_premultiplied(spec);
+        if (straight) {
+            if (!OIIO::ImageBufAlgo::premult(premultiplied, img_buf))
+                return sung::unexpected(OIIO::geterror());
+            src = &premultiplied;
+        }
+
+        if (!cancel) {
+            const auto res = OIIO::ImageBufAlgo::resize(
+                out->get(), *src, nullptr, roi
+            );
+            if (!res)
+                return sung::unexpected(OIIO::geterror());
+        } else {
+            constexpr int BAND_ROWS = 256;
+            for (int y = 0; y < height; y += BAND_ROWS) {
+                if (cancel->is_cancelled())
+                    return sung::unexpected("Cancelled");
+
+                const auto y_end = std::min(y + BAND_ROWS, height);
+                const OIIO::ROI band(0, width, y, y_end, 0, 1, 0, nch);
+                const auto res = OIIO::ImageBufAlgo::resize(
+                    out->get(), *src, nullptr, band
+                );
+                if (!res)
+                    return sung::unexpected(OIIO::geterror());
+            }
+        }
+
+        if (straight && !OIIO::ImageBufAlgo::unpremult(out->get(), out->get()))
             return sung::unexpected(OIIO::geterror());
 
         return std::move(out);
@@ -341,31 +910,114 @@ namespace sung::oiio {
         const auto& img = dynamic_cast<const OIIOImage2D&>(img_ptr).get();
         auto& spec = img.spec();
 
-        auto out = std::make_unique<OIIOImage2D>("");
-        if (spec.alpha_channel < 0) {
-            out->get().copy(img);
-            return std::move(out);
+        if (spec.alpha_channel >= 0 && spec.nchannels != 4) {
+            return sung::unexpected(fmt::format(
+                "Cannot drop alpha channel if nchannel is {}", spec.nchannels
+            ));
         }
 
-        if (spec.nchannels != 4) {
+        const auto nch = spec.alpha_channel < 0 ? spec.nchannels : 3;
+        return ::copy_channels(img, nch);
+    }
+
+    ImgExpected merge_greyscale_channels(const IImage2D& img_ptr) {
+        const auto& img = dynamic_cast<const OIIOImage2D&>(img_ptr).get();
+        return ::copy_channels(img, 1);
+    }
+
+    ImgExpected merge_alpha(
+        const IImage2D& color_ptr, const IImage2D& opacity_ptr
+    ) {
+        const auto& color = dynamic_cast<const OIIOImage2D&>(color_ptr).get();
+        const auto& opacity = dynamic_cast<const OIIOImage2D&>(opacity_ptr)
+                                  .get();
+        const auto& spec = color.spec();
+        const auto& op_spec = opacity.spec();
+        if (spec.width != op_spec.width || spec.height != op_spec.height) {
             return sung::unexpected(fmt::format(
-                "Cannot drop alpha channel if nchannel is {}", spec.nchannels
+                "Opacity is {}x{} but colour is {}x{}",
+                op_spec.width,
+                op_spec.height,
+                spec.width,
+                spec.height
             ));
         }
 
-        if (!OIIO::ImageBufAlgo::channels(out->get(), img, 3, {}))
-            return sung::unexpected(OIIO::geterror());
+        const auto count = static_cast<size_t>(spec.width) * spec.height;
+        const auto color_ch = spec.nchannels >= 3 ? 3 : 1;
+        const auto op_ch = op_spec.nchannels >= 3 ? 3 : 1;
+
+        auto roi = color.roi();
+        roi.chbegin = 0;
+        roi.chend = color_ch;
+        std::vector<uint8_t> color_px(count * color_ch);
+        if (!color.get_pixels(roi, OIIO::TypeDesc::UINT8, color_px.data()))
+            return sung::unexpected(color.geterror());
+
+        roi = opacity.roi();
+        roi.chbegin = 0;
+        roi.chend = op_ch;
+        std::vector<uint8_t> alpha(count * op_ch);
+        if (!opacity.get_pixels(roi, OIIO::TypeDesc::UINT8, alpha.data()))
+            return sung::unexpected(opacity.geterror());
+        if (op_ch == 3) {
+            std::vector<uint8_t> luma(count);
+            ::make_luma(alpha.data(), luma.data(), count);
+            alpha = std::move(luma);
+        }
+
+        OIIO::ImageSpec out_spec(
+            spec.width, spec.height, color_ch + 1, OIIO::TypeDesc::UINT8
+        );
+        if (color_ch == 1) {
+            out_spec.channelnames = { "Y", "A" };
+            out_spec.alpha_channel = 1;
+        }
+        out_spec.attribute(
+            "Orientation", spec.get_int_attribute("Orientation", 1)
+        );
+        // Colour is copied as is, like PIL's putalpha did
+        out_spec.attribute("oiio:UnassociatedAlpha", 1);
+
+        auto out = std::make_unique<OIIOImage2D>();
+        out->allocate(out_spec);
+        const auto dst = static_cast<uint8_t*>(out->get().localpixels());
+        if (color_ch == 3)
+            ::interleave_alpha<3>(color_px.data(), alpha.data(), dst, count);
+        else
+            ::interleave_alpha<1>(color_px.data(), alpha.data(), dst, count);
 
         return std::move(out);
     }
 
-    ImgExpected merge_greyscale_channels(const IImage2D& img_ptr) {
+    sung::Expected<std::vector<uint8_t>, std::string> make_grey_thumbnail(
+        const IImage2D& img_ptr, int width, int height
+    ) {
         const auto& img = dynamic_cast<const OIIOImage2D&>(img_ptr).get();
-        auto out = std::make_unique<OIIOImage2D>("");
-        if (!OIIO::ImageBufAlgo::channels(out->get(), img, 1, {}))
+        const auto nch = img.nchannels();
+        const OIIO::ROI roi(0, width, 0, height, 0, 1, 0, nch);
+
+        OIIO::ImageBuf small;
+        if (!OIIO::ImageBufAlgo::resize(small, img, nullptr, roi))
             return sung::unexpected(OIIO::geterror());
 
-        return std::move(out);
+        std::vector<float> rgb(size_t(width) * height * nch);
+        if (!small.get_pixels(roi, OIIO::TypeDesc::FLOAT, rgb.data()))
+            return sung::unexpected(small.geterror());
+
+        std::vector<uint8_t> out(size_t(width) * height);
+        for (size_t i = 0; i < out.size(); ++i) {
+            const auto px = rgb.data() + i * nch;
+            const auto luma = nch >= 3
+                                  ? 0.299f * px[0] + 0.587f * px[1] +
+                                        0.114f * px[2]
+                                  : px[0];
+            out[i] = static_cast<uint8_t>(
+                std::clamp(luma, 0.f, 1.f) * 255.f + 0.5f
+            );
+        }
+
+        return out;
     }
 
 }  // namespace sung::oiio
@@ -0,0 +1,205 @@
+#include "sung/imgref/jxl_codec.hpp"
+
+#include <algorithm>
+#include <memory>
+
+#include <fmt/core.h>
+#include <jxl/encode.h>
+
+
+namespace {
+
+    struct JxlEncoderDeleter {
+        void operator()(JxlEncoder* enc) const { JxlEncoderDestroy(enc); }
+    };
+
+    using JxlEncoderPtr = std::unique_ptr<JxlEncoder, JxlEncoderDeleter>;
+
+
+    std::string make_jxl_error(JxlEncoder* enc, const char* stage) {
+        return fmt::format(
+            "libjxl: {} failed ({})", stage, (int)JxlEncoderGetError(enc)
+        );
+    }
+
+    std::string flush_jxl_output(
+        JxlEncoder* enc, std::vector<unsigned char>& out
+    ) {
+        const auto start = out.size();
+        out.resize(start + 64 * 1024);
+        auto next_out = out.data() + start;
+        auto avail_out = out.size() - start;
+
+        while (true) {
+            const auto status = JxlEncoderProcessOutput(
+                enc, &next_out, &avail_out
+            );
+            if (status == JXL_ENC_SUCCESS)
+                break;
+            if (status != JXL_ENC_NEED_MORE_OUTPUT) {
+                out.resize(start);
+                return ::make_jxl_error(enc, "JxlEncoderProcessOutput");
+            }
+
+            const auto written = next_out - out.data();
+            out.resize(out.size() * 2);
+            next_out = out.data() + written;
+            avail_out = out.size() - written;
+        }
+
+        out.resize(next_out - out.data());
+        return {};
+    }
+
+    JxlEncoderFrameSettings* make_frame_settings(
+        JxlEncoder* enc, const sung::codec::JxlOptions& options
+    ) {
+        auto settings = JxlEncoderFrameSettingsCreate(enc, nullptr);
+        if (!settings)
+            return nullptr;
+
+        const auto res = JxlEncoderFrameSettingsSetOption(
+            settings, JXL_ENC_FRAME_SETTING_EFFORT, options.effort_
+        );
+        if (res != JXL_ENC_SUCCESS)
+            return nullptr;
+
+        return settings;
+    }
+
+}  // namespace
+
+
+namespace sung::codec {
+
+    std::string encode_jxl(
+        std::vector<unsigned char>& out,
+        const PixelView& img,
+        float quality,
+        const JxlOptions& options,
+        const ImageMetadata& metadata
+    ) {
+        if (img.bytes_per_ch_ != 1 && img.bytes_per_ch_ != 2)
+            return "JPEG XL encoder only accepts 8 or 16-bit samples";
+        if (img.nchannels_ < 1 || img.nchannels_ > 4)
+            return fmt::format(
+                "JPEG XL encoder cannot handle {} channels", img.nchannels_
+            );
+
+        JxlEncoderPtr enc{ JxlEncoderCreate(nullptr) };
+        if (!enc)
+            return "JxlEncoderCreate failed";
+
+        const auto lossless = quality >= 100;
+        const auto has_alpha = img.nchannels_ == 2 || img.nchannels_ == 4;
+        const auto bits = static_cast<uint32_t>(img.bytes_per_ch_ * 8);
+
+        JxlBasicInfo info;
+        JxlEncoderInitBasicInfo(&info);
+        info.xsize = img.width_;
+        info.ysize = img.height_;
+        info.bits_per_sample = bits;
+        info.num_color_channels = img.nchannels_ >= 3 ? 3 : 1;
+        info.num_extra_channels = has_alpha ? 1 : 0;
+        info.alpha_bits = has_alpha ? bits : 0;
+        // Pixels stay in the source space rather than XYB with a profile
+        const auto has_icc = !metadata.icc_.empty();
+        info.uses_original_profile = lossless || has_icc ? JXL_TRUE
+                                                         : JXL_FALSE;
+        if (metadata.orientation_ >= 1 && metadata.orientation_ <= 8)
+            info.orientation = static_cast<JxlOrientation>(
+                metadata.orientation_
+            );
+        if (JXL_ENC_SUCCESS != JxlEncoderSetBasicInfo(enc.get(), &info))
+            return ::make_jxl_error(enc.get(), "JxlEncoderSetBasicInfo");
+
+        if (has_icc) {
+            const auto res = JxlEncoderSetICCProfile(
+                enc.get(), metadata.icc_.data(), metadata.icc_.size()
+            );
+            if (res != JXL_ENC_SUCCESS)
+                return ::make_jxl_error(enc.get(), "JxlEncoderSetICCProfile");
+        } else {
+            JxlColorEncoding color;
+            JxlColorEncodingSetToSRGB(&color, img.nchannels_ < 3);
+            const auto res = JxlEncoderSetColorEncoding(enc.get(), &color);
+            if (res != JXL_ENC_SUCCESS)
+                return ::make_jxl_error(
+                    enc.get(), "JxlEncoderSetColorEncoding"
+                );
+        }
+
+        auto settings = ::make_frame_settings(enc.get(), options);
+        if (!settings)
+            return ::make_jxl_error(enc.get(), "frame settings");
+
+        if (lossless) {
+            JxlEncoderSetFrameLossless(settings, JXL_TRUE);
+        } else {
+            const auto distance = JxlEncoderDistanceFromQuality(quality);
+            JxlEncoderSetFrameDistance(settings, distance);
+        }
+
+        // libjxl only takes tightly packed rows or a power of two alignment
+        const auto packed_row = static_cast<std::ptrdiff_t>(img.width_) *
+                                img.nchannels_ * img.bytes_per_ch_;
+        std::vector<uint8_t> packed;
+        const uint8_t* pixels = img.data_;
+        if (img.row_stride_ != packed_row) {
+            packed.resize(packed_row * img.height_);
+            for (int y = 0; y < img.height_; ++y) {
+                std::copy(
+                    img.row(y),
+                    img.row(y) + packed_row,
+                    packed.data() + y * packed_row
+                );
+            }
+            pixels = packed.data();
+        }
+
+        JxlPixelFormat format;
+        format.num_channels = img.nchannels_;
+        format.data_type = img.bytes_per_ch_ == 1 ? JXL_TYPE_UINT8
+                                                  : JXL_TYPE_UINT16;
+        format.endianness = JXL_NATIVE_ENDIAN;
+        format.align = 0;
+
+        const auto add_res = JxlEncoderAddImageFrame(
+            settings, &format, pixels, packed_row * img.height_
+        );
+        if (add_res != JXL_ENC_SUCCESS)
+            return ::make_jxl_error(enc.get(), "JxlEncoderAddImageFrame");
+
+        JxlEncoderCloseInput(enc.get());
+        return ::flush_jxl_output(enc.get(), out);
+    }
+
+    std::string transcode_jpeg_to_jxl(
+        std::vector<unsigned char>& out,
+        const unsigned char* jpeg_data,
+        size_t jpeg_size,
+        const JxlOptions& options
+    ) {
+        JxlEncoderPtr enc{ JxlEncoderCreate(nullptr) };
+        if (!enc)
+            return "JxlEncoderCreate failed";
+
+        // Keeps the reconstruction data so the JPEG can be restored exactly
+        if (JXL_ENC_SUCCESS != JxlEncoderStoreJPEGMetadata(enc.get(), JXL_TRUE))
+            return ::make_jxl_error(enc.get(), "JxlEncoderStoreJPEGMetadata");
+
+        auto settings = ::make_frame_settings(enc.get(), options);
+        if (!settings)
+            return ::make_jxl_error(enc.get(), "frame settings");
+
+        const auto add_res = JxlEncoderAddJPEGFrame(
+            settings, jpeg_data, jpeg_size
+        );
+        if (add_res != JXL_ENC_SUCCESS)
+            return ::make_jxl_error(enc.get(), "JxlEncoderAddJPEGFrame");
+
+        JxlEncoderCloseInput(enc.get());
+        return ::flush_jxl_output(enc.get(), out);
+    }
+
+}  // namespace sung::codec
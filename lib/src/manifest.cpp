@@ -0,0 +1,162 @@
+#include "sung/imgref/manifest.hpp"
+
+#include <cstring>
+#include <iostream>
+
+#include <fmt/core.h>
+
+#include "sung/imgref/filesys.hpp"
+
+#ifdef __unix__
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+
+namespace {
+
+    namespace fs = std::filesystem;
+
+
+    constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+
+    fs::path make_path_from_utf8(const char* data, size_t size) {
+        return fs::path(
+            std::u8string(reinterpret_cast<const char8_t*>(data), size)
+        );
+    }
+
+}  // namespace
+
+
+namespace sung {
+
+    ManifestReader::~ManifestReader() { this->close(); }
+
+    std::string ManifestReader::open(const fs::path& path) {
+        this->close();
+
+        if (path == "-") {
+            stream_ = &std::cin;
+            this->refill();
+            this->detect_separator();
+            return {};
+        }
+
+#ifdef __unix__
+        const auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return fmt::format(
+                "Failed to open manifest: {}", sung::make_utf8_str(path)
+            );
+
+        struct stat st {};
+        if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+            map_size_ = static_cast<size_t>(st.st_size);
+            map_ = ::mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map_ == MAP_FAILED) {
+                map_ = nullptr;
+                map_size_ = 0;
+            } else {
+                ::madvise(map_, map_size_, MADV_SEQUENTIAL);
+            }
+        }
+        ::close(fd);
+
+        if (map_) {
+            data_ = static_cast<const char*>(map_);
+            size_ = map_size_;
+            this->detect_separator();
+            return {};
+        }
+#endif
+
+        // Not mappable, e.g. a pipe or an empty file
+        file_.open(path, std::ios::in | std::ios::binary);
+        if (!file_)
+            return fmt::format(
+                "Failed to open manifest: {}", sung::make_utf8_str(path)
+            );
+        stream_ = &file_;
+        this->refill();
+        this->detect_separator();
+        return {};
+    }
+
+    std::optional<fs::path> ManifestReader::next() {
+        if (!data_)
+            return std::nullopt;
+
+        while (true) {
+            auto begin = data_ + pos_;
+            auto end = data_ + size_;
+            const auto sep = static_cast<const char*>(
+                std::memchr(begin, separator_, end - begin)
+            );
+
+            if (!sep) {
+                if (this->refill())
+                    continue;
+                // The buffer may have been compacted
+                begin = data_ + pos_;
+                end = data_ + size_;
+                if (begin == end)
+                    return std::nullopt;
+            }
+
+            const auto entry_end = sep ? sep : end;
+            pos_ = sep ? (sep - data_ + 1) : size_;
+
+            auto len = static_cast<size_t>(entry_end - begin);
+            if (separator_ == '\n' && len > 0 && begin[len - 1] == '\r')
+                --len;
+            if (len == 0)
+                continue;
+
+            return ::make_path_from_utf8(begin, len);
+        }
+    }
+
+    bool ManifestReader::refill() {
+        if (!stream_ || !*stream_)
+            return false;
+
+        buffer_.erase(0, pos_);
+        const auto old_size = buffer_.size();
+        buffer_.resize(old_size + CHUNK_SIZE);
+        stream_->read(buffer_.data() + old_size, CHUNK_SIZE);
+        const auto read = static_cast<size_t>(stream_->gcount());
+        buffer_.resize(old_size + read);
+
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+        pos_ = 0;
+        return read > 0;
+    }
+
+    void ManifestReader::detect_separator() {
+        const auto probe = std::min(size_, CHUNK_SIZE);
+        separator_ = std::memchr(data_, '\0', probe) ? '\0' : '\n';
+    }
+
+    void ManifestReader::close() {
+#ifdef __unix__
+        if (map_)
+            ::munmap(map_, map_size_);
+#endif
+        map_ = nullptr;
+        map_size_ = 0;
+
+        if (file_.is_open())
+            file_.close();
+        stream_ = nullptr;
+        buffer_.clear();
+        data_ = nullptr;
+        size_ = 0;
+        pos_ = 0;
+    }
+
+}  // namespace sung
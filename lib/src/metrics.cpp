@@ -0,0 +1,379 @@
+#include "sung/imgref/metrics.hpp"
+
+#include <fstream>
+#include <set>
+
+#include <fmt/core.h>
+
+#ifdef __linux__
+    #include <sys/resource.h>
+    #include <unistd.h>
+#endif
+
+
+namespace {
+
+    size_t get_thread_slot(size_t slot_count) {
+        thread_local const size_t slot = std::hash<std::thread::id>{}(
+            std::this_thread::get_id()
+        );
+        return slot % slot_count;
+    }
+
+    std::string join_labels(const std::string& a, const std::string& b) {
+        if (a.empty())
+            return b;
+        if (b.empty())
+            return a;
+        return a + "," + b;
+    }
+
+    std::string wrap_labels(const std::string& labels) {
+        if (labels.empty())
+            return {};
+        return "{" + labels + "}";
+    }
+
+    std::string format_value(double value) {
+        return fmt::format("{}", value);
+    }
+
+}  // namespace
+
+
+// Counter, Gauge
+namespace sung::metrics {
+
+    void Counter::inc(uint64_t n) {
+        slots_[::get_thread_slot(SLOT_COUNT)].value_.fetch_add(
+            n, std::memory_order_relaxed
+        );
+    }
+
+    uint64_t Counter::get() const {
+        uint64_t out = 0;
+        for (const auto& slot : slots_)
+            out += slot.value_.load(std::memory_order_relaxed);
+        return out;
+    }
+
+    void Gauge::set(double value) {
+        value_.store(value, std::memory_order_relaxed);
+    }
+
+    void Gauge::add(double delta) {
+        value_.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    double Gauge::get() const { return value_.load(std::memory_order_relaxed); }
+
+}  // namespace sung::metrics
+
+
+// Histogram
+namespace sung::metrics {
+
+    Histogram::Histogram(std::vector<double> bounds)
+        : bounds_(std::move(bounds))
+        , counts_(new std::atomic<uint64_t>[bounds_.size() + 1]) {
+        for (size_t i = 0; i <= bounds_.size(); ++i) counts_[i] = 0;
+    }
+
+    void Histogram::observe(double value) {
+        const auto it = std::lower_bound(bounds_.begin(), bounds_.end(), value);
+        const auto index = static_cast<size_t>(it - bounds_.begin());
+        counts_[index].fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::vector<uint64_t> Histogram::get_counts() const {
+        std::vector<uint64_t> out(bounds_.size() + 1);
+        for (size_t i = 0; i < out.size(); ++i)
+            out[i] = counts_[i].load(std::memory_order_relaxed);
+        return out;
+    }
+
+    double Histogram::get_sum() const {
+        return sum_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Histogram::get_count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    std::vector<double> make_latency_bounds() {
+        return { 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,  0.25,
+                 0.5,   1,      2.5,   5,    10,    30,   60,   120 };
+    }
+
+}  // namespace sung::metrics
+
+
+// Registry
+namespace sung::metrics {
+
+    Counter& Registry::counter(
+        const std::string& name,
+        const std::string& help,
+        const std::string& labels
+    ) {
+        std::lock_guard lock(mut_);
+        if (auto e = this->find(name, labels); e && e->counter_)
+            return *e->counter_;
+
+        auto& e = entries_.emplace_back();
+        e.name_ = name;
+        e.help_ = help;
+        e.labels_ = labels;
+        e.type_ = Type::counter;
+        e.counter_ = std::make_unique<Counter>();
+        return *e.counter_;
+    }
+
+    Gauge& Registry::gauge(
+        const std::string& name,
+        const std::string& help,
+        const std::string& labels
+    ) {
+        std::lock_guard lock(mut_);
+        if (auto e = this->find(name, labels); e && e->gauge_)
+            return *e->gauge_;
+
+        auto& e = entries_.emplace_back();
+        e.name_ = name;
+        e.help_ = help;
+        e.labels_ = labels;
+        e.type_ = Type::gauge;
+        e.gauge_ = std::make_unique<Gauge>();
+        return *e.gauge_;
+    }
+
+    Histogram& Registry::histogram(
+        const std::string& name,
+        const std::string& help,
+        const std::string& labels,
+        std::vector<double> bounds
+    ) {
+        std::lock_guard lock(mut_);
+        if (auto e = this->find(name, labels); e && e->histogram_)
+            return *e->histogram_;
+
+        auto& e = entries_.emplace_back();
+        e.name_ = name;
+        e.help_ = help;
+        e.labels_ = labels;
+        e.type_ = Type::histogram;
+        e.histogram_ = std::make_unique<Histogram>(std::move(bounds));
+        return *e.histogram_;
+    }
+
+    void Registry::gauge_callback(
+        const std::string& name,
+        const std::string& help,
+        std::function<double()> callback
+    ) {
+        std::lock_guard lock(mut_);
+        auto& e = entries_.emplace_back();
+        e.name_ = name;
+        e.help_ = help;
+        e.type_ = Type::callback;
+        e.callback_ = std::move(callback);
+    }
+
+    std::string Registry::render_prometheus() const {
+        std::lock_guard lock(mut_);
+
+        std::string out;
+        std::set<std::string> described;
+        for (const auto& e : entries_) {
+            if (described.insert(e.name_).second) {
+                const char* type_str = "gauge";
+                if (e.type_ == Type::counter)
+                    type_str = "counter";
+                else if (e.type_ == Type::histogram)
+                    type_str = "histogram";
+
+                out += fmt::format("# HELP {} {}\n", e.name_, e.help_);
+                out += fmt::format("# TYPE {} {}\n", e.name_, type_str);
+            }
+
+            const auto labels = ::wrap_labels(e.labels_);
+            switch (e.type_) {
+                case Type::counter:
+                    out += fmt::format(
+                        "{}{} {}\n", e.name_, labels, e.counter_->get()
+                    );
+                    break;
+                case Type::gauge:
+                    out += fmt::format(
+                        "{}{} {}\n",
+                        e.name_,
+                        labels,
+                        ::format_value(e.gauge_->get())
+                    );
+                    break;
+                case Type::callback:
+                    out += fmt::format(
+                        "{}{} {}\n",
+                        e.name_,
+                        labels,
+                        ::format_value(e.callback_())
+                    );
+                    break;
+                case Type::histogram: {
+                    const auto& h = *e.histogram_;
+                    const auto counts = h.get_counts();
+                    uint64_t cumulative = 0;
+                    for (size_t i = 0; i < counts.size(); ++i) {
+                        cumulative += counts[i];
+                        const auto le = i < h.bounds().size()
+                                            ? ::format_value(h.bounds()[i])
+                                            : std::string("+Inf");
+                        out += fmt::format(
+                            "{}_bucket{} {}\n",
+                            e.name_,
+                            ::wrap_labels(::join_labels(
+                                e.labels_, fmt::format("le=\"{}\"", le)
+                            )),
+                            cumulative
+                        );
+                    }
+                    out += fmt::format(
+                        "{}_sum{} {}\n",
+                        e.name_,
+                        labels,
+                        ::format_value(h.get_sum())
+                    );
+                    out += fmt::format(
+                        "{}_count{} {}\n", e.name_, labels, h.get_count()
+                    );
+                    break;
+                }
+            }
+        }
+
+        return out;
+    }
+
+    Registry::Entry* Registry::find(
+        const std::string& name, const std::string& labels
+    ) {
+        for (auto& e : entries_) {
+            if (e.name_ == name && e.labels_ == labels)
+                return &e;
+        }
+        return nullptr;
+    }
+
+}  // namespace sung::metrics
+
+
+// StageTimer
+namespace sung::metrics {
+
+    StageTimer::StageTimer(Histogram* histogram, double* seconds)
+        : histogram_(histogram)
+        , seconds_(seconds)
+        , start_(std::chrono::steady_clock::now()) {}
+
+    StageTimer::~StageTimer() { this->finish(); }
+
+    void StageTimer::finish() {
+        if (!histogram_ && !seconds_)
+            return;
+
+        const auto elapsed = std::chrono::steady_clock::now() - start_;
+        const auto sec = std::chrono::duration<double>(elapsed).count();
+        if (histogram_)
+            histogram_->observe(sec);
+        if (seconds_)
+            *seconds_ = sec;
+
+        histogram_ = nullptr;
+        seconds_ = nullptr;
+    }
+
+}  // namespace sung::metrics
+
+
+// TextfileWriter
+namespace sung::metrics {
+
+    TextfileWriter::TextfileWriter(
+        const Registry& registry,
+        const fs::path& path,
+        std::chrono::milliseconds interval
+    )
+        : registry_(registry), path_(path), interval_(interval) {
+        thread_ = std::thread([this] {
+            std::unique_lock lock(mut_);
+            while (!stop_) {
+                cv_.wait_for(lock, interval_, [this] { return stop_; });
+                lock.unlock();
+                this->write_once();
+                lock.lock();
+            }
+        });
+    }
+
+    TextfileWriter::~TextfileWriter() { this->stop(); }
+
+    void TextfileWriter::stop() {
+        {
+            std::lock_guard lock(mut_);
+            if (stop_)
+                return;
+            stop_ = true;
+        }
+        cv_.notify_all();
+        if (thread_.joinable())
+            thread_.join();
+    }
+
+    void TextfileWriter::write_once() const {
+        auto tmp_path = path_;
+        tmp_path += ".tmp";
+
+        {
+            std::ofstream file(tmp_path, std::ios::trunc | std::ios::binary);
+            if (!file)
+                return;
+            file << registry_.render_prometheus();
+        }
+
+        std::error_code ec;
+        fs::rename(tmp_path, path_, ec);
+    }
+
+}  // namespace sung::metrics
+
+
+// Free functions
+namespace sung::metrics {
+
+    uint64_t get_process_rss_bytes() {
+#ifdef __linux__
+        std::ifstream file("/proc/self/statm");
+        uint64_t total_pages = 0, resident_pages = 0;
+        if (!(file >> total_pages >> resident_pages))
+            return 0;
+        return resident_pages * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+#else
+        return 0;
+#endif
+    }
+
+    uint64_t get_peak_rss_bytes() {
+#ifdef __linux__
+        rusage usage{};
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+        // Reported in KiB on Linux
+        return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#else
+        return 0;
+#endif
+    }
+
+}  // namespace sung::metrics
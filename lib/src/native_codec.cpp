@@ -0,0 +1,555 @@
+#include "sung/imgref/native_codec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fmt/core.h>
+#include <jpeglib.h>
+#include <png.h>
+#include <webp/encode.h>
+#include <zlib.h>
+
+
+// JPEG
+namespace {
+
+    struct JpegErrorMgr {
+        jpeg_error_mgr pub_;
+        std::jmp_buf jmp_;
+        char msg_[JMSG_LENGTH_MAX] = {};
+    };
+
+    void jpeg_error_exit(j_common_ptr cinfo) {
+        auto err = reinterpret_cast<JpegErrorMgr*>(cinfo->err);
+        (*cinfo->err->format_message)(cinfo, err->msg_);
+        std::longjmp(err->jmp_, 1);
+    }
+
+    void jpeg_output_message(j_common_ptr cinfo) {}
+
+
+    // Lives outside of the setjmp frame so it is valid after a longjmp.
+    struct JpegMemDest {
+        unsigned char* buf_ = nullptr;
+        unsigned long size_ = 0;
+
+        ~JpegMemDest() {
+            if (buf_)
+                std::free(buf_);
+        }
+    };
+
+
+    bool set_jpeg_color_space(jpeg_compress_struct& cinfo, int nchannels) {
+        switch (nchannels) {
+            case 1:
+                cinfo.input_components = 1;
+                cinfo.in_color_space = JCS_GRAYSCALE;
+                return true;
+            case 3:
+                cinfo.input_components = 3;
+                cinfo.in_color_space = JCS_RGB;
+                return true;
+#ifdef JCS_EXTENSIONS
+            case 4:
+                // Alpha is ignored by libjpeg-turbo, no channel drop copy
+                cinfo.input_components = 4;
+                cinfo.in_color_space = JCS_EXT_RGBX;
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
+
+    void set_jpeg_subsampling(
+        jpeg_compress_struct& cinfo, sung::codec::ChromaSubsampling sub
+    ) {
+        if (cinfo.num_components < 3)
+            return;
+
+        auto& luma = cinfo.comp_info[0];
+        switch (sub) {
+            case sung::codec::ChromaSubsampling::s444:
+                luma.h_samp_factor = 1;
+                luma.v_samp_factor = 1;
+                break;
+            case sung::codec::ChromaSubsampling::s422:
+                luma.h_samp_factor = 2;
+                luma.v_samp_factor = 1;
+                break;
+            case sung::codec::ChromaSubsampling::s420:
+                luma.h_samp_factor = 2;
+                luma.v_samp_factor = 2;
+                break;
+        }
+
+        for (int i = 1; i < cinfo.num_components; ++i) {
+            cinfo.comp_info[i].h_samp_factor = 1;
+            cinfo.comp_info[i].v_samp_factor = 1;
+        }
+    }
+
+    bool is_icc_marker(const jpeg_saved_marker_ptr marker) {
+        constexpr char ICC_SIG[] = "ICC_PROFILE";
+        if (marker->marker != JPEG_APP0 + 2)
+            return false;
+        if (marker->data_length < sizeof(ICC_SIG))
+            return false;
+        return 0 == std::memcmp(marker->data, ICC_SIG, sizeof(ICC_SIG));
+    }
+
+    // APP2 markers of at most 64 KiB each, numbered from 1
+    void write_icc_markers(
+        jpeg_compress_struct& cinfo, const std::vector<unsigned char>& icc
+    ) {
+        constexpr char ICC_SIG[] = "ICC_PROFILE";
+        constexpr size_t HEADER_SIZE = sizeof(ICC_SIG) + 2;
+        constexpr size_t MAX_DATA = 65533 - HEADER_SIZE;
+
+        const auto count = (icc.size() + MAX_DATA - 1) / MAX_DATA;
+        std::vector<JOCTET> marker;
+        for (size_t i = 0; i < count; ++i) {
+            const auto begin = icc.begin() + i * MAX_DATA;
+            const auto end = icc.begin() +
+                             std::min(icc.size(), (i + 1) * MAX_DATA);
+            marker.assign(ICC_SIG, ICC_SIG + sizeof(ICC_SIG));
+            marker.push_back(static_cast<JOCTET>(i + 1));
+            marker.push_back(static_cast<JOCTET>(count));
+            marker.insert(marker.end(), begin, end);
+            jpeg_write_marker(
+                &cinfo,
+                JPEG_APP0 + 2,
+                marker.data(),
+                static_cast<unsigned>(marker.size())
+            );
+        }
+    }
+
+    // APP1 Exif with a single big-endian IFD holding only the orientation
+    void write_orientation_marker(
+        jpeg_compress_struct& cinfo, const int orientation
+    ) {
+        const JOCTET marker[] = {
+            'E', 'x', 'i', 'f', 0, 0,
+            // TIFF header, IFD at offset 8
+            'M', 'M', 0, 42, 0, 0, 0, 8,
+            // One entry: tag 0x0112, SHORT, count 1, value
+            0, 1, 0x01, 0x12, 0, 3, 0, 0, 0, 1,
+            0, static_cast<JOCTET>(orientation), 0, 0,
+            // No next IFD
+            0, 0, 0, 0,
+        };
+        jpeg_write_marker(&cinfo, JPEG_APP0 + 1, marker, sizeof(marker));
+    }
+
+}  // namespace
+
+
+// PNG
+namespace {
+
+    struct PngWriteCtx {
+        std::vector<unsigned char>* out_ = nullptr;
+        char msg_[256] = {};
+    };
+
+    void png_write_to_vec(png_structp png, png_bytep data, png_size_t size) {
+        auto ctx = static_cast<PngWriteCtx*>(png_get_io_ptr(png));
+        ctx->out_->insert(ctx->out_->end(), data, data + size);
+    }
+
+    void png_flush_noop(png_structp png) {}
+
+    void png_error_fn(png_structp png, png_const_charp msg) {
+        auto ctx = static_cast<PngWriteCtx*>(png_get_error_ptr(png));
+        std::snprintf(ctx->msg_, sizeof(ctx->msg_), "%s", msg);
+        png_longjmp(png, 1);
+    }
+
+    void png_warning_fn(png_structp png, png_const_charp msg) {}
+
+    int select_png_color_type(int nchannels) {
+        switch (nchannels) {
+            case 1:
+                return PNG_COLOR_TYPE_GRAY;
+            case 2:
+                return PNG_COLOR_TYPE_GRAY_ALPHA;
+            case 3:
+                return PNG_COLOR_TYPE_RGB;
+            case 4:
+                return PNG_COLOR_TYPE_RGB_ALPHA;
+            default:
+                return -1;
+        }
+    }
+
+    void append_be32(std::vector<unsigned char>& out, uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back(static_cast<unsigned char>(value >> shift));
+    }
+
+    std::vector<unsigned char> make_png_chunk(
+        const char* type, const std::vector<unsigned char>& body
+    ) {
+        std::vector<unsigned char> out;
+        out.reserve(body.size() + 12);
+        ::append_be32(out, static_cast<uint32_t>(body.size()));
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), body.begin(), body.end());
+        const auto crc = ::crc32(
+            0, out.data() + 4, static_cast<uInt>(body.size() + 4)
+        );
+        ::append_be32(out, static_cast<uint32_t>(crc));
+        return out;
+    }
+
+}  // namespace
+
+
+// WebP
+namespace {
+
+    int webp_write_to_vec(
+        const uint8_t* data, size_t size, const WebPPicture* pic
+    ) {
+        auto out = static_cast<std::vector<unsigned char>*>(pic->custom_ptr);
+        out->insert(out->end(), data, data + size);
+        return 1;
+    }
+
+    class WebPPictureGuard {
+
+    public:
+        WebPPictureGuard() { ok_ = WebPPictureInit(&pic_); }
+        ~WebPPictureGuard() { WebPPictureFree(&pic_); }
+
+        WebPPicture& get() { return pic_; }
+        bool ok() const { return ok_; }
+
+    private:
+        WebPPicture pic_;
+        bool ok_ = false;
+    };
+
+}  // namespace
+
+
+namespace sung::codec {
+
+    std::string encode_jpeg(
+        std::vector<unsigned char>& out,
+        const PixelView& img,
+        int quality,
+        const JpegOptions& options,
+        const ImageMetadata& metadata
+    ) {
+        if (img.bytes_per_ch_ != 1)
+            return "JPEG encoder only accepts 8-bit samples";
+
+        jpeg_compress_struct cinfo;
+        JpegErrorMgr jerr;
+        JpegMemDest dest;
+
+        cinfo.err = jpeg_std_error(&jerr.pub_);
+        jerr.pub_.error_exit = ::jpeg_error_exit;
+        jerr.pub_.output_message = ::jpeg_output_message;
+
+        if (setjmp(jerr.jmp_)) {
+            jpeg_destroy_compress(&cinfo);
+            return fmt::format("libjpeg: {}", jerr.msg_);
+        }
+
+        jpeg_create_compress(&cinfo);
+        jpeg_mem_dest(&cinfo, &dest.buf_, &dest.size_);
+
+        cinfo.image_width = img.width_;
+        cinfo.image_height = img.height_;
+        if (!::set_jpeg_color_space(cinfo, img.nchannels_)) {
+            jpeg_destroy_compress(&cinfo);
+            return fmt::format(
+                "JPEG encoder cannot handle {} channels", img.nchannels_
+            );
+        }
+
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, quality, TRUE);
+        ::set_jpeg_subsampling(cinfo, options.subsampling_);
+        cinfo.optimize_coding = options.optimize_coding_ ? TRUE : FALSE;
+        if (options.progressive_)
+            jpeg_simple_progression(&cinfo);
+
+        jpeg_start_compress(&cinfo, TRUE);
+        if (metadata.orientation_ >= 2 && metadata.orientation_ <= 8)
+            ::write_orientation_marker(cinfo, metadata.orientation_);
+        if (!metadata.icc_.empty())
+            ::write_icc_markers(cinfo, metadata.icc_);
+        while (cinfo.next_scanline < cinfo.image_height) {
+            auto row = const_cast<JSAMPROW>(img.row(cinfo.next_scanline));
+            jpeg_write_scanlines(&cinfo, &row, 1);
+        }
+        jpeg_finish_compress(&cinfo);
+        jpeg_destroy_compress(&cinfo);
+
+        out.insert(out.end(), dest.buf_, dest.buf_ + dest.size_);
+        return {};
+    }
+
+    std::string transcode_jpeg(
+        std::vector<unsigned char>& out,
+        const unsigned char* jpeg_data,
+        size_t jpeg_size,
+        const JpegTranscodeOptions& options
+    ) {
+        jpeg_decompress_struct src{};
+        jpeg_compress_struct dst{};
+        JpegErrorMgr jerr;
+        JpegMemDest dest;
+
+        src.err = jpeg_std_error(&jerr.pub_);
+        dst.err = &jerr.pub_;
+        jerr.pub_.error_exit = ::jpeg_error_exit;
+        jerr.pub_.output_message = ::jpeg_output_message;
+
+        // Both are safe to destroy even if never created since mem is null
+        if (setjmp(jerr.jmp_)) {
+            jpeg_destroy_compress(&dst);
+            jpeg_destroy_decompress(&src);
+            return fmt::format("libjpeg: {}", jerr.msg_);
+        }
+
+        jpeg_create_decompress(&src);
+        jpeg_create_compress(&dst);
+
+        jpeg_mem_src(&src, jpeg_data, static_cast<unsigned long>(jpeg_size));
+        if (options.keep_icc_)
+            jpeg_save_markers(&src, JPEG_APP0 + 2, 0xFFFF);
+        jpeg_read_header(&src, TRUE);
+
+        const auto coefs = jpeg_read_coefficients(&src);
+        jpeg_copy_critical_parameters(&src, &dst);
+        dst.optimize_coding = TRUE;
+        if (options.progressive_)
+            jpeg_simple_progression(&dst);
+
+        jpeg_mem_dest(&dst, &dest.buf_, &dest.size_);
+        jpeg_write_coefficients(&dst, coefs);
+
+        for (auto m = src.marker_list; m; m = m->next) {
+            if (::is_icc_marker(m))
+                jpeg_write_marker(&dst, m->marker, m->data, m->data_length);
+        }
+
+        jpeg_finish_compress(&dst);
+        jpeg_destroy_compress(&dst);
+        jpeg_finish_decompress(&src);
+        jpeg_destroy_decompress(&src);
+
+        out.insert(out.end(), dest.buf_, dest.buf_ + dest.size_);
+        return {};
+    }
+
+    std::string decode_jpeg_grey_reduced(
+        GreyImage& out, const unsigned char* jpeg_data, size_t jpeg_size
+    ) {
+        jpeg_decompress_struct cinfo{};
+        JpegErrorMgr jerr;
+
+        cinfo.err = jpeg_std_error(&jerr.pub_);
+        jerr.pub_.error_exit = ::jpeg_error_exit;
+        jerr.pub_.output_message = ::jpeg_output_message;
+
+        if (setjmp(jerr.jmp_)) {
+            jpeg_destroy_decompress(&cinfo);
+            return fmt::format("libjpeg: {}", jerr.msg_);
+        }
+
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, jpeg_data, static_cast<unsigned long>(jpeg_size));
+        jpeg_read_header(&cinfo, TRUE);
+
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = 8;
+        cinfo.out_color_space = JCS_GRAYSCALE;
+        cinfo.dct_method = JDCT_IFAST;
+        cinfo.do_fancy_upsampling = FALSE;
+
+        jpeg_start_decompress(&cinfo);
+        out.width_ = cinfo.output_width;
+        out.height_ = cinfo.output_height;
+        out.pixels_.resize(size_t(out.width_) * out.height_);
+        while (cinfo.output_scanline < cinfo.output_height) {
+            JSAMPROW row = out.pixels_.data() +
+                           size_t(cinfo.output_scanline) * out.width_;
+            jpeg_read_scanlines(&cinfo, &row, 1);
+        }
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+
+        return {};
+    }
+
+    std::string encode_png(
+        std::vector<unsigned char>& out,
+        const PixelView& img,
+        int compression_level,
+        const PngOptions& options
+    ) {
+        const auto color_type = ::select_png_color_type(img.nchannels_);
+        if (color_type < 0)
+            return fmt::format(
+                "PNG encoder cannot handle {} channels", img.nchannels_
+            );
+        if (img.bytes_per_ch_ != 1 && img.bytes_per_ch_ != 2)
+            return "PNG encoder only accepts 8 or 16-bit samples";
+
+        PngWriteCtx ctx;
+        ctx.out_ = &out;
+
+        auto png = png_create_write_struct(
+            PNG_LIBPNG_VER_STRING, &ctx, ::png_error_fn, ::png_warning_fn
+        );
+        if (!png)
+            return "png_create_write_struct failed";
+        auto info = png_create_info_struct(png);
+        if (!info) {
+            png_destroy_write_struct(&png, nullptr);
+            return "png_create_info_struct failed";
+        }
+
+        if (setjmp(png_jmpbuf(png))) {
+            png_destroy_write_struct(&png, &info);
+            return fmt::format("libpng: {}", ctx.msg_);
+        }
+
+        png_set_write_fn(png, &ctx, ::png_write_to_vec, ::png_flush_noop);
+        png_set_compression_level(png, compression_level);
+        if (options.filters_ != 0)
+            png_set_filter(png, PNG_FILTER_TYPE_BASE, options.filters_);
+        if (options.zlib_strategy_ >= 0)
+            png_set_compression_strategy(png, options.zlib_strategy_);
+
+        png_set_IHDR(
+            png,
+            info,
+            img.width_,
+            img.height_,
+            img.bytes_per_ch_ * 8,
+            color_type,
+            PNG_INTERLACE_NONE,
+            PNG_COMPRESSION_TYPE_BASE,
+            PNG_FILTER_TYPE_BASE
+        );
+        png_write_info(png, info);
+
+        // PNG stores 16-bit samples big-endian
+        if (img.bytes_per_ch_ == 2) {
+            constexpr uint16_t probe = 1;
+            if (*reinterpret_cast<const uint8_t*>(&probe) == 1)
+                png_set_swap(png);
+        }
+
+        for (int y = 0; y < img.height_; ++y)
+            png_write_row(png, img.row(y));
+
+        png_write_end(png, nullptr);
+        png_destroy_write_struct(&png, &info);
+        return {};
+    }
+
+    std::string insert_png_color_chunks(
+        std::vector<unsigned char>& png, const ColorProfile& color
+    ) {
+        if (color.empty())
+            return {};
+
+        // Signature, then the IHDR chunk with its 13 byte body
+        constexpr size_t IHDR_END = 8 + 12 + 13;
+        if (png.size() < IHDR_END || std::memcmp(png.data() + 12, "IHDR", 4))
+            return "Not a PNG stream";
+
+        std::vector<unsigned char> chunk;
+        if (!color.icc_.empty()) {
+            // Profile name, its null terminator and compression method 0
+            constexpr std::string_view NAME{ "ICC Profile\0\0", 13 };
+            std::vector<unsigned char> body(NAME.begin(), NAME.end());
+            auto size = ::compressBound(color.icc_.size());
+            body.resize(NAME.size() + size);
+            const auto res = ::compress2(
+                body.data() + NAME.size(),
+                &size,
+                color.icc_.data(),
+                color.icc_.size(),
+                Z_BEST_COMPRESSION
+            );
+            if (res != Z_OK)
+                return "Failed to compress the ICC profile";
+            body.resize(NAME.size() + size);
+            chunk = ::make_png_chunk("iCCP", body);
+        } else if (color.srgb_) {
+            // Perceptual rendering intent
+            chunk = ::make_png_chunk("sRGB", { 0 });
+        } else {
+            std::vector<unsigned char> body;
+            ::append_be32(
+                body, static_cast<uint32_t>(std::lround(1e5 / color.gamma_))
+            );
+            chunk = ::make_png_chunk("gAMA", body);
+        }
+
+        png.insert(png.begin() + IHDR_END, chunk.begin(), chunk.end());
+        return {};
+    }
+
+    std::string encode_webp(
+        std::vector<unsigned char>& out,
+        const PixelView& img,
+        float quality,
+        bool lossless,
+        const WebpOptions& options
+    ) {
+        if (img.bytes_per_ch_ != 1)
+            return "WebP encoder only accepts 8-bit samples";
+        if (img.nchannels_ != 3 && img.nchannels_ != 4)
+            return fmt::format(
+                "WebP encoder cannot handle {} channels", img.nchannels_
+            );
+
+        WebPConfig config;
+        if (!WebPConfigPreset(&config, WEBP_PRESET_DEFAULT, quality))
+            return "WebPConfigPreset failed";
+        config.lossless = lossless ? 1 : 0;
+        config.method = options.method_;
+        config.exact = options.exact_ ? 1 : 0;
+        if (!WebPValidateConfig(&config))
+            return "Invalid WebP config";
+
+        WebPPictureGuard pic;
+        if (!pic.ok())
+            return "WebPPictureInit failed";
+
+        auto& p = pic.get();
+        p.use_argb = lossless ? 1 : 0;
+        p.width = img.width_;
+        p.height = img.height_;
+
+        const auto stride = static_cast<int>(img.row_stride_);
+        const auto imported = img.nchannels_ == 4
+                                  ? WebPPictureImportRGBA(&p, img.data_, stride)
+                                  : WebPPictureImportRGB(&p, img.data_, stride);
+        if (!imported)
+            return "WebP picture import failed";
+
+        p.writer = ::webp_write_to_vec;
+        p.custom_ptr = &out;
+        if (!WebPEncode(&config, &p))
+            return fmt::format("WebPEncode failed ({})", (int)p.error_code);
+
+        return {};
+    }
+
+}  // namespace sung::codec
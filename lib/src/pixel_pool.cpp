@@ -0,0 +1,139 @@
+#include "sung/imgref/pixel_pool.hpp"
+
+#include <atomic>
+#include <bit>
+#include <map>
+#include <vector>
+
+
+namespace {
+
+    using Block = std::unique_ptr<uint8_t[]>;
+
+    // Smaller buffers are rare enough that malloc serves them fine
+    constexpr size_t MIN_CLASS_BYTES = size_t(64) << 10;
+
+    std::atomic<uint64_t> g_hits = 0;
+    std::atomic<uint64_t> g_misses = 0;
+    std::atomic<uint64_t> g_live_bytes = 0;
+    std::atomic<uint64_t> g_idle_bytes = 0;
+    std::atomic<uint64_t> g_peak_bytes = 0;
+    std::atomic<uint64_t> g_limit_bytes = uint64_t(256) << 20;
+
+
+    // Four classes per doubling, so at most a quarter is wasted
+    size_t round_to_class(const size_t bytes) {
+        if (bytes <= MIN_CLASS_BYTES)
+            return MIN_CLASS_BYTES;
+        const auto step = std::bit_floor(bytes) / 4;
+        return (bytes + step - 1) / step * step;
+    }
+
+    void update_peak() {
+        const auto now = g_live_bytes.load() + g_idle_bytes.load();
+        auto peak = g_peak_bytes.load();
+        while (now > peak && !g_peak_bytes.compare_exchange_weak(peak, now)) {
+        }
+    }
+
+
+    class ThreadPool {
+
+    public:
+        ~ThreadPool() {
+            for (const auto& [size, blocks] : free_)
+                g_idle_bytes -= size * blocks.size();
+        }
+
+        Block take(const size_t size) {
+            const auto it = free_.find(size);
+            if (it == free_.end() || it->second.empty())
+                return nullptr;
+
+            auto out = std::move(it->second.back());
+            it->second.pop_back();
+            g_idle_bytes -= size;
+            return out;
+        }
+
+        // Frees `block` instead if that would go over the limit
+        void give(Block block, const size_t size) {
+            const auto idle = g_idle_bytes.fetch_add(size) + size;
+            if (idle > g_limit_bytes.load(std::memory_order_relaxed)) {
+                g_idle_bytes -= size;
+                return;
+            }
+            free_[size].push_back(std::move(block));
+        }
+
+    private:
+        std::map<size_t, std::vector<Block>> free_;
+    };
+
+    ThreadPool& get_thread_pool() {
+        thread_local ThreadPool pool;
+        return pool;
+    }
+
+}  // namespace
+
+
+// PixelBuffer
+namespace sung {
+
+    PixelBuffer::~PixelBuffer() { this->release(); }
+
+    PixelBuffer& PixelBuffer::operator=(PixelBuffer&& other) noexcept {
+        if (this != &other) {
+            this->release();
+            data_ = std::move(other.data_);
+            capacity_ = other.capacity_;
+        }
+        return *this;
+    }
+
+    PixelBuffer PixelBuffer::acquire(const size_t bytes) {
+        PixelBuffer out;
+        out.capacity_ = ::round_to_class(bytes);
+        out.data_ = ::get_thread_pool().take(out.capacity_);
+        if (out.data_) {
+            ++g_hits;
+        } else {
+            ++g_misses;
+            out.data_ = std::make_unique_for_overwrite<uint8_t[]>(
+                out.capacity_
+            );
+        }
+
+        g_live_bytes += out.capacity_;
+        ::update_peak();
+        return out;
+    }
+
+    void PixelBuffer::release() {
+        if (!data_)
+            return;
+
+        g_live_bytes -= capacity_;
+        ::get_thread_pool().give(std::move(data_), capacity_);
+        capacity_ = 0;
+    }
+
+}  // namespace sung
+
+
+// Free functions
+namespace sung {
+
+    void set_pixel_pool_limit(const size_t bytes) { g_limit_bytes = bytes; }
+
+    PixelPoolStats get_pixel_pool_stats() {
+        PixelPoolStats out;
+        out.hits_ = g_hits.load();
+        out.misses_ = g_misses.load();
+        out.peak_bytes_ = g_peak_bytes.load();
+        out.idle_bytes_ = g_idle_bytes.load();
+        return out;
+    }
+
+}  // namespace sung
@@ -0,0 +1,597 @@
+#include "sung/imgref/png_optimizer.hpp"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <fmt/core.h>
+#include <png.h>
+#include <zlib.h>
+
+
+// Analysis
+namespace {
+
+    uint16_t get_sample(
+        const sung::codec::PixelView& img, int x, int y, int c
+    ) {
+        const auto row = img.row(y);
+        if (img.bytes_per_ch_ == 1)
+            return row[x * img.nchannels_ + c];
+
+        uint16_t out;
+        std::memcpy(&out, row + (x * img.nchannels_ + c) * 2, 2);
+        return out;
+    }
+
+    uint8_t to_8bit(uint16_t value, int bytes_per_ch) {
+        return bytes_per_ch == 1 ? static_cast<uint8_t>(value)
+                                 : static_cast<uint8_t>(value / 257);
+    }
+
+
+    struct ImageAnalysis {
+        bool fits_8bit_ = true;
+        bool opaque_ = true;
+        bool grey_ = true;
+        // Minimum bit depth of an opaque grey image, 8 if not applicable
+        int grey_depth_ = 8;
+        // Empty if there are more than 256 colours or not 8-bit
+        std::vector<uint32_t> colors_;
+    };
+
+
+    // RGBA8 packed into uint32 with R at the lowest byte
+    uint32_t get_rgba8(const sung::codec::PixelView& img, int x, int y) {
+        const auto b = img.bytes_per_ch_;
+        uint32_t r, g, bl, a = 255;
+        switch (img.nchannels_) {
+            case 1:
+                r = g = bl = ::to_8bit(::get_sample(img, x, y, 0), b);
+                break;
+            case 2:
+                r = g = bl = ::to_8bit(::get_sample(img, x, y, 0), b);
+                a = ::to_8bit(::get_sample(img, x, y, 1), b);
+                break;
+            default:
+                r = ::to_8bit(::get_sample(img, x, y, 0), b);
+                g = ::to_8bit(::get_sample(img, x, y, 1), b);
+                bl = ::to_8bit(::get_sample(img, x, y, 2), b);
+                if (img.nchannels_ == 4)
+                    a = ::to_8bit(::get_sample(img, x, y, 3), b);
+                break;
+        }
+        return r | (g << 8) | (bl << 16) | (a << 24);
+    }
+
+    bool grey_fits_depth(const sung::codec::PixelView& img, int depth) {
+        const auto step = 255 / ((1 << depth) - 1);
+        for (int y = 0; y < img.height_; ++y) {
+            for (int x = 0; x < img.width_; ++x) {
+                const auto v = ::to_8bit(
+                    ::get_sample(img, x, y, 0), img.bytes_per_ch_
+                );
+                if (v % step != 0)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    ImageAnalysis analyze(
+        const sung::codec::PixelView& img,
+        const sung::codec::PngOptimizeOptions& options
+    ) {
+        ImageAnalysis out;
+
+        const auto nch = img.nchannels_;
+        const auto has_alpha = nch == 2 || nch == 4;
+        const auto alpha_ch = nch - 1;
+        const uint16_t max_val = img.bytes_per_ch_ == 1 ? 255 : 65535;
+
+        out.fits_8bit_ = img.bytes_per_ch_ == 1;
+        out.opaque_ = !has_alpha;
+        out.grey_ = nch < 3;
+
+        bool all_8bit = true, all_opaque = true, all_grey = true;
+        for (int y = 0; y < img.height_; ++y) {
+            for (int x = 0; x < img.width_; ++x) {
+                if (img.bytes_per_ch_ == 2 && all_8bit) {
+                    for (int c = 0; c < nch; ++c) {
+                        if (::get_sample(img, x, y, c) % 257 != 0) {
+                            all_8bit = false;
+                            break;
+                        }
+                    }
+                }
+                if (has_alpha && all_opaque) {
+                    if (::get_sample(img, x, y, alpha_ch) != max_val)
+                        all_opaque = false;
+                }
+                if (nch >= 3 && all_grey) {
+                    const auto r = ::get_sample(img, x, y, 0);
+                    if (r != ::get_sample(img, x, y, 1) ||
+                        r != ::get_sample(img, x, y, 2))
+                        all_grey = false;
+                }
+            }
+        }
+
+        if (img.bytes_per_ch_ == 2 && options.allow_bit_depth_reduction_)
+            out.fits_8bit_ = all_8bit;
+        if (has_alpha)
+            out.opaque_ = all_opaque;
+        if (nch >= 3)
+            out.grey_ = options.allow_grey_ && all_grey;
+
+        if (!out.fits_8bit_)
+            return out;
+
+        if (out.grey_ && out.opaque_ && options.allow_bit_depth_reduction_) {
+            for (const auto depth : { 1, 2, 4 }) {
+                if (::grey_fits_depth(img, depth)) {
+                    out.grey_depth_ = depth;
+                    break;
+                }
+            }
+        }
+
+        if (options.allow_palette_) {
+            std::unordered_set<uint32_t> colors;
+            colors.reserve(512);
+            for (int y = 0; y < img.height_ && colors.size() <= 256; ++y) {
+                for (int x = 0; x < img.width_; ++x) {
+                    colors.insert(::get_rgba8(img, x, y));
+                    if (colors.size() > 256)
+                        break;
+                }
+            }
+            if (colors.size() <= 256)
+                out.colors_.assign(colors.begin(), colors.end());
+        }
+
+        return out;
+    }
+
+}  // namespace
+
+
+// Reduction
+namespace {
+
+    struct ReducedImage {
+        int width_ = 0;
+        int height_ = 0;
+        int color_type_ = 0;
+        int bit_depth_ = 8;
+        size_t row_bytes_ = 0;
+        std::vector<uint8_t> rows_;
+        std::vector<png_color> palette_;
+        std::vector<png_byte> trns_;
+
+        uint8_t* row(int y) { return rows_.data() + y * row_bytes_; }
+        const uint8_t* row(int y) const {
+            return rows_.data() + y * row_bytes_;
+        }
+    };
+
+
+    int palette_depth(size_t ncolors) {
+        if (ncolors <= 2)
+            return 1;
+        if (ncolors <= 4)
+            return 2;
+        if (ncolors <= 16)
+            return 4;
+        return 8;
+    }
+
+    void pack_low_depth(uint8_t* row, int x, int depth, uint8_t value) {
+        const auto per_byte = 8 / depth;
+        const auto shift = 8 - depth * (x % per_byte + 1);
+        row[x / per_byte] |= static_cast<uint8_t>(value << shift);
+    }
+
+    void init_rows(ReducedImage& out, int channels) {
+        const auto bits = size_t(out.width_) * channels * out.bit_depth_;
+        out.row_bytes_ = (bits + 7) / 8;
+        out.rows_.assign(out.row_bytes_ * out.height_, 0);
+    }
+
+    ReducedImage reduce_to_palette(
+        const sung::codec::PixelView& img, std::vector<uint32_t> colors
+    ) {
+        // Translucent entries first keeps the tRNS chunk short
+        std::sort(colors.begin(), colors.end(), [](uint32_t a, uint32_t b) {
+            const auto a_opaque = (a >> 24) == 255;
+            const auto b_opaque = (b >> 24) == 255;
+            if (a_opaque != b_opaque)
+                return !a_opaque;
+            return a < b;
+        });
+
+        ReducedImage out;
+        out.width_ = img.width_;
+        out.height_ = img.height_;
+        out.color_type_ = PNG_COLOR_TYPE_PALETTE;
+        out.bit_depth_ = ::palette_depth(colors.size());
+        ::init_rows(out, 1);
+
+        std::unordered_map<uint32_t, uint8_t> index_of;
+        index_of.reserve(colors.size() * 2);
+        for (size_t i = 0; i < colors.size(); ++i) {
+            const auto c = colors[i];
+            index_of[c] = static_cast<uint8_t>(i);
+            out.palette_.push_back(png_color{
+                static_cast<png_byte>(c & 0xFF),
+                static_cast<png_byte>((c >> 8) & 0xFF),
+                static_cast<png_byte>((c >> 16) & 0xFF),
+            });
+            if ((c >> 24) != 255)
+                out.trns_.push_back(static_cast<png_byte>(c >> 24));
+        }
+
+        for (int y = 0; y < img.height_; ++y) {
+            auto row = out.row(y);
+            for (int x = 0; x < img.width_; ++x) {
+                const auto index = index_of[::get_rgba8(img, x, y)];
+                if (out.bit_depth_ == 8)
+                    row[x] = index;
+                else
+                    ::pack_low_depth(row, x, out.bit_depth_, index);
+            }
+        }
+
+        return out;
+    }
+
+    ReducedImage reduce_to_low_depth_grey(
+        const sung::codec::PixelView& img, int depth
+    ) {
+        ReducedImage out;
+        out.width_ = img.width_;
+        out.height_ = img.height_;
+        out.color_type_ = PNG_COLOR_TYPE_GRAY;
+        out.bit_depth_ = depth;
+        ::init_rows(out, 1);
+
+        const auto step = 255 / ((1 << depth) - 1);
+        for (int y = 0; y < img.height_; ++y) {
+            auto row = out.row(y);
+            for (int x = 0; x < img.width_; ++x) {
+                const auto v = ::to_8bit(
+                    ::get_sample(img, x, y, 0), img.bytes_per_ch_
+                );
+                ::pack_low_depth(row, x, depth, static_cast<uint8_t>(v / step));
+            }
+        }
+
+        return out;
+    }
+
+    // 8 or 16-bit grey/GA/RGB/RGBA with alpha and colour channels dropped
+    // where the analysis allows it. 16-bit samples are stored big-endian.
+    ReducedImage reduce_channels(
+        const sung::codec::PixelView& img, const ImageAnalysis& analysis
+    ) {
+        const auto has_alpha = img.nchannels_ == 2 || img.nchannels_ == 4;
+        const auto keep_alpha = has_alpha && !analysis.opaque_;
+
+        std::vector<int> src_channels;
+        if (analysis.grey_)
+            src_channels.push_back(0);
+        else
+            src_channels.insert(src_channels.end(), { 0, 1, 2 });
+        if (keep_alpha)
+            src_channels.push_back(img.nchannels_ - 1);
+
+        ReducedImage out;
+        out.width_ = img.width_;
+        out.height_ = img.height_;
+        out.bit_depth_ = analysis.fits_8bit_ ? 8 : 16;
+        if (analysis.grey_)
+            out.color_type_ = keep_alpha ? PNG_COLOR_TYPE_GRAY_ALPHA
+                                         : PNG_COLOR_TYPE_GRAY;
+        else
+            out.color_type_ = keep_alpha ? PNG_COLOR_TYPE_RGB_ALPHA
+                                         : PNG_COLOR_TYPE_RGB;
+        ::init_rows(out, static_cast<int>(src_channels.size()));
+
+        for (int y = 0; y < img.height_; ++y) {
+            auto dst = out.row(y);
+            for (int x = 0; x < img.width_; ++x) {
+                for (const auto c : src_channels) {
+                    const auto v = ::get_sample(img, x, y, c);
+                    if (out.bit_depth_ == 8) {
+                        *dst++ = ::to_8bit(v, img.bytes_per_ch_);
+                    } else {
+                        *dst++ = static_cast<uint8_t>(v >> 8);
+                        *dst++ = static_cast<uint8_t>(v & 0xFF);
+                    }
+                }
+            }
+        }
+
+        return out;
+    }
+
+    ReducedImage reduce(
+        const sung::codec::PixelView& img, const ImageAnalysis& analysis
+    ) {
+        const auto ncolors = analysis.colors_.size();
+        const auto has_palette = analysis.fits_8bit_ && ncolors > 0;
+
+        if (analysis.fits_8bit_ && analysis.grey_ && analysis.opaque_) {
+            const auto grey_depth = analysis.grey_depth_;
+            if (has_palette && ::palette_depth(ncolors) < grey_depth)
+                return ::reduce_to_palette(img, analysis.colors_);
+            if (grey_depth < 8)
+                return ::reduce_to_low_depth_grey(img, grey_depth);
+            return ::reduce_channels(img, analysis);
+        }
+
+        if (has_palette)
+            return ::reduce_to_palette(img, analysis.colors_);
+
+        return ::reduce_channels(img, analysis);
+    }
+
+}  // namespace
+
+
+// Trials
+namespace {
+
+    struct TrialSetting {
+        int filters_;
+        int strategy_;
+    };
+
+
+    std::vector<TrialSetting> make_trial_settings(const ReducedImage& img) {
+        // Filtering rarely helps indexed or sub-byte images
+        if (img.color_type_ == PNG_COLOR_TYPE_PALETTE || img.bit_depth_ < 8) {
+            return {
+                { PNG_FILTER_NONE, Z_DEFAULT_STRATEGY },
+                { PNG_FILTER_NONE, Z_RLE },
+                { PNG_ALL_FILTERS, Z_DEFAULT_STRATEGY },
+            };
+        }
+
+        return {
+            { PNG_ALL_FILTERS, Z_DEFAULT_STRATEGY },
+            { PNG_ALL_FILTERS, Z_FILTERED },
+            { PNG_FILTER_PAETH, Z_DEFAULT_STRATEGY },
+            { PNG_FILTER_SUB, Z_RLE },
+            { PNG_FILTER_UP, Z_FILTERED },
+            { PNG_FILTER_NONE, Z_DEFAULT_STRATEGY },
+        };
+    }
+
+
+    enum class TrialStatus { ok, aborted, error };
+
+    struct TrialResult {
+        TrialStatus status_ = TrialStatus::error;
+        std::vector<unsigned char> data_;
+        std::string error_;
+    };
+
+
+    struct TrialCtx {
+        std::vector<unsigned char>* out_ = nullptr;
+        const size_t* best_size_ = nullptr;
+        const sung::CancelToken* cancel_ = nullptr;
+        bool aborted_ = false;
+        bool cancelled_ = false;
+        char msg_[256] = {};
+    };
+
+    bool is_cancelled(const sung::CancelToken* cancel) {
+        return cancel && cancel->is_cancelled();
+    }
+
+    void trial_write(png_structp png, png_bytep data, png_size_t size) {
+        auto ctx = static_cast<TrialCtx*>(png_get_io_ptr(png));
+        ctx->out_->insert(ctx->out_->end(), data, data + size);
+        if (ctx->out_->size() > *ctx->best_size_) {
+            ctx->aborted_ = true;
+            png_error(png, "larger than best");
+        }
+        if (::is_cancelled(ctx->cancel_)) {
+            ctx->cancelled_ = true;
+            png_error(png, "Cancelled");
+        }
+    }
+
+    void trial_flush(png_structp png) {}
+
+    void trial_error(png_structp png, png_const_charp msg) {
+        auto ctx = static_cast<TrialCtx*>(png_get_error_ptr(png));
+        std::snprintf(ctx->msg_, sizeof(ctx->msg_), "%s", msg);
+        png_longjmp(png, 1);
+    }
+
+    void trial_warning(png_structp png, png_const_charp msg) {}
+
+    TrialResult run_trial(
+        const ReducedImage& img,
+        const TrialSetting& setting,
+        const int compression_level,
+        size_t& best_size,
+        const sung::CancelToken* cancel
+    ) {
+        TrialResult out;
+        if (::is_cancelled(cancel)) {
+            out.error_ = "Cancelled";
+            return out;
+        }
+
+        TrialCtx ctx;
+        ctx.out_ = &out.data_;
+        ctx.best_size_ = &best_size;
+        ctx.cancel_ = cancel;
+
+        auto png = png_create_write_struct(
+            PNG_LIBPNG_VER_STRING, &ctx, ::trial_error, ::trial_warning
+        );
+        if (!png) {
+            out.error_ = "png_create_write_struct failed";
+            return out;
+        }
+        auto info = png_create_info_struct(png);
+        if (!info) {
+            png_destroy_write_struct(&png, nullptr);
+            out.error_ = "png_create_info_struct failed";
+            return out;
+        }
+
+        if (setjmp(png_jmpbuf(png))) {
+            png_destroy_write_struct(&png, &info);
+            if (ctx.cancelled_) {
+                out.data_.clear();
+                out.error_ = "Cancelled";
+            } else if (ctx.aborted_) {
+                out.status_ = TrialStatus::aborted;
+                out.data_.clear();
+            } else {
+                out.error_ = fmt::format("libpng: {}", ctx.msg_);
+            }
+            return out;
+        }
+
+        png_set_write_fn(png, &ctx, ::trial_write, ::trial_flush);
+        png_set_compression_level(png, compression_level);
+        png_set_filter(png, PNG_FILTER_TYPE_BASE, setting.filters_);
+        png_set_compression_strategy(png, setting.strategy_);
+
+        png_set_IHDR(
+            png,
+            info,
+            img.width_,
+            img.height_,
+            img.bit_depth_,
+            img.color_type_,
+            PNG_INTERLACE_NONE,
+            PNG_COMPRESSION_TYPE_BASE,
+            PNG_FILTER_TYPE_BASE
+        );
+        if (!img.palette_.empty()) {
+            png_set_PLTE(
+                png,
+                info,
+                img.palette_.data(),
+                static_cast<int>(img.palette_.size())
+            );
+        }
+        if (!img.trns_.empty()) {
+            png_set_tRNS(
+                png,
+                info,
+                img.trns_.data(),
+                static_cast<int>(img.trns_.size()),
+                nullptr
+            );
+        }
+
+        png_write_info(png, info);
+        for (int y = 0; y < img.height_; ++y) {
+            // Highly compressible rows may not reach the write callback
+            if (::is_cancelled(cancel)) {
+                ctx.cancelled_ = true;
+                png_error(png, "Cancelled");
+            }
+            png_write_row(png, img.row(y));
+        }
+        png_write_end(png, nullptr);
+        png_destroy_write_struct(&png, &info);
+
+        // Shrink the bar for the next trials
+        best_size = std::min(best_size, out.data_.size());
+
+        out.status_ = TrialStatus::ok;
+        return out;
+    }
+
+}  // namespace
+
+
+namespace sung::codec {
+
+    std::string optimize_png(
+        std::vector<unsigned char>& out,
+        const PixelView& img,
+        const PngOptimizeOptions& options,
+        PngOptimizeStats* stats
+    ) {
+        if (img.nchannels_ < 1 || img.nchannels_ > 4)
+            return fmt::format(
+                "PNG optimizer cannot handle {} channels", img.nchannels_
+            );
+        if (img.bytes_per_ch_ != 1 && img.bytes_per_ch_ != 2)
+            return "PNG optimizer only accepts 8 or 16-bit samples";
+
+        const auto analysis = ::analyze(img, options);
+        const auto reduced = ::reduce(img, analysis);
+        const auto settings = ::make_trial_settings(reduced);
+
+        auto best_size = std::numeric_limits<size_t>::max();
+        std::vector<TrialResult> results;
+        results.reserve(settings.size());
+
+        // Serial, callers already keep every CPU busy with one image each
+        for (const auto& setting : settings) {
+            results.push_back(::run_trial(
+                reduced,
+                setting,
+                options.compression_level_,
+                best_size,
+                options.cancel_
+            ));
+        }
+
+        if (::is_cancelled(options.cancel_))
+            return "Cancelled";
+
+        const TrialResult* best = nullptr;
+        size_t best_index = 0;
+        int aborted = 0;
+        for (size_t i = 0; i < results.size(); ++i) {
+            const auto& r = results[i];
+            if (r.status_ == TrialStatus::aborted)
+                ++aborted;
+            if (r.status_ != TrialStatus::ok)
+                continue;
+            if (!best || r.data_.size() < best->data_.size()) {
+                best = &r;
+                best_index = i;
+            }
+        }
+
+        if (!best) {
+            for (const auto& r : results) {
+                if (!r.error_.empty())
+                    return r.error_;
+            }
+            return "All PNG trials failed";
+        }
+
+        out.insert(out.end(), best->data_.begin(), best->data_.end());
+
+        if (stats) {
+            stats->color_type_ = reduced.color_type_;
+            stats->bit_depth_ = reduced.bit_depth_;
+            stats->trials_ = static_cast<int>(results.size());
+            stats->aborted_trials_ = aborted;
+            stats->best_filters_ = settings[best_index].filters_;
+            stats->best_strategy_ = settings[best_index].strategy_;
+        }
+
+        return {};
+    }
+
+}  // namespace sung::codec
@@ -0,0 +1,158 @@
+#include "sung/imgref/refine_engine.hpp"
+
+#include <fmt/core.h>
+
+#include "sung/imgref/governor.hpp"
+
+
+namespace {
+
+    double seconds_since(std::chrono::steady_clock::time_point start) {
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double>(elapsed).count();
+    }
+
+}  // namespace
+
+
+namespace sung {
+
+    RefineEngine::RefineEngine(size_t thread_count)
+        : pool_(thread_count > 0 ? thread_count : sung::get_cpu_limit()) {
+        state_.current_.resize(pool_.get_thread_count());
+    }
+
+    RefineEngine::~RefineEngine() {
+        this->cancel();
+        this->wait();
+    }
+
+    std::string RefineEngine::start(
+        const FileList& files, const ImgRefWorkConfigs& configs
+    ) {
+        {
+            std::lock_guard lock(mut_);
+            if (state_.running_)
+                return "A batch is already running";
+        }
+        this->wait();
+
+        if (files.get_files().empty())
+            return "No files to process";
+
+        const auto output_dir = sung::make_fol_path_with_suffix(
+            configs.output_dir_.value_or(fs::temp_directory_path() / "imgref")
+        );
+        if (!output_dir)
+            return "Failed to find an output folder";
+
+        configs_ = configs;
+        output_loc_.emplace(files.get_longest_common_prefix(), *output_dir);
+        files_.assign(files.get_files().begin(), files.get_files().end());
+        cancel_token_.reset();
+
+        {
+            std::lock_guard lock(mut_);
+            const auto worker_count = state_.current_.size();
+            state_ = Snapshot{};
+            state_.running_ = true;
+            state_.total_ = files_.size();
+            state_.current_.resize(worker_count);
+            start_time_ = std::chrono::steady_clock::now();
+        }
+        this->notify();
+
+        batch_thread_ = std::thread([this] {
+            pool_
+                .submit_sequence<size_t>(
+                    0, files_.size(), [this](size_t i) { this->process(i); }
+                )
+                .wait();
+
+            {
+                std::lock_guard lock(mut_);
+                state_.running_ = false;
+                state_.elapsed_ = ::seconds_since(start_time_);
+            }
+            this->notify();
+        });
+
+        return {};
+    }
+
+    void RefineEngine::cancel() {
+        cancel_token_.cancel();
+
+        {
+            std::lock_guard lock(mut_);
+            if (!state_.running_)
+                return;
+            state_.cancelling_ = true;
+        }
+        this->notify();
+    }
+
+    void RefineEngine::wait() {
+        if (batch_thread_.joinable())
+            batch_thread_.join();
+    }
+
+    RefineEngine::Snapshot RefineEngine::get_snapshot() const {
+        std::lock_guard lock(mut_);
+        auto out = state_;
+        if (out.running_)
+            out.elapsed_ = ::seconds_since(start_time_);
+        return out;
+    }
+
+    void RefineEngine::process(size_t index) {
+        const auto& path = files_[index];
+        const auto worker = BS::this_thread::get_index().value_or(0);
+
+        WorkOutput output;
+        std::string result;
+        if (cancel_token_.is_cancelled()) {
+            output.record_.outcome_ = WorkOutcome::cancelled;
+        } else {
+            {
+                std::lock_guard lock(mut_);
+                if (worker < state_.current_.size())
+                    state_.current_[worker] = path;
+            }
+            this->notify();
+
+            WorkContext ctx{ configs_, *output_loc_ };
+            ctx.cancel_ = &cancel_token_;
+            try {
+                result = sung::refine_img(path, ctx, output);
+            } catch (const std::exception& e) {
+                output.record_.outcome_ = WorkOutcome::failed;
+                result = e.what();
+            }
+        }
+
+        {
+            const auto& rec = output.record_;
+            std::lock_guard lock(mut_);
+            if (worker < state_.current_.size())
+                state_.current_[worker].clear();
+            state_.done_ += 1;
+            state_.outcomes_[rec.outcome_] += 1;
+            if (rec.outcome_ == WorkOutcome::success) {
+                state_.src_bytes_ += rec.src_bytes_;
+                state_.dst_bytes_ += rec.dst_bytes_;
+            } else if (rec.outcome_ == WorkOutcome::failed) {
+                state_.last_error_ = fmt::format(
+                    "{}: {}", sung::make_utf8_str(path), result
+                );
+            }
+        }
+        this->notify();
+    }
+
+    void RefineEngine::notify() const {
+        if (on_update_)
+            on_update_();
+    }
+
+}  // namespace sung
@@ -0,0 +1,940 @@
+#include "sung/imgref/refinery.hpp"
+
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <random>
+#include <set>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "sung/imgref/governor.hpp"
+#include "sung/imgref/img_refinery.hpp"
+#include "sung/imgref/rendition.hpp"
+
+
+namespace {
+
+    namespace fs = std::filesystem;
+
+
+    using Harbor = sung::oiio::ImageExportHarbor;
+    using Img = sung::oiio::IImage2D;
+
+
+    // Every name a candidate is built under, for the win counters
+    constexpr std::array CANDIDATE_NAMES{
+        "jpeg 80",      "jpeg 80 monochrome", "jpeg lossless", "jxl 80",
+        "jxl lossless", "png",                "webp 80",       "webp lossless",
+    };
+
+
+    struct Candidate {
+        std::string name_;
+        std::function<void(Harbor&, const Img&)> build_;
+        // False for candidates that do not encode the given pixels
+        bool proxiable_ = true;
+    };
+
+
+    double random_unit() {
+        thread_local std::mt19937 rng{ std::random_device{}() };
+        thread_local std::uniform_real_distribution<double> dist(0, 1);
+        return dist(rng);
+    }
+
+
+    struct ProxyEstimate {
+        std::set<std::string> losers_;
+        std::map<std::string, size_t> proxy_bytes_;
+        double pixel_ratio_ = 1;
+    };
+
+
+    // Encodes a 1/4 scale proxy with every proxiable candidate and marks the
+    // ones predicted to be larger than the best by more than the band.
+    // Losers are still encoded at the explore rate so their calibration
+    // recovers from an early misprediction.
+    ProxyEstimate estimate_with_proxy(
+        const std::vector<Candidate>& candidates,
+        const std::optional<std::string>& leader,
+        const Img& img,
+        const sung::oiio::ImageSize2D& img_dim,
+        const Harbor& harbor,
+        const sung::SizeEstimator& estimator,
+        const sung::WorkContext& ctx
+    ) {
+        constexpr double PROXY_SCALE = 0.25;
+        constexpr double MIN_PIXELS = 500'000;
+
+        ProxyEstimate out;
+
+        const auto full_pixels = static_cast<double>(img_dim.width()) *
+                                 img_dim.height();
+        if (full_pixels < MIN_PIXELS)
+            return out;
+
+        size_t proxiable = 0;
+        for (const auto& c : candidates) {
+            if (c.proxiable_ && (!leader || c.name_ != *leader))
+                ++proxiable;
+        }
+        if (proxiable < 2)
+            return out;
+
+        sung::oiio::ImageSize2D proxy_dim(img_dim.width(), img_dim.height());
+        proxy_dim.resize_to_fit_into(
+            img_dim.width() * PROXY_SCALE, img_dim.height() * PROXY_SCALE
+        );
+        const auto proxy = sung::oiio::resize_img(
+            img, proxy_dim, ctx.cancel_
+        );
+        if (!proxy)
+            return out;
+
+        const auto proxy_pixels = static_cast<double>(proxy_dim.width()) *
+                                  proxy_dim.height();
+        out.pixel_ratio_ = full_pixels / proxy_pixels;
+
+        const auto& configs = ctx.configs_;
+        Harbor proxy_harbor(
+            configs.native_encoders_ ? sung::oiio::EncoderBackend::native
+                                     : sung::oiio::EncoderBackend::oiio
+        );
+        proxy_harbor.cancel_token_ = ctx.cancel_;
+        for (const auto& c : candidates) {
+            if (c.proxiable_ && (!leader || c.name_ != *leader))
+                c.build_(proxy_harbor, **proxy);
+        }
+
+        // The leader, if any, is already encoded at full size
+        double best = std::numeric_limits<double>::max();
+        for (const auto& [name, record] : harbor.get_sorted_by_size())
+            best = std::min<double>(best, record->data_.size());
+
+        std::map<std::string, double> predictions;
+        for (const auto& [name, record] : proxy_harbor.get_sorted_by_size()) {
+            out.proxy_bytes_[name] = record->data_.size();
+            const auto predicted = estimator.predict(
+                name, record->data_.size(), out.pixel_ratio_
+            );
+            // Uncalibrated candidates are always encoded in full
+            if (!predicted)
+                continue;
+            predictions[name] = *predicted;
+            best = std::min(best, *predicted);
+        }
+
+        for (const auto& [name, predicted] : predictions) {
+            if (predicted <= best * (1 + configs.estimate_band_))
+                continue;
+            if (::random_unit() < configs.explore_rate_)
+                continue;
+            out.losers_.insert(name);
+        }
+
+        return out;
+    }
+
+
+    bool is_jpeg_file(const fs::path& path) {
+        sung::AllowedExtFileFilter filter;
+        filter.add_allowed_ext(".jpg");
+        filter.add_allowed_ext(".jpeg");
+        return filter(path);
+    }
+
+
+    // Candidates that encode the given pixels, usable at any size
+    std::vector<Candidate> make_pixel_candidates(
+        const sung::ImgRefWorkConfigs& configs,
+        const sung::oiio::ImageProperties& props
+    ) {
+        std::vector<Candidate> out;
+
+        if (configs.allow_webp_) {
+            out.push_back({ "webp 80", [](Harbor& h, const Img& img) {
+                h.build_webp("webp 80", img, 80);
+            } });
+        }
+        if (configs.allow_jxl_) {
+            out.push_back({ "jxl 80", [&](Harbor& h, const Img& img) {
+                h.build_jxl("jxl 80", img, 80, configs.jxl_effort_);
+            } });
+        }
+        if (props.transparent_) {
+            out.push_back({ "png", [](Harbor& h, const Img& img) {
+                h.build_png_optimized("png", img, 9);
+            } });
+        } else {
+            out.push_back({ "jpeg 80", [](Harbor& h, const Img& img) {
+                h.build_jpeg("jpeg 80", img, 80);
+            } });
+        }
+
+        if (props.monochrome_ && !props.transparent_) {
+            const auto build_mono = [](Harbor& h, const Img& img) {
+                const auto grey = sung::oiio::merge_greyscale_channels(img);
+                if (grey)
+                    h.build_jpeg("jpeg 80 monochrome", **grey, 80);
+            };
+            out.push_back({ "jpeg 80 monochrome", build_mono });
+        }
+
+        return out;
+    }
+
+
+    struct SourceImage {
+        // File content if it was read into memory, null otherwise
+        const std::vector<unsigned char>* data_ = nullptr;
+        std::vector<unsigned char> read_data_;
+        std::unique_ptr<Img> img_;
+        sung::oiio::ImageProperties props_;
+    };
+
+    // Reads through `ctx.io_` unless `mem` is given, then decodes. Fills
+    // the source size and decode time of `rec`.
+    std::string open_source(
+        const fs::path& path,
+        const std::vector<unsigned char>* mem,
+        const sung::WorkContext& ctx,
+        sung::WorkRecord& rec,
+        SourceImage& out
+    ) {
+        const auto& metrics = ctx.metrics_;
+
+        out.data_ = mem;
+        if (!mem && ctx.io_) {
+            auto data = ctx.io_->read(path).get();
+            if (!data)
+                return data.error();
+            out.read_data_ = std::move(*data);
+            out.data_ = &out.read_data_;
+        }
+
+        std::error_code ec;
+        const auto src_size = out.data_ ? out.data_->size()
+                                        : sung::get_file_size(path, ec);
+        if (ec)
+            return fmt::format("Failed to get file size: {}", ec.message());
+        rec.src_bytes_ = src_size;
+        sung::get_io_limiter().acquire(src_size);
+        if (metrics.bytes_in_)
+            metrics.bytes_in_->inc(src_size);
+
+        sung::metrics::StageTimer decode_timer(
+            metrics.decode_, &rec.timings_.decode_
+        );
+        auto img = out.data_
+                       ? sung::oiio::open_img(path, *out.data_, ctx.cancel_)
+                       : sung::oiio::open_img(path, ctx.cancel_);
+        if (!img)
+            return img.error();
+        out.img_ = std::move(*img);
+
+        out.props_ = sung::oiio::get_img_properties(*out.img_);
+        if (out.props_.animated_)
+            return "Animated image not supported";
+        decode_timer.finish();
+
+        return {};
+    }
+
+
+    std::string write_output(
+        const fs::path& out_path,
+        const std::vector<unsigned char>& data,
+        const sung::WorkContext& ctx
+    ) {
+        sung::get_io_limiter().acquire(data.size());
+        if (ctx.archive_out_)
+            return ctx.archive_out_->add(out_path, data);
+
+        if (!ctx.io_ || !ctx.io_->makes_folders())
+            sung::create_folder(out_path.parent_path());
+        if (ctx.io_)
+            return ctx.io_->write(out_path, data).get();
+
+        std::fstream file(out_path, std::ios::out | std::ios::binary);
+        if (!file)
+            return "Failed to open file";
+        file.write((const char*)data.data(), data.size());
+        return {};
+    }
+
+}  // namespace
+
+
+// WorkMetrics
+namespace sung {
+
+    constexpr auto WINS_NAME = "imgref_candidate_wins_total";
+    constexpr auto WINS_HELP = "Outputs written per winning candidate";
+
+    void WorkMetrics::add_win(const std::string& candidate) const {
+        const auto it = wins_.find(candidate);
+        if (it != wins_.end()) {
+            it->second->inc();
+            return;
+        }
+
+        // Not in CANDIDATE_NAMES, takes the registry lock
+        if (registry_) {
+            registry_
+                ->counter(
+                    WINS_NAME,
+                    WINS_HELP,
+                    fmt::format("candidate=\"{}\"", candidate)
+                )
+                .inc();
+        }
+    }
+
+    WorkMetrics make_work_metrics(sung::metrics::Registry& registry) {
+        constexpr auto STAGE_NAME = "imgref_stage_seconds";
+        constexpr auto STAGE_HELP = "Time spent per image in each stage";
+        constexpr auto BYTES_NAME = "imgref_bytes_total";
+        constexpr auto BYTES_HELP = "Bytes read from inputs and written";
+
+        WorkMetrics out;
+        out.registry_ = &registry;
+        out.decode_ = &registry.histogram(
+            STAGE_NAME, STAGE_HELP, "stage=\"decode\""
+        );
+        out.resize_ = &registry.histogram(
+            STAGE_NAME, STAGE_HELP, "stage=\"resize\""
+        );
+        out.encode_ = &registry.histogram(
+            STAGE_NAME, STAGE_HELP, "stage=\"encode\""
+        );
+        out.write_ = &registry.histogram(
+            STAGE_NAME, STAGE_HELP, "stage=\"write\""
+        );
+        out.bytes_in_ = &registry.counter(
+            BYTES_NAME, BYTES_HELP, "direction=\"in\""
+        );
+        out.bytes_out_ = &registry.counter(
+            BYTES_NAME, BYTES_HELP, "direction=\"out\""
+        );
+        for (const auto name : ::CANDIDATE_NAMES) {
+            out.wins_[name] = &registry.counter(
+                WINS_NAME, WINS_HELP, fmt::format("candidate=\"{}\"", name)
+            );
+        }
+        return out;
+    }
+
+}  // namespace sung
+
+
+namespace {
+
+    // `mem` is the file content if it is not to be read from `path`
+    std::string refine(
+        const fs::path& path,
+        const std::vector<unsigned char>* mem,
+        const sung::WorkContext& ctx,
+        sung::WorkOutput& output
+    ) {
+        const auto& configs = ctx.configs_;
+        const auto& metrics = ctx.metrics_;
+        const auto selector = ctx.selector_;
+        const auto estimator = ctx.estimator_;
+        const auto is_cancelled = [&] {
+            return ctx.cancel_ && ctx.cancel_->is_cancelled();
+        };
+
+        auto& rec = output.record_;
+        rec.path_ = path;
+
+        ::SourceImage src;
+        const auto src_err = ::open_source(path, mem, ctx, rec, src);
+        if (!src_err.empty())
+            return src_err;
+        const auto& props = src.props_;
+        const auto src_size = rec.src_bytes_;
+
+        if (is_cancelled()) {
+            rec.outcome_ = sung::WorkOutcome::cancelled;
+            return "Cancelled";
+        }
+
+        sung::oiio::ImageSize2D img_dim(props.width_, props.height_);
+        img_dim.resize_for_jpeg();
+        img_dim.resize_to_enclose(2000, 2000);
+        if (configs.allow_webp_)
+            img_dim.resize_for_webp();
+        if (configs.allow_jxl_)
+            img_dim.resize_for_jxl();
+
+        sung::metrics::StageTimer resize_timer(
+            metrics.resize_, &rec.timings_.resize_
+        );
+        auto mod = sung::oiio::resize_img(*src.img_, img_dim, ctx.cancel_);
+        if (!mod)
+            return mod.error();
+
+        if (!props.transparent_) {
+            mod = sung::oiio::drop_alpha_ch(**mod);
+            if (!mod)
+                return mod.error();
+        }
+        resize_timer.finish();
+
+        const auto& img_mod = **mod;
+        auto candidates = ::make_pixel_candidates(configs, props);
+
+        // Coefficient-domain candidates keep the source resolution
+        std::vector<unsigned char> file_data;
+        const std::vector<unsigned char>* src_data = nullptr;
+        if (::is_jpeg_file(path) && props.orientation_ == 1 &&
+            img_dim.width() == props.width_ &&
+            img_dim.height() == props.height_) {
+            if (src.data_) {
+                src_data = src.data_;
+            } else if (auto data = sung::read_file(path)) {
+                file_data = std::move(*data);
+                src_data = &file_data;
+            }
+        }
+        if (src_data && !src_data->empty()) {
+            const auto build_jpeg_ll = [&](Harbor& h, const Img&) {
+                h.build_jpeg_lossless("jpeg lossless", *src_data);
+            };
+            candidates.push_back({ "jpeg lossless", build_jpeg_ll, false });
+
+            if (configs.allow_jxl_) {
+                const auto build_jxl_ll = [&](Harbor& h, const Img&) {
+                    h.build_jxl_from_jpeg(
+                        "jxl lossless", *src_data, configs.jxl_effort_
+                    );
+                };
+                candidates.push_back({ "jxl lossless", build_jxl_ll, false });
+            }
+        }
+
+        sung::ImageClass img_class;
+        img_class.transparent_ = props.transparent_;
+        img_class.monochrome_ = props.monochrome_;
+        img_class.width_ = img_dim.width();
+        img_class.height_ = img_dim.height();
+        img_class.src_ext_ = sung::make_utf8_str(path.extension());
+        const auto class_key = img_class.make_key();
+
+        std::optional<std::string> leader;
+        if (selector) {
+            std::vector<std::string> names;
+            for (const auto& c : candidates) names.push_back(c.name_);
+            leader = selector->pick_leader(class_key, names);
+        }
+
+        sung::metrics::StageTimer encode_timer(
+            metrics.encode_, &rec.timings_.encode_
+        );
+        Harbor harbor(
+            configs.native_encoders_ ? sung::oiio::EncoderBackend::native
+                                     : sung::oiio::EncoderBackend::oiio
+        );
+        harbor.cancel_token_ = ctx.cancel_;
+
+        // Encode the historical winner first, the rest only if it is not
+        // comfortably below the reduction threshold.
+        bool full_trial = true;
+        if (leader) {
+            for (const auto& c : candidates) {
+                if (c.name_ == *leader)
+                    c.build_(harbor, img_mod);
+            }
+
+            const auto built = harbor.get_sorted_by_size();
+            full_trial = built.empty() ||
+                         !selector->is_good_enough(
+                             built.front().second->data_.size() /
+                                 (double)src_size,
+                             configs.reduction_threshold_
+                         );
+        }
+
+        ProxyEstimate estimate;
+        if (full_trial && estimator) {
+            estimate = ::estimate_with_proxy(
+                candidates,
+                leader,
+                img_mod,
+                img_dim,
+                harbor,
+                *estimator,
+                ctx
+            );
+        }
+
+        bool pruned = false;
+        if (full_trial) {
+            for (const auto& c : candidates) {
+                if (leader && c.name_ == *leader)
+                    continue;
+                if (estimate.losers_.contains(c.name_)) {
+                    pruned = true;
+                    continue;
+                }
+                c.build_(harbor, img_mod);
+            }
+        }
+
+        const auto sorted = harbor.get_sorted_by_size();
+        encode_timer.finish();
+
+        // Candidates aborted midway are missing, so the result is not valid
+        if (is_cancelled()) {
+            rec.outcome_ = sung::WorkOutcome::cancelled;
+            return "Cancelled";
+        }
+        if (sorted.empty())
+            return "No candidate could be encoded";
+
+        if (estimator) {
+            for (const auto& [name, record] : sorted) {
+                const auto it = estimate.proxy_bytes_.find(name);
+                if (it == estimate.proxy_bytes_.end())
+                    continue;
+                estimator->calibrate(
+                    name,
+                    it->second,
+                    estimate.pixel_ratio_,
+                    record->data_.size()
+                );
+            }
+        }
+
+        // Trials after a leader are only run when it did poorly, so they
+        // would count its failures but never its wins
+        if (selector && !leader && !pruned && !sorted.empty())
+            selector->stats().add_outcome(class_key, sorted.front().first);
+
+        sung::metrics::StageTimer write_timer(
+            metrics.write_, &rec.timings_.write_
+        );
+        sung::FilePathMap img_map{ path };
+        for (auto& [name, record] : sorted) {
+            rec.candidate_ = name;
+            rec.dst_bytes_ = record->data_.size();
+            const auto ratio = record->data_.size() / (double)src_size;
+            if (ratio >= configs.reduction_threshold_) {
+                rec.outcome_ = sung::WorkOutcome::not_reduced;
+                return fmt::format("Not enough reduction ({})", ratio);
+            }
+
+            output.suffix_ = fmt::format("{}.{}", name, record->file_ext_);
+            const auto out_path = img_map.add_with_suffix(
+                output.suffix_, ctx.output_loc_
+            );
+            rec.output_path_ = out_path;
+
+            const auto err = ::write_output(out_path, record->data_, ctx);
+            if (!err.empty())
+                return err;
+
+            if (metrics.bytes_out_)
+                metrics.bytes_out_->inc(record->data_.size());
+            metrics.add_win(name);
+            break;
+        }
+
+        if (configs.inplace_) {
+            const auto res = img_map.replace_src();
+            if (!res)
+                return "Failed to replace img: " + res.error();
+            rec.output_path_ = *res;
+        }
+        write_timer.finish();
+
+        rec.outcome_ = sung::WorkOutcome::success;
+        return "success";
+    }
+
+
+    std::string refine_renditions(
+        const fs::path& path,
+        const std::vector<unsigned char>* mem,
+        const sung::WorkContext& ctx,
+        std::vector<sung::WorkOutput>& outputs
+    ) {
+        const auto& configs = ctx.configs_;
+        const auto& metrics = ctx.metrics_;
+        const auto is_cancelled = [&] {
+            return ctx.cancel_ && ctx.cancel_->is_cancelled();
+        };
+
+        struct Level {
+            const sung::RenditionProfile* profile_;
+            sung::oiio::ImageSize2D dim_;
+        };
+
+        // Timings are shared by all renditions of the file
+        sung::WorkRecord base;
+        base.path_ = path;
+        ::SourceImage src;
+        const auto src_err = ::open_source(path, mem, ctx, base, src);
+        const auto& props = src.props_;
+
+        std::vector<Level> levels;
+        for (const auto& name : configs.renditions_) {
+            const auto profile = sung::find_rendition_profile(name);
+            if (!profile)
+                continue;
+
+            auto dim = sung::make_rendition_size(
+                *profile, props.width_, props.height_
+            );
+            dim.resize_for_jpeg();
+            if (configs.allow_webp_)
+                dim.resize_for_webp();
+            if (configs.allow_jxl_)
+                dim.resize_for_jxl();
+            levels.push_back({ profile, dim });
+        }
+        // Largest first, so each level can be resized from the previous
+        std::stable_sort(
+            levels.begin(), levels.end(), [](const Level& a, const Level& b) {
+                return (int64_t)a.dim_.width() * a.dim_.height() >
+                       (int64_t)b.dim_.width() * b.dim_.height();
+            }
+        );
+
+        outputs.assign(levels.size(), {});
+        const auto fail_all = [&](sung::WorkOutcome outcome,
+                                  const std::string& msg) {
+            for (size_t i = 0; i < levels.size(); ++i) {
+                auto& rec = outputs[i].record_;
+                rec = base;
+                rec.rendition_ = levels[i].profile_->name_;
+                rec.outcome_ = outcome;
+                rec.message_ = msg;
+            }
+            return msg;
+        };
+
+        if (!src_err.empty())
+            return fail_all(sung::WorkOutcome::failed, src_err);
+        if (is_cancelled())
+            return fail_all(sung::WorkOutcome::cancelled, "Cancelled");
+
+        sung::metrics::StageTimer resize_timer(
+            metrics.resize_, &base.timings_.resize_
+        );
+        std::vector<std::unique_ptr<Img>> owned;
+        std::vector<const Img*> level_imgs;
+        const Img* prev = src.img_.get();
+        int prev_w = props.width_;
+        int prev_h = props.height_;
+        bool alpha_dropped = props.transparent_;
+        for (const auto& level : levels) {
+            const Img* img = prev;
+            const auto width = level.dim_.width();
+            const auto height = level.dim_.height();
+            if (width != prev_w || height != prev_h) {
+                auto mod = sung::oiio::resize_img(
+                    *prev, level.dim_, ctx.cancel_
+                );
+                if (!mod)
+                    return fail_all(sung::WorkOutcome::failed, mod.error());
+                owned.push_back(std::move(*mod));
+                img = owned.back().get();
+            }
+            if (!alpha_dropped) {
+                auto mod = sung::oiio::drop_alpha_ch(*img);
+                if (!mod)
+                    return fail_all(sung::WorkOutcome::failed, mod.error());
+                owned.push_back(std::move(*mod));
+                img = owned.back().get();
+                alpha_dropped = true;
+            }
+
+            level_imgs.push_back(img);
+            prev = img;
+            prev_w = width;
+            prev_h = height;
+        }
+        resize_timer.finish();
+
+        // Each rendition gets its own harbor, built in turn on the calling
+        // thread so one task keeps to one CPU
+        sung::metrics::StageTimer encode_timer(
+            metrics.encode_, &base.timings_.encode_
+        );
+        const auto candidates = ::make_pixel_candidates(configs, props);
+        std::deque<Harbor> harbors;
+        for (size_t i = 0; i < levels.size(); ++i) {
+            auto& harbor = harbors.emplace_back(
+                configs.native_encoders_ ? sung::oiio::EncoderBackend::native
+                                         : sung::oiio::EncoderBackend::oiio
+            );
+            harbor.cancel_token_ = ctx.cancel_;
+            for (const auto& c : candidates) c.build_(harbor, *level_imgs[i]);
+        }
+        encode_timer.finish();
+
+        if (is_cancelled())
+            return fail_all(sung::WorkOutcome::cancelled, "Cancelled");
+        fail_all(sung::WorkOutcome::failed, "");
+
+        sung::metrics::StageTimer write_timer(
+            metrics.write_, &base.timings_.write_
+        );
+        size_t written = 0;
+        sung::FilePathMap img_map{ path };
+        for (size_t i = 0; i < levels.size(); ++i) {
+            auto& output = outputs[i];
+            auto& rec = output.record_;
+
+            const auto sorted = harbors[i].get_sorted_by_size();
+            if (sorted.empty()) {
+                rec.message_ = "No candidate could be encoded";
+                continue;
+            }
+
+            const auto& [name, record] = sorted.front();
+            output.suffix_ = fmt::format(
+                "{}_{}.{}", rec.rendition_, name, record->file_ext_
+            );
+            const auto out_path = img_map.add_with_suffix(
+                output.suffix_, ctx.output_loc_
+            );
+            rec.candidate_ = name;
+            rec.dst_bytes_ = record->data_.size();
+            rec.output_path_ = out_path;
+
+            rec.message_ = ::write_output(out_path, record->data_, ctx);
+            if (!rec.message_.empty())
+                continue;
+
+            if (metrics.bytes_out_)
+                metrics.bytes_out_->inc(record->data_.size());
+            metrics.add_win(name);
+            rec.outcome_ = sung::WorkOutcome::success;
+            rec.message_ = "success";
+            ++written;
+        }
+        write_timer.finish();
+
+        for (auto& output : outputs) output.record_.timings_ = base.timings_;
+        return fmt::format(
+            "{} of {} renditions written", written, levels.size()
+        );
+    }
+
+
+    std::string refine_alpha_pair(
+        const fs::path& color_path,
+        const fs::path& opacity_path,
+        const fs::path& merged_path,
+        const sung::WorkContext& ctx,
+        sung::WorkOutput& output
+    ) {
+        const auto& configs = ctx.configs_;
+        const auto& metrics = ctx.metrics_;
+        const auto is_cancelled = [&] {
+            return ctx.cancel_ && ctx.cancel_->is_cancelled();
+        };
+
+        auto& rec = output.record_;
+        rec.path_ = color_path;
+        rec.outcome_ = sung::WorkOutcome::failed;
+
+        ::SourceImage color;
+        const auto color_err = ::open_source(
+            color_path, nullptr, ctx, rec, color
+        );
+        if (!color_err.empty())
+            return color_err;
+
+        ::SourceImage opacity;
+        sung::WorkRecord opacity_rec;
+        const auto opacity_err = ::open_source(
+            opacity_path, nullptr, ctx, opacity_rec, opacity
+        );
+        if (!opacity_err.empty())
+            return fmt::format("Opacity image: {}", opacity_err);
+        rec.src_bytes_ += opacity_rec.src_bytes_;
+        rec.timings_.decode_ += opacity_rec.timings_.decode_;
+
+        if (is_cancelled()) {
+            rec.outcome_ = sung::WorkOutcome::cancelled;
+            return "Cancelled";
+        }
+
+        // The only pixel transform here, so it takes the resize stage
+        sung::metrics::StageTimer merge_timer(
+            metrics.resize_, &rec.timings_.resize_
+        );
+        auto merged = sung::oiio::merge_alpha(*color.img_, *opacity.img_);
+        if (!merged)
+            return merged.error();
+        merge_timer.finish();
+
+        // Lossless only, opacity maps must survive exactly
+        sung::metrics::StageTimer encode_timer(
+            metrics.encode_, &rec.timings_.encode_
+        );
+        Harbor harbor(
+            configs.native_encoders_ ? sung::oiio::EncoderBackend::native
+                                     : sung::oiio::EncoderBackend::oiio
+        );
+        harbor.cancel_token_ = ctx.cancel_;
+        auto build_err = harbor.build_png_optimized("png", **merged, 9);
+        if (configs.allow_webp_) {
+            const auto err = harbor.build_webp_lossless(
+                "webp lossless", **merged
+            );
+            if (build_err.empty())
+                build_err = err;
+        }
+        encode_timer.finish();
+
+        if (is_cancelled()) {
+            rec.outcome_ = sung::WorkOutcome::cancelled;
+            return "Cancelled";
+        }
+        const auto sorted = harbor.get_sorted_by_size();
+        if (sorted.empty())
+            return build_err;
+
+        sung::metrics::StageTimer write_timer(
+            metrics.write_, &rec.timings_.write_
+        );
+        const auto& [name, record] = sorted.front();
+        rec.candidate_ = name;
+        rec.dst_bytes_ = record->data_.size();
+
+        sung::FilePathMap img_map{ merged_path };
+        output.suffix_ = fmt::format("{}.{}", name, record->file_ext_);
+        const auto out_path = img_map.add_with_suffix(
+            output.suffix_, ctx.output_loc_
+        );
+        rec.output_path_ = out_path;
+
+        const auto err = ::write_output(out_path, record->data_, ctx);
+        if (!err.empty())
+            return err;
+
+        if (metrics.bytes_out_)
+            metrics.bytes_out_->inc(record->data_.size());
+        metrics.add_win(name);
+        write_timer.finish();
+
+        rec.outcome_ = sung::WorkOutcome::success;
+        return "success";
+    }
+
+
+    // Work that was still unfinished when the image deadline passed is
+    // reported as timed out rather than failed or cancelled
+    std::string check_deadline(
+        const sung::CancelToken& token,
+        double seconds,
+        sung::WorkRecord& rec,
+        const std::string& result
+    ) {
+        if (!token.is_expired())
+            return result;
+        if (rec.outcome_ == sung::WorkOutcome::success ||
+            rec.outcome_ == sung::WorkOutcome::not_reduced)
+            return result;
+
+        rec.outcome_ = sung::WorkOutcome::timed_out;
+        rec.message_ = fmt::format("Exceeded {} seconds", seconds);
+        return rec.message_;
+    }
+
+}  // namespace
+
+
+namespace sung {
+
+    std::string refine_img(
+        const fs::path& path, const WorkContext& ctx, WorkOutput& output
+    ) {
+        const CancelToken token(ctx.cancel_, ctx.max_seconds_);
+        auto image_ctx = ctx;
+        image_ctx.cancel_ = &token;
+        const auto result = ::refine(path, nullptr, image_ctx, output);
+        return ::check_deadline(
+            token, ctx.max_seconds_, output.record_, result
+        );
+    }
+
+    std::string refine_img(
+        const fs::path& path,
+        const std::vector<unsigned char>& data,
+        const WorkContext& ctx,
+        WorkOutput& output
+    ) {
+        const CancelToken token(ctx.cancel_, ctx.max_seconds_);
+        auto image_ctx = ctx;
+        image_ctx.cancel_ = &token;
+        const auto result = ::refine(path, &data, image_ctx, output);
+        return ::check_deadline(
+            token, ctx.max_seconds_, output.record_, result
+        );
+    }
+
+    std::string refine_renditions(
+        const fs::path& path,
+        const WorkContext& ctx,
+        std::vector<WorkOutput>& outputs
+    ) {
+        const CancelToken token(ctx.cancel_, ctx.max_seconds_);
+        auto image_ctx = ctx;
+        image_ctx.cancel_ = &token;
+        auto result = ::refine_renditions(path, nullptr, image_ctx, outputs);
+        for (auto& output : outputs) {
+            result = ::check_deadline(
+                token, ctx.max_seconds_, output.record_, result
+            );
+        }
+        return result;
+    }
+
+    std::string refine_renditions(
+        const fs::path& path,
+        const std::vector<unsigned char>& data,
+        const WorkContext& ctx,
+        std::vector<WorkOutput>& outputs
+    ) {
+        const CancelToken token(ctx.cancel_, ctx.max_seconds_);
+        auto image_ctx = ctx;
+        image_ctx.cancel_ = &token;
+        auto result = ::refine_renditions(path, &data, image_ctx, outputs);
+        for (auto& output : outputs) {
+            result = ::check_deadline(
+                token, ctx.max_seconds_, output.record_, result
+            );
+        }
+        return result;
+    }
+
+    std::string refine_alpha_pair(
+        const fs::path& color,
+        const fs::path& opacity,
+        const fs::path& merged_name,
+        const WorkContext& ctx,
+        WorkOutput& output
+    ) {
+        const CancelToken token(ctx.cancel_, ctx.max_seconds_);
+        auto image_ctx = ctx;
+        image_ctx.cancel_ = &token;
+        const auto result = ::refine_alpha_pair(
+            color, opacity, merged_name, image_ctx, output
+        );
+        return ::check_deadline(
+            token, ctx.max_seconds_, output.record_, result
+        );
+    }
+
+}  // namespace sung
@@ -0,0 +1,669 @@
+#include "sung/imgref/result_log.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+
+#include <fmt/core.h>
+
+#include "sung/imgref/filesys.hpp"
+
+
+namespace {
+
+    namespace fs = std::filesystem;
+
+
+    constexpr size_t FLUSH_SIZE = 1 << 20;
+    constexpr auto PROGRESS_INTERVAL = std::chrono::milliseconds(500);
+    // Long runs such as --watch would otherwise keep records in memory
+    constexpr auto FLUSH_INTERVAL = std::chrono::seconds(2);
+    constexpr auto IDLE_SLEEP = std::chrono::milliseconds(10);
+
+
+    void append_json_str(std::string& out, const std::string& str) {
+        out += '"';
+        for (const char c : str) {
+            switch (c) {
+                case '"':
+                    out += "\\\"";
+                    break;
+                case '\\':
+                    out += "\\\\";
+                    break;
+                case '\n':
+                    out += "\\n";
+                    break;
+                case '\r':
+                    out += "\\r";
+                    break;
+                case '\t':
+                    out += "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20)
+                        out += fmt::format("\\u{:04x}", static_cast<int>(c));
+                    else
+                        out += c;
+            }
+        }
+        out += '"';
+    }
+
+    // Tabs, newlines and backslashes are escaped so one line is one entry
+    void append_tsv_str(std::string& out, const std::string& str) {
+        for (const char c : str) {
+            switch (c) {
+                case '\t':
+                    out += "\\t";
+                    break;
+                case '\n':
+                    out += "\\n";
+                    break;
+                case '\\':
+                    out += "\\\\";
+                    break;
+                default:
+                    out += c;
+            }
+        }
+    }
+
+    fs::path make_path_from_utf8(const std::string& str) {
+        return fs::path(std::u8string(str.begin(), str.end()));
+    }
+
+    void append_utf8(std::string& out, uint32_t cp) {
+        if (cp < 0x80) {
+            out += static_cast<char>(cp);
+        } else if (cp < 0x800) {
+            out += static_cast<char>(0xC0 | (cp >> 6));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else if (cp < 0x10000) {
+            out += static_cast<char>(0xE0 | (cp >> 12));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (cp >> 18));
+            out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (cp & 0x3F));
+        }
+    }
+
+
+    // Just enough JSON for the flat objects WorkRecord writes
+    class JsonCursor {
+
+    public:
+        explicit JsonCursor(const std::string& str) : str_(str) {}
+
+        bool consume(char c) {
+            this->skip_ws();
+            if (pos_ >= str_.size() || str_[pos_] != c)
+                return false;
+            ++pos_;
+            return true;
+        }
+
+        bool peek(char c) {
+            this->skip_ws();
+            return pos_ < str_.size() && str_[pos_] == c;
+        }
+
+        std::optional<std::string> parse_str() {
+            if (!this->consume('"'))
+                return std::nullopt;
+
+            std::string out;
+            while (pos_ < str_.size()) {
+                const auto c = str_[pos_++];
+                if (c == '"')
+                    return out;
+                if (c != '\\') {
+                    out += c;
+                    continue;
+                }
+                if (pos_ >= str_.size())
+                    return std::nullopt;
+
+                switch (str_[pos_++]) {
+                    case '"':
+                        out += '"';
+                        break;
+                    case '\\':
+                        out += '\\';
+                        break;
+                    case '/':
+                        out += '/';
+                        break;
+                    case 'b':
+                        out += '\b';
+                        break;
+                    case 'f':
+                        out += '\f';
+                        break;
+                    case 'n':
+                        out += '\n';
+                        break;
+                    case 'r':
+                        out += '\r';
+                        break;
+                    case 't':
+                        out += '\t';
+                        break;
+                    case 'u': {
+                        auto cp = this->parse_hex4();
+                        if (!cp)
+                            return std::nullopt;
+                        // Surrogate pair
+                        if (*cp >= 0xD800 && *cp < 0xDC00 &&
+                            this->consume('\\') && this->consume('u')) {
+                            const auto low = this->parse_hex4();
+                            if (!low)
+                                return std::nullopt;
+                            *cp = 0x10000 + ((*cp - 0xD800) << 10) +
+                                  (*low - 0xDC00);
+                        }
+                        ::append_utf8(out, *cp);
+                        break;
+                    }
+                    default:
+                        return std::nullopt;
+                }
+            }
+            return std::nullopt;
+        }
+
+        template <typename T>
+        std::optional<T> parse_num() {
+            this->skip_ws();
+            const auto begin = str_.data() + pos_;
+            const auto end = str_.data() + str_.size();
+            T out{};
+            const auto [ptr, ec] = std::from_chars(begin, end, out);
+            if (ec != std::errc{})
+                return std::nullopt;
+            pos_ += ptr - begin;
+            return out;
+        }
+
+        // Skips any scalar or nested value
+        bool skip_value() {
+            if (this->peek('"'))
+                return this->parse_str().has_value();
+
+            int depth = 0;
+            while (pos_ < str_.size()) {
+                const auto c = str_[pos_];
+                if (c == '"') {
+                    if (!this->parse_str())
+                        return false;
+                    continue;
+                }
+                if (c == '{' || c == '[') {
+                    ++depth;
+                } else if (c == '}' || c == ']') {
+                    if (depth == 0)
+                        return true;
+                    --depth;
+                } else if (c == ',' && depth == 0) {
+                    return true;
+                }
+                ++pos_;
+            }
+            return depth == 0;
+        }
+
+    private:
+        void skip_ws() {
+            while (pos_ < str_.size()) {
+                const auto c = str_[pos_];
+                if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+                    break;
+                ++pos_;
+            }
+        }
+
+        std::optional<uint32_t> parse_hex4() {
+            if (pos_ + 4 > str_.size())
+                return std::nullopt;
+            uint32_t out = 0;
+            const auto begin = str_.data() + pos_;
+            const auto [ptr, ec] = std::from_chars(begin, begin + 4, out, 16);
+            if (ec != std::errc{} || ptr != begin + 4)
+                return std::nullopt;
+            pos_ += 4;
+            return out;
+        }
+
+        const std::string& str_;
+        size_t pos_ = 0;
+    };
+
+
+    bool parse_timings(JsonCursor& cur, sung::StageTimings& out) {
+        if (!cur.consume('{'))
+            return false;
+        if (cur.consume('}'))
+            return true;
+
+        do {
+            const auto key = cur.parse_str();
+            if (!key || !cur.consume(':'))
+                return false;
+
+            double* dst = nullptr;
+            if (*key == "decode")
+                dst = &out.decode_;
+            else if (*key == "resize")
+                dst = &out.resize_;
+            else if (*key == "encode")
+                dst = &out.encode_;
+            else if (*key == "write")
+                dst = &out.write_;
+
+            if (dst) {
+                const auto value = cur.parse_num<double>();
+                if (!value)
+                    return false;
+                *dst = *value;
+            } else if (!cur.skip_value()) {
+                return false;
+            }
+        } while (cur.consume(','));
+
+        return cur.consume('}');
+    }
+
+    double seconds_since(std::chrono::steady_clock::time_point start) {
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double>(elapsed).count();
+    }
+
+    std::string format_duration(double seconds) {
+        const auto total = static_cast<uint64_t>(seconds);
+        return fmt::format(
+            "{}:{:02}:{:02}", total / 3600, total / 60 % 60, total % 60
+        );
+    }
+
+}  // namespace
+
+
+// WorkRecord
+namespace sung {
+
+    const char* to_str(WorkOutcome outcome) {
+        switch (outcome) {
+            case WorkOutcome::success:
+                return "success";
+            case WorkOutcome::not_reduced:
+                return "not_reduced";
+            case WorkOutcome::failed:
+                return "failed";
+            case WorkOutcome::cancelled:
+                return "cancelled";
+            case WorkOutcome::timed_out:
+                return "timed_out";
+        }
+        return "unknown";
+    }
+
+    std::optional<WorkOutcome> parse_work_outcome(const std::string& str) {
+        for (const auto x : { WorkOutcome::success,
+                              WorkOutcome::not_reduced,
+                              WorkOutcome::failed,
+                              WorkOutcome::cancelled,
+                              WorkOutcome::timed_out }) {
+            if (str == sung::to_str(x))
+                return x;
+        }
+        return std::nullopt;
+    }
+
+    std::string WorkRecord::make_json() const {
+        std::string out = "{\"path\":";
+        ::append_json_str(out, sung::make_utf8_str(path_));
+        if (!rendition_.empty()) {
+            out += ",\"rendition\":";
+            ::append_json_str(out, rendition_);
+        }
+        out += ",\"outcome\":";
+        ::append_json_str(out, sung::to_str(outcome_));
+        out += ",\"message\":";
+        ::append_json_str(out, message_);
+        out += ",\"candidate\":";
+        ::append_json_str(out, candidate_);
+        out += ",\"output\":";
+        ::append_json_str(out, sung::make_utf8_str(output_path_));
+        out += fmt::format(
+            ",\"src_bytes\":{},\"dst_bytes\":{}", src_bytes_, dst_bytes_
+        );
+        if (duplicate_of_) {
+            out += ",\"duplicate_of\":";
+            ::append_json_str(out, sung::make_utf8_str(*duplicate_of_));
+        }
+        if (similar_to_) {
+            out += ",\"similar_to\":";
+            ::append_json_str(out, sung::make_utf8_str(*similar_to_));
+        }
+        out += fmt::format(
+            ",\"seconds\":{{\"decode\":{:.6f},\"resize\":{:.6f},"
+            "\"encode\":{:.6f},\"write\":{:.6f}}}}}\n",
+            timings_.decode_,
+            timings_.resize_,
+            timings_.encode_,
+            timings_.write_
+        );
+        return out;
+    }
+
+    std::optional<WorkRecord> WorkRecord::from_json(const std::string& line) {
+        ::JsonCursor cur(line);
+        if (!cur.consume('{'))
+            return std::nullopt;
+
+        WorkRecord out;
+        bool has_path = false;
+        if (!cur.peek('}')) {
+            do {
+                const auto key = cur.parse_str();
+                if (!key || !cur.consume(':'))
+                    return std::nullopt;
+
+                if (*key == "seconds") {
+                    if (!::parse_timings(cur, out.timings_))
+                        return std::nullopt;
+                    continue;
+                }
+                if (*key == "src_bytes" || *key == "dst_bytes") {
+                    const auto value = cur.parse_num<uint64_t>();
+                    if (!value)
+                        return std::nullopt;
+                    (*key == "src_bytes" ? out.src_bytes_ : out.dst_bytes_) =
+                        *value;
+                    continue;
+                }
+                if (!cur.peek('"')) {
+                    if (!cur.skip_value())
+                        return std::nullopt;
+                    continue;
+                }
+
+                const auto value = cur.parse_str();
+                if (!value)
+                    return std::nullopt;
+                if (*key == "path") {
+                    out.path_ = ::make_path_from_utf8(*value);
+                    has_path = true;
+                } else if (*key == "rendition") {
+                    out.rendition_ = *value;
+                } else if (*key == "outcome") {
+                    const auto outcome = sung::parse_work_outcome(*value);
+                    if (!outcome)
+                        return std::nullopt;
+                    out.outcome_ = *outcome;
+                } else if (*key == "message") {
+                    out.message_ = *value;
+                } else if (*key == "candidate") {
+                    out.candidate_ = *value;
+                } else if (*key == "output") {
+                    out.output_path_ = ::make_path_from_utf8(*value);
+                } else if (*key == "duplicate_of") {
+                    out.duplicate_of_ = ::make_path_from_utf8(*value);
+                } else if (*key == "similar_to") {
+                    out.similar_to_ = ::make_path_from_utf8(*value);
+                }
+            } while (cur.consume(','));
+        }
+
+        if (!cur.consume('}') || !has_path)
+            return std::nullopt;
+        return out;
+    }
+
+}  // namespace sung
+
+
+// ResultSink
+namespace sung {
+
+    ResultSink::~ResultSink() { this->finish(); }
+
+    std::string ResultSink::start(const ResultSinkConfigs& configs) {
+        configs_ = configs;
+
+        if (configs_.log_path_) {
+            if (*configs_.log_path_ == "-") {
+                out_ = &std::cout;
+                configs_.progress_ = false;
+            } else {
+                file_.open(
+                    *configs_.log_path_, std::ios::out | std::ios::binary
+                );
+                if (!file_)
+                    return fmt::format(
+                        "Failed to open result log: {}",
+                        sung::make_utf8_str(*configs_.log_path_)
+                    );
+                out_ = &file_;
+            }
+        }
+
+        if (configs_.manifest_path_) {
+            manifest_file_.open(
+                *configs_.manifest_path_, std::ios::out | std::ios::binary
+            );
+            if (!manifest_file_)
+                return fmt::format(
+                    "Failed to open output manifest: {}",
+                    sung::make_utf8_str(*configs_.manifest_path_)
+                );
+            manifest_buffer_ = "# input\toutput\tsrc_bytes\tdst_bytes\n";
+        }
+
+        buffer_.reserve(FLUSH_SIZE + 4096);
+        start_time_ = std::chrono::steady_clock::now();
+        thread_ = std::thread([this] { this->run(); });
+        return {};
+    }
+
+    void ResultSink::push(WorkRecord record) {
+        queue_.push(std::move(record));
+    }
+
+    void ResultSink::finish() {
+        if (!thread_.joinable())
+            return;
+
+        stop_.store(true, std::memory_order_release);
+        thread_.join();
+
+        if (file_.is_open())
+            file_.close();
+        if (manifest_file_.is_open())
+            manifest_file_.close();
+        out_ = nullptr;
+    }
+
+    void ResultSink::run() {
+        auto last_progress = std::chrono::steady_clock::now();
+        auto last_flush = last_progress;
+
+        while (true) {
+            // Every push before finish() is visible once this reads true
+            const auto stopping = stop_.load(std::memory_order_acquire);
+
+            size_t popped = 0;
+            while (auto record = queue_.pop()) {
+                ++popped;
+                ++done_;
+                summary_.outcomes_[record->outcome_] += 1;
+                if (record->outcome_ == WorkOutcome::success) {
+                    summary_.src_bytes_ += record->src_bytes_;
+                    summary_.dst_bytes_ += record->dst_bytes_;
+
+                    if (manifest_file_.is_open()) {
+                        auto& m = manifest_buffer_;
+                        ::append_tsv_str(m, sung::make_utf8_str(record->path_));
+                        m += '\t';
+                        ::append_tsv_str(
+                            m, sung::make_utf8_str(record->output_path_)
+                        );
+                        m += fmt::format(
+                            "\t{}\t{}\n", record->src_bytes_, record->dst_bytes_
+                        );
+                    }
+                }
+
+                if (out_)
+                    buffer_ += record->make_json();
+                if (buffer_.size() >= FLUSH_SIZE ||
+                    manifest_buffer_.size() >= FLUSH_SIZE)
+                    this->flush();
+            }
+
+            const auto now = std::chrono::steady_clock::now();
+            if (now - last_progress >= PROGRESS_INTERVAL) {
+                this->print_progress(false);
+                last_progress = now;
+            }
+            if (now - last_flush >= FLUSH_INTERVAL) {
+                this->flush();
+                last_flush = now;
+            }
+
+            if (stopping)
+                break;
+            if (popped == 0)
+                std::this_thread::sleep_for(IDLE_SLEEP);
+        }
+
+        this->flush();
+        summary_.elapsed_ = ::seconds_since(start_time_);
+        this->print_progress(true);
+    }
+
+    void ResultSink::flush() {
+        if (out_ && !buffer_.empty()) {
+            out_->write(buffer_.data(), buffer_.size());
+            out_->flush();
+        }
+        buffer_.clear();
+
+        if (manifest_file_.is_open() && !manifest_buffer_.empty()) {
+            manifest_file_.write(
+                manifest_buffer_.data(), manifest_buffer_.size()
+            );
+            manifest_file_.flush();
+        }
+        manifest_buffer_.clear();
+    }
+
+    void ResultSink::print_progress(bool final) {
+        if (!configs_.progress_)
+            return;
+
+        const auto elapsed = ::seconds_since(start_time_);
+        const auto rate = elapsed > 0 ? done_ / elapsed : 0.0;
+        const auto saved = static_cast<double>(summary_.src_bytes_) -
+                           static_cast<double>(summary_.dst_bytes_);
+
+        // Streamed inputs have no known total
+        std::string count = fmt::format("{}", done_);
+        std::string eta;
+        if (configs_.total_ > 0) {
+            count += fmt::format("/{}", configs_.total_);
+            if (configs_.total_ <= done_)
+                eta = ", ETA " + ::format_duration(0);
+            else if (rate > 0)
+                eta = ", ETA " + ::format_duration(
+                                     (configs_.total_ - done_) / rate
+                                 );
+            else
+                eta = ", ETA ?";
+        }
+
+        fmt::print(
+            "\r{} files, {:.1f} files/s, {:.1f} MB saved, elapsed {}{}   {}",
+            count,
+            rate,
+            saved / 1e6,
+            ::format_duration(elapsed),
+            eta,
+            final ? "\n" : ""
+        );
+        std::fflush(stdout);
+    }
+
+}  // namespace sung
+
+
+// Free functions
+namespace sung {
+
+    std::string merge_result_logs(
+        const std::vector<fs::path>& inputs,
+        const fs::path& output,
+        ResultSink::Summary* summary
+    ) {
+        using Key = std::pair<fs::path, std::string>;
+        std::map<Key, WorkRecord> records;
+        for (const auto& input : inputs) {
+            std::ifstream file(input, std::ios::in | std::ios::binary);
+            if (!file)
+                return fmt::format(
+                    "Failed to open result log: {}", sung::make_utf8_str(input)
+                );
+
+            std::string line;
+            size_t line_num = 0;
+            while (std::getline(file, line)) {
+                ++line_num;
+                if (line.empty())
+                    continue;
+
+                auto record = WorkRecord::from_json(line);
+                if (!record)
+                    return fmt::format(
+                        "Malformed record at {}:{}",
+                        sung::make_utf8_str(input),
+                        line_num
+                    );
+                Key key{ record->path_, record->rendition_ };
+                records.insert_or_assign(std::move(key), std::move(*record));
+            }
+        }
+
+        std::ofstream file(output, std::ios::out | std::ios::binary);
+        if (!file)
+            return fmt::format(
+                "Failed to open merged log: {}", sung::make_utf8_str(output)
+            );
+
+        ResultSink::Summary sum;
+        std::string buffer;
+        for (const auto& [key, record] : records) {
+            sum.outcomes_[record.outcome_] += 1;
+            if (record.outcome_ == WorkOutcome::success) {
+                sum.src_bytes_ += record.src_bytes_;
+                sum.dst_bytes_ += record.dst_bytes_;
+            }
+
+            buffer += record.make_json();
+            if (buffer.size() >= FLUSH_SIZE) {
+                file.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+        file.write(buffer.data(), buffer.size());
+        if (!file)
+            return "Failed to write merged log";
+
+        if (summary)
+            *summary = sum;
+        return {};
+    }
+
+}  // namespace sung
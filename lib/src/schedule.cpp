@@ -0,0 +1,88 @@
+#include "sung/imgref/schedule.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <queue>
+
+
+namespace {
+
+    // Per megapixel, relative to a JPEG encode of the same pixels
+    constexpr double JPEG_DECODE = 0.5;
+    constexpr double OTHER_DECODE = 1;
+    constexpr double JPEG_ENCODE = 1;
+    constexpr double JPEG_TRANSCODE = 0.5;
+    constexpr double PNG_ENCODE = 4;  // Filter and strategy trials
+    constexpr double WEBP_ENCODE = 3;
+    constexpr double JXL_ENCODE = 6;  // At the default effort of 7
+
+}  // namespace
+
+
+namespace sung {
+
+    double estimate_job_cost(
+        const sung::oiio::ImageHeader& header, const ImgRefWorkConfigs& configs
+    ) {
+        const auto megapixels = static_cast<double>(header.width_) *
+                                header.height_ / 1e6;
+        const auto is_jpeg = header.format_ == "jpeg";
+        // Alpha is only known after decoding, the channel count is close
+        const auto has_alpha = header.nchannels_ == 2 ||
+                               header.nchannels_ == 4;
+
+        double cost = is_jpeg ? JPEG_DECODE : OTHER_DECODE;
+        cost += has_alpha ? PNG_ENCODE : JPEG_ENCODE;
+        if (is_jpeg)
+            cost += JPEG_TRANSCODE;
+        if (configs.allow_webp_)
+            cost += WEBP_ENCODE;
+        if (configs.allow_jxl_)
+            cost += JXL_ENCODE * configs.jxl_effort_ / 7.0;
+
+        return megapixels * cost;
+    }
+
+    double probe_job_cost(
+        const fs::path& path, const ImgRefWorkConfigs& configs
+    ) {
+        const auto header = sung::oiio::probe_img(path);
+        if (!header)
+            return 0;
+        return sung::estimate_job_cost(*header, configs);
+    }
+
+    std::vector<size_t> make_lpt_order(const std::vector<double>& costs) {
+        std::vector<size_t> out(costs.size());
+        std::iota(out.begin(), out.end(), 0);
+        // Stable so equal costs keep their path order
+        std::stable_sort(out.begin(), out.end(), [&](size_t a, size_t b) {
+            return costs[a] > costs[b];
+        });
+        return out;
+    }
+
+    double simulate_makespan(
+        const std::vector<double>& costs,
+        const std::vector<size_t>& order,
+        size_t workers
+    ) {
+        if (workers == 0)
+            return 0;
+
+        // When each worker becomes idle, earliest on top
+        std::priority_queue<double, std::vector<double>, std::greater<>> idle;
+        for (size_t i = 0; i < workers; ++i) idle.push(0);
+
+        double makespan = 0;
+        for (const auto i : order) {
+            const auto finish = idle.top() + costs[i];
+            idle.pop();
+            idle.push(finish);
+            makespan = std::max(makespan, finish);
+        }
+        return makespan;
+    }
+
+}  // namespace sung
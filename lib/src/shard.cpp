@@ -0,0 +1,50 @@
+#include "sung/imgref/shard.hpp"
+
+#include <charconv>
+
+
+namespace sung {
+
+    bool ShardSpec::contains(const fs::path& rel_path) const {
+        if (count_ <= 1)
+            return true;
+        return sung::hash_path_stable(rel_path) % count_ == index_;
+    }
+
+    sung::Expected<ShardSpec, std::string> parse_shard_spec(
+        const std::string& str
+    ) {
+        const auto slash = str.find('/');
+        if (slash == std::string::npos)
+            return sung::unexpected("Shard must be in the form i/N");
+
+        ShardSpec out;
+        const auto begin = str.data();
+        const auto end = str.data() + str.size();
+        const auto [p0, e0] = std::from_chars(begin, begin + slash, out.index_);
+        const auto [p1, e1] = std::from_chars(
+            begin + slash + 1, end, out.count_
+        );
+        if (e0 != std::errc{} || e1 != std::errc{} || p0 != begin + slash ||
+            p1 != end)
+            return sung::unexpected("Shard must be in the form i/N");
+        if (out.count_ == 0 || out.index_ >= out.count_)
+            return sung::unexpected("Shard index must be less than count");
+
+        return out;
+    }
+
+    uint64_t hash_path_stable(const fs::path& path) {
+        constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+        constexpr uint64_t FNV_PRIME = 1099511628211ull;
+
+        const auto str = path.generic_u8string();
+        uint64_t hash = FNV_OFFSET;
+        for (const auto c : str) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= FNV_PRIME;
+        }
+        return hash;
+    }
+
+}  // namespace sung
@@ -0,0 +1,84 @@
+#include "sung/imgref/size_estimator.hpp"
+
+#include <cmath>
+
+#include <fmt/core.h>
+
+
+namespace sung {
+
+    SizeEstimator::SizeEstimator(double smoothing, uint64_t min_samples)
+        : smoothing_(smoothing), min_samples_(min_samples) {}
+
+    std::optional<double> SizeEstimator::predict(
+        const std::string& candidate, size_t proxy_bytes, double pixel_ratio
+    ) const {
+        std::lock_guard lock(mut_);
+
+        const auto it = entries_.find(candidate);
+        if (it == entries_.end())
+            return std::nullopt;
+        if (it->second.samples_ < min_samples_)
+            return std::nullopt;
+
+        return proxy_bytes * pixel_ratio * it->second.factor_;
+    }
+
+    void SizeEstimator::calibrate(
+        const std::string& candidate,
+        size_t proxy_bytes,
+        double pixel_ratio,
+        size_t actual_bytes
+    ) {
+        const auto raw = proxy_bytes * pixel_ratio;
+        if (raw <= 0 || actual_bytes == 0)
+            return;
+
+        std::lock_guard lock(mut_);
+        auto& entry = entries_[candidate];
+
+        // Scored like predict(), never with the uncalibrated factor
+        if (entry.samples_ > 0 && entry.samples_ >= min_samples_) {
+            const auto predicted = raw * entry.factor_;
+            const auto rel_error = (predicted - actual_bytes) / actual_bytes;
+            entry.error_.samples_ += 1;
+            entry.error_.sum_abs_rel_error_ += std::abs(rel_error);
+            entry.error_.sum_rel_error_ += rel_error;
+        }
+
+        entry.samples_ += 1;
+        const auto observed = actual_bytes / raw;
+        if (entry.samples_ == 1)
+            entry.factor_ = observed;
+        else
+            entry.factor_ += smoothing_ * (observed - entry.factor_);
+    }
+
+    std::string SizeEstimator::make_report() const {
+        std::lock_guard lock(mut_);
+
+        std::string out;
+        for (const auto& [name, entry] : entries_) {
+            const auto& err = entry.error_;
+            out += fmt::format(
+                "{}: factor {:.3f}, {} samples",
+                name,
+                entry.factor_,
+                entry.samples_
+            );
+            if (err.samples_ == 0) {
+                out += ", still warming up\n";
+                continue;
+            }
+            out += fmt::format(
+                ", mean abs error {:.1f}% and bias {:+.1f}% over {} "
+                "predictions\n",
+                100 * err.sum_abs_rel_error_ / err.samples_,
+                100 * err.sum_rel_error_ / err.samples_,
+                err.samples_
+            );
+        }
+        return out;
+    }
+
+}  // namespace sung
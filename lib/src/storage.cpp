@@ -0,0 +1,98 @@
+#include "sung/imgref/storage.hpp"
+
+#include <fstream>
+
+#include <fmt/core.h>
+
+#include "sung/imgref/filesys.hpp"
+
+
+namespace {
+
+    namespace fs = std::filesystem;
+
+
+    template <typename T>
+    std::future<T> make_ready_future(T value) {
+        std::promise<T> promise;
+        promise.set_value(std::move(value));
+        return promise.get_future();
+    }
+
+
+    class LocalStorage : public sung::IStorage {
+
+    public:
+        LocalStorage(const fs::path& root) : root_(root) {}
+
+        sung::Expected<std::vector<fs::path>, std::string> list(
+            const fs::path& prefix, const bool recursive
+        ) override {
+            const auto folder = root_ / prefix;
+            std::vector<fs::path> out;
+            std::error_code ec;
+            if (recursive) {
+                fs::recursive_directory_iterator it(folder, ec);
+                for (; !ec && it != fs::recursive_directory_iterator();
+                     it.increment(ec)) {
+                    if (it->is_regular_file(ec))
+                        out.push_back(this->make_key(it->path()));
+                }
+            } else {
+                fs::directory_iterator it(folder, ec);
+                for (; !ec && it != fs::directory_iterator();
+                     it.increment(ec)) {
+                    if (it->is_regular_file(ec))
+                        out.push_back(this->make_key(it->path()));
+                }
+            }
+
+            if (ec) {
+                return sung::unexpected(fmt::format(
+                    "Failed to list '{}': {}",
+                    sung::make_utf8_str(folder),
+                    ec.message()
+                ));
+            }
+            return out;
+        }
+
+        std::future<sung::ReadResult> read(const fs::path& path) override {
+            return ::make_ready_future(sung::read_file(root_ / path));
+        }
+
+        std::future<std::string> write(
+            const fs::path& path, const std::vector<unsigned char>& data
+        ) override {
+            const auto full_path = root_ / path;
+            sung::create_folder(full_path.parent_path());
+
+            std::ofstream file(full_path, std::ios::binary);
+            if (!file)
+                return ::make_ready_future<std::string>("Failed to open file");
+            file.write(reinterpret_cast<const char*>(data.data()), data.size());
+            if (!file)
+                return ::make_ready_future<std::string>("Failed to write file");
+            return ::make_ready_future(std::string{});
+        }
+
+        bool makes_folders() const override { return true; }
+
+    private:
+        fs::path make_key(const fs::path& path) const {
+            return path.lexically_relative(root_).generic_u8string();
+        }
+
+        fs::path root_;
+    };
+
+}  // namespace
+
+
+namespace sung {
+
+    std::unique_ptr<IStorage> make_local_storage(const fs::path& root) {
+        return std::make_unique<::LocalStorage>(root);
+    }
+
+}  // namespace sung
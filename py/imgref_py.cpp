@@ -0,0 +1,303 @@
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
+#include <pybind11/stl/filesystem.h>
+
+#include "sung/imgref/img_refinery.hpp"
+
+
+namespace {
+
+    namespace fs = std::filesystem;
+    namespace py = pybind11;
+    using Harbor = sung::oiio::ImageExportHarbor;
+    using Img = sung::oiio::IImage2D;
+
+
+    struct PyImage {
+        // Export of wrapped pixels, released only after the image is gone
+        py::buffer_info buffer_;
+        std::unique_ptr<Img> img_;
+    };
+
+
+    // Builds release the GIL, so without the lock two Python threads could
+    // build into the same harbor at once
+    struct PyHarbor {
+        explicit PyHarbor(sung::oiio::EncoderBackend backend)
+            : harbor_(backend) {}
+
+        Harbor harbor_;
+        std::mutex mut_;
+    };
+
+
+    PyImage unwrap(sung::oiio::ImgExpected&& img) {
+        if (!img)
+            throw std::runtime_error(img.error());
+        return PyImage{ {}, std::move(*img) };
+    }
+
+    void check(const std::string& err) {
+        if (!err.empty())
+            throw std::runtime_error(err);
+    }
+
+    // HxW or HxWxC of uint8 or uint16, rows may be padded but pixels must
+    // be packed within a row. The last of 2 or 4 channels is straight alpha.
+    PyImage wrap_buffer(const py::buffer& buf) {
+        auto info = buf.request();
+
+        sung::codec::PixelView view;
+        if (info.format == py::format_descriptor<uint8_t>::format())
+            view.bytes_per_ch_ = 1;
+        else if (info.format == py::format_descriptor<uint16_t>::format())
+            view.bytes_per_ch_ = 2;
+        else
+            throw py::type_error("Pixels must be uint8 or uint16");
+
+        if (info.ndim != 2 && info.ndim != 3)
+            throw py::value_error("Pixels must be HxW or HxWxC");
+
+        view.data_ = static_cast<const uint8_t*>(info.ptr);
+        view.height_ = static_cast<int>(info.shape[0]);
+        view.width_ = static_cast<int>(info.shape[1]);
+        view.nchannels_ = info.ndim == 3 ? static_cast<int>(info.shape[2])
+                                         : 1;
+        view.row_stride_ = info.strides[0];
+
+        const auto ch_packed = info.ndim == 2 ||
+                               info.strides[2] == view.bytes_per_ch_;
+        const auto px_packed = info.strides[1] ==
+                               view.nchannels_ * view.bytes_per_ch_;
+        if (!ch_packed || !px_packed)
+            throw py::value_error("Pixels within a row must be contiguous");
+
+        auto out = ::unwrap(sung::oiio::wrap_pixels(view));
+        out.buffer_ = std::move(info);
+        return out;
+    }
+
+    py::buffer_info make_buffer_info(PyImage& self) {
+        const auto view = sung::oiio::get_pixel_view(*self.img_);
+        if (!view)
+            throw std::runtime_error(view.error());
+
+        const py::ssize_t bpc = view->bytes_per_ch_;
+        const py::ssize_t nch = view->nchannels_;
+        return py::buffer_info(
+            const_cast<uint8_t*>(view->data_),
+            bpc,
+            bpc == 2 ? py::format_descriptor<uint16_t>::format()
+                     : py::format_descriptor<uint8_t>::format(),
+            3,
+            { py::ssize_t(view->height_), py::ssize_t(view->width_), nch },
+            { py::ssize_t(view->row_stride_), nch * bpc, bpc }
+        );
+    }
+
+
+    PyImage open_img(const fs::path& path) {
+        auto img = [&] {
+            py::gil_scoped_release release;
+            return sung::oiio::open_img(path);
+        }();
+        return ::unwrap(std::move(img));
+    }
+
+    PyImage open_img_data(const fs::path& name, const py::bytes& data) {
+        const auto view = static_cast<std::string_view>(data);
+        const std::vector<unsigned char> bytes(view.begin(), view.end());
+        auto img = [&] {
+            py::gil_scoped_release release;
+            return sung::oiio::open_img(name, bytes);
+        }();
+        return ::unwrap(std::move(img));
+    }
+
+    // Fits into the frame keeping the aspect ratio, never upscales
+    PyImage resize_img(const PyImage& src, int max_width, int max_height) {
+        auto img = [&] {
+            py::gil_scoped_release release;
+            const auto props = sung::oiio::get_img_properties(*src.img_);
+            sung::oiio::ImageSize2D dim(props.width_, props.height_);
+            dim.resize_to_fit_into(max_width, max_height);
+            return sung::oiio::resize_img(*src.img_, dim);
+        }();
+        return ::unwrap(std::move(img));
+    }
+
+}  // namespace
+
+
+PYBIND11_MODULE(imgref, m) {
+    m.doc() = "Image Refinery decoding, resizing and encoding. Image "
+              "pixels are shared with NumPy through the buffer protocol. "
+              "Alpha is always straight, not premultiplied, both in arrays "
+              "read from an Image and in arrays wrapped by one.";
+
+    py::class_<sung::oiio::ImageProperties>(m, "ImageProperties")
+        .def_readonly("width", &sung::oiio::ImageProperties::width_)
+        .def_readonly("height", &sung::oiio::ImageProperties::height_)
+        .def_readonly("animated", &sung::oiio::ImageProperties::animated_)
+        .def_readonly(
+            "transparent", &sung::oiio::ImageProperties::transparent_
+        )
+        .def_readonly("monochrome", &sung::oiio::ImageProperties::monochrome_)
+        .def_readonly(
+            "orientation", &sung::oiio::ImageProperties::orientation_
+        );
+
+    // numpy.asarray(img) is a view of the pixels, Image(array) refers to
+    // the array without copying
+    py::class_<PyImage>(m, "Image", py::buffer_protocol())
+        .def(py::init(&::wrap_buffer), py::arg("pixels"))
+        .def_buffer(&::make_buffer_info);
+
+    m.def("open_img", &::open_img, py::arg("path"));
+    m.def(
+        "open_img",
+        &::open_img_data,
+        py::arg("name"),
+        py::arg("data"),
+        "Decodes file content, `name` only selects the format"
+    );
+    m.def(
+        "get_img_properties",
+        [](const PyImage& img) {
+            return sung::oiio::get_img_properties(*img.img_);
+        },
+        py::arg("img"),
+        py::call_guard<py::gil_scoped_release>()
+    );
+    m.def(
+        "resize_img",
+        &::resize_img,
+        py::arg("img"),
+        py::arg("max_width"),
+        py::arg("max_height")
+    );
+
+    // Builds raise RuntimeError on failure and run without the GIL. Calls
+    // on one harbor from several threads are serialized.
+    using NoGil = py::call_guard<py::gil_scoped_release>;
+    py::class_<PyHarbor>(m, "ImageExportHarbor")
+        .def(
+            py::init([](bool native) {
+                return std::make_unique<PyHarbor>(
+                    native ? sung::oiio::EncoderBackend::native
+                           : sung::oiio::EncoderBackend::oiio
+                );
+            }),
+            py::arg("native") = false
+        )
+        .def(
+            "build_png",
+            [](PyHarbor& h,
+               const std::string& name,
+               const PyImage& img,
+               int lv) {
+                std::lock_guard lock(h.mut_);
+                ::check(h.harbor_.build_png(name, *img.img_, lv));
+            },
+            py::arg("name"),
+            py::arg("img"),
+            py::arg("compression_level") = 9,
+            NoGil()
+        )
+        .def(
+            "build_png_optimized",
+            [](PyHarbor& h,
+               const std::string& name,
+               const PyImage& img,
+               int lv) {
+                std::lock_guard lock(h.mut_);
+                ::check(h.harbor_.build_png_optimized(name, *img.img_, lv));
+            },
+            py::arg("name"),
+            py::arg("img"),
+            py::arg("compression_level") = 9,
+            NoGil()
+        )
+        .def(
+            "build_jpeg",
+            [](PyHarbor& h,
+               const std::string& name,
+               const PyImage& img,
+               int q) {
+                std::lock_guard lock(h.mut_);
+                ::check(h.harbor_.build_jpeg(name, *img.img_, q));
+            },
+            py::arg("name"),
+            py::arg("img"),
+            py::arg("quality"),
+            NoGil()
+        )
+        .def(
+            "build_webp",
+            [](PyHarbor& h,
+               const std::string& name,
+               const PyImage& img,
+               int q) {
+                std::lock_guard lock(h.mut_);
+                ::check(h.harbor_.build_webp(name, *img.img_, q));
+            },
+            py::arg("name"),
+            py::arg("img"),
+            py::arg("quality") = 100,
+            NoGil()
+        )
+        .def(
+            "build_webp_lossless",
+            [](PyHarbor& h, const std::string& name, const PyImage& img) {
+                std::lock_guard lock(h.mut_);
+                ::check(h.harbor_.build_webp_lossless(name, *img.img_));
+            },
+            py::arg("name"),
+            py::arg("img"),
+            NoGil()
+        )
+        .def(
+            "build_jxl",
+            [](PyHarbor& h,
+               const std::string& name,
+               const PyImage& img,
+               int q,
+               int effort) {
+                std::lock_guard lock(h.mut_);
+                ::check(h.harbor_.build_jxl(name, *img.img_, q, effort));
+            },
+            py::arg("name"),
+            py::arg("img"),
+            py::arg("quality"),
+            py::arg("effort") = 7,
+            NoGil()
+        )
+        .def(
+            "get_sorted_by_size",
+            [](PyHarbor& h) {
+                // Builds wait on the lock without the GIL, so no deadlock
+                std::lock_guard lock(h.mut_);
+                py::list out;
+                for (const auto& [name, record] :
+                     h.harbor_.get_sorted_by_size()) {
+                    const auto& data = record->data_;
+                    out.append(py::make_tuple(
+                        name,
+                        record->file_ext_,
+                        py::bytes(
+                            reinterpret_cast<const char*>(data.data()),
+                            data.size()
+                        )
+                    ));
+                }
+                return out;
+            },
+            "List of (name, file extension, bytes), smallest first"
+        );
+}
@@ -0,0 +1,93 @@
+"""Serves a folder as the object store that `reduce_img --storage` expects.
+
+    python object_store.py ./bucket --port 8000
+    reduce_img --storage http://127.0.0.1:8000 -r photos -o reduced
+
+GET and PUT read and write objects by key. GET /?list=<prefix> returns the
+keys under that folder one per line, add &recursive=1 for the whole tree.
+Only meant for local testing, there is no authentication.
+"""
+
+import argparse
+import os
+import urllib.parse
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+
+class ObjectStoreHandler(BaseHTTPRequestHandler):
+    root = "."
+
+    def _resolve(self, key):
+        root = os.path.realpath(self.root)
+        path = os.path.realpath(os.path.join(root, key.lstrip("/")))
+        if path != root and not path.startswith(root + os.sep):
+            return None
+        return path
+
+    def _reply(self, status, body=b""):
+        self.send_response(status)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def _list(self, query):
+        prefix = query.get("list", [""])[0]
+        recursive = query.get("recursive", ["0"])[0] == "1"
+        folder = self._resolve(prefix)
+        if folder is None or not os.path.isdir(folder):
+            return self._reply(404)
+
+        root = os.path.realpath(self.root)
+        keys = []
+        for dirpath, dirnames, filenames in os.walk(folder):
+            for name in filenames:
+                rel = os.path.relpath(os.path.join(dirpath, name), root)
+                keys.append(rel.replace(os.sep, "/"))
+            if not recursive:
+                break
+        self._reply(200, "".join(k + "\n" for k in sorted(keys)).encode())
+
+    def do_GET(self):
+        url = urllib.parse.urlsplit(self.path)
+        query = urllib.parse.parse_qs(url.query)
+        if "list" in query:
+            return self._list(query)
+
+        path = self._resolve(urllib.parse.unquote(url.path))
+        if path is None or not os.path.isfile(path):
+            return self._reply(404)
+        with open(path, "rb") as file:
+            self._reply(200, file.read())
+
+    def do_PUT(self):
+        url = urllib.parse.urlsplit(self.path)
+        path = self._resolve(urllib.parse.unquote(url.path))
+        if path is None:
+            return self._reply(403)
+
+        length = int(self.headers.get("Content-Length", 0))
+        data = self.rfile.read(length)
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, "wb") as file:
+            file.write(data)
+        self._reply(201)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("root", help="Folder holding the objects")
+    parser.add_argument("--host", default="127.0.0.1")
+    parser.add_argument("--port", type=int, default=8000)
+    args = parser.parse_args()
+
+    ObjectStoreHandler.root = args.root
+    server = ThreadingHTTPServer((args.host, args.port), ObjectStoreHandler)
+    print(f"Serving {args.root} on http://{args.host}:{args.port}")
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()